@@ -0,0 +1,505 @@
+// Microbenchmarks suite; see the Makefile bench target
+// A deterministic synthetic corpus, where terms frequencies follow a Zipfian distribution, is indexed with each codec, and then we benchmark
+// postings lists decoding(next() and advance()), conjunction/disjunction/phrase queries, segments merging and updated_documents_scanner::test().
+//
+// The report is a JSON document(one object per measurement, in results[]), so that runs can be compared, e.g before and after a codec
+// or an engine change. For every measurement, we report the best and the median of `reps` runs.
+// The same arguments (and seed) always generate the same corpus, so reports are only comparable if they were generated with the same arguments.
+#include "elias_fano_codec.h"
+#include "exec.h"
+#include "google_codec.h"
+#include "indexer.h"
+#include "lucene_codec.h"
+#include "merge.h"
+#include "segment_index_source.h"
+#include <chrono>
+#include <cinttypes>
+#include <cmath>
+#include <sys/stat.h>
+
+using namespace Trinity;
+
+namespace // static/local this module
+{
+        struct bench_config final
+        {
+                uint32_t documents{200'000};
+                uint32_t vocabulary{100'000};
+                // Zipf exponent; terms frequencies are proportional to 1/rank^skew
+                double skew{1.0};
+                // average hits per document
+                uint32_t positions{64};
+                // payload bytes per hit(0 for none)
+                uint8_t payload{0};
+                // percentage of the documents replaced in the second segment(see merge and scanner benchmarks)
+                uint32_t updates{10};
+                uint32_t reps{5};
+                uint64_t seed{1};
+                std::string dir;
+                std::vector<std::string> codecs{"google", "lucene", "eliasfano"};
+        };
+
+        // splitmix64; we want the same corpus on every platform, so we don't use <random> distributions
+        struct rng final
+        {
+                uint64_t s;
+
+                uint64_t next() noexcept
+                {
+                        uint64_t z = (s += 0x9e3779b97f4a7c15ull);
+
+                        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+                        z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+                        return z ^ (z >> 31);
+                }
+
+                double uniform() noexcept
+                {
+                        return (next() >> 11) * 0x1.0p-53;
+                }
+        };
+
+        class zipf_distribution final
+        {
+              private:
+                std::vector<double> cdf;
+
+              public:
+                zipf_distribution(const uint32_t n, const double s)
+                {
+                        double sum{0};
+
+                        cdf.reserve(n);
+                        for (uint32_t i{1}; i <= n; ++i)
+                        {
+                                sum += 1.0 / std::pow(double(i), s);
+                                cdf.push_back(sum);
+                        }
+
+                        for (auto &it : cdf)
+                                it /= sum;
+                }
+
+                // rank, in [0, n)
+                uint32_t operator()(rng &r) const noexcept
+                {
+                        const auto it = std::lower_bound(cdf.begin(), cdf.end(), r.uniform());
+
+                        return std::min<size_t>(std::distance(cdf.begin(), it), cdf.size() - 1);
+                }
+        };
+
+        struct corpus final
+        {
+                const bench_config &cfg;
+                const zipf_distribution dist;
+                simple_allocator allocator;
+                std::vector<str8_t> terms; // by rank
+
+                corpus(const bench_config &c)
+                    : cfg{c}, dist(c.vocabulary, c.skew)
+                {
+                        char buf[32];
+
+                        terms.reserve(cfg.vocabulary);
+                        for (uint32_t i{0}; i != cfg.vocabulary; ++i)
+                        {
+                                const auto len = snprintf(buf, sizeof(buf), "w%u", i);
+
+                                terms.push_back({allocator.CopyOf(buf, len), uint8_t(len)});
+                        }
+                }
+
+                // The hits of document id, in its version-th revision
+                template <typename L>
+                void document(const isrc_docid_t id, const uint32_t version, L &&l) const
+                {
+                        rng r{cfg.seed ^ (uint64_t(id) * 0xff51afd7ed558ccdull) ^ (uint64_t(version) << 56)};
+                        const uint32_t len = std::min<uint32_t>(cfg.positions / 2 + r.next() % (cfg.positions + 1), Limits::MaxPosition - 1);
+
+                        for (uint32_t pos{1}; pos <= len; ++pos)
+                        {
+                                const auto term = terms[dist(r)];
+                                const auto payload = r.next();
+
+                                l(term, tokenpos_t(pos), payload);
+                        }
+                }
+        };
+
+        struct sample final
+        {
+                double best, median;
+        };
+
+        template <typename L>
+        sample measure(const uint32_t reps, L &&l)
+        {
+                std::vector<double> v;
+
+                for (uint32_t i{0}; i != std::max<uint32_t>(reps, 1); ++i)
+                {
+                        const auto before = std::chrono::steady_clock::now();
+
+                        l();
+                        v.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - before).count());
+                }
+
+                std::sort(v.begin(), v.end());
+                return {v.front(), v[v.size() / 2]};
+        }
+
+        // Collects results into a JSON document
+        class report final
+        {
+              private:
+                std::string out;
+                bool first{true};
+
+              public:
+                // fields is a list of JSON members (e.g "\"codec\":\"lucene\""), without the braces
+                void add(const char *const bench, const std::string &fields, const sample s, const uint64_t items)
+                {
+                        char buf[256];
+
+                        snprintf(buf, sizeof(buf), ",\"best_us\":%.3f,\"median_us\":%.3f,\"items\":%" PRIu64 ",\"ns_per_item\":%.3f}", s.best, s.median, items, items ? s.best * 1000.0 / items : 0.0);
+                        out.append(first ? "\n" : ",\n").append("{\"bench\":\"").append(bench).append("\",").append(fields).append(buf);
+                        first = false;
+                }
+
+                std::string json(const bench_config &cfg) const
+                {
+                        char buf[512];
+
+                        snprintf(buf, sizeof(buf), "{\"config\":{\"documents\":%u,\"vocabulary\":%u,\"skew\":%.3f,\"positions\":%u,\"payload\":%u,\"updates\":%u,\"reps\":%u,\"seed\":%" PRIu64 "},\"results\":[",
+                                 cfg.documents, cfg.vocabulary, cfg.skew, cfg.positions, cfg.payload, cfg.updates, cfg.reps, cfg.seed);
+                        return std::string(buf).append(out).append("\n]}\n");
+                }
+        };
+
+        struct counting_filter final
+            : public MatchedIndexDocumentsFilter
+        {
+                uint64_t n{0};
+
+                void consider(const matched_document &) override final
+                {
+                        ++n;
+                }
+
+                void consider(const docid_t) override final
+                {
+                        ++n;
+                }
+
+                void consider(const docid_t, const double) override final
+                {
+                        ++n;
+                }
+        };
+}
+
+static std::string quoted(const char *const k, const std::string &v)
+{
+        return std::string("\"").append(k).append("\":\"").append(v).append("\"");
+}
+
+static std::string segment_path(const bench_config &cfg, const std::string &codec, const uint64_t gen)
+{
+        const auto base = cfg.dir + "/" + codec;
+
+        mkdir(cfg.dir.c_str(), 0775);
+        mkdir(base.c_str(), 0775);
+
+        const auto path = base + "/" + std::to_string(gen);
+
+        if (mkdir(path.c_str(), 0775) == -1 && errno != EEXIST)
+                throw Switch::system_error("Failed to create ", path.c_str());
+
+        return path;
+}
+
+static Codecs::IndexSession *new_index_session(const std::string &codec, const char *const path)
+{
+        if (codec == "google")
+                return new Codecs::Google::IndexSession(path);
+        else if (codec == "lucene")
+                return new Codecs::Lucene::IndexSession(path);
+        else if (codec == "eliasfano")
+                return new Codecs::EliasFano::IndexSession(path);
+        else
+                throw Switch::invalid_argument("Unknown codec ", codec.c_str());
+}
+
+static uint64_t file_size(const std::string &path)
+{
+        struct stat64 st;
+
+        return stat64(path.c_str(), &st) == -1 ? 0 : st.st_size;
+}
+
+// Indexes documents [1, documents] as a new segment, or, if replaceEvery is set, replaces every replaceEvery-th document
+static uint64_t index_segment(const corpus &c, const std::string &codec, const std::string &path, const uint32_t replaceEvery)
+{
+        const auto &cfg = c.cfg;
+        SegmentIndexSession sess;
+        std::unique_ptr<Codecs::IndexSession> is(new_index_session(codec, path.c_str()));
+        uint64_t hits{0};
+
+        for (isrc_docid_t id{1}; id <= cfg.documents; id += replaceEvery ?: 1)
+        {
+                auto proxy = sess.begin(id);
+
+                c.document(id, replaceEvery ? 1 : 0, [&](const str8_t term, const tokenpos_t pos, const uint64_t payload) {
+                        proxy.insert(term, pos, {reinterpret_cast<const uint8_t *>(&payload), cfg.payload});
+                        ++hits;
+                });
+
+                if (replaceEvery)
+                        sess.replace(proxy);
+                else
+                        sess.insert(proxy);
+        }
+
+        sess.commit(is.get());
+        return hits;
+}
+
+static void bench_postings(const bench_config &cfg, const corpus &c, const std::string &codec, SegmentIndexSource *const src, report &r)
+{
+        for (const uint32_t rank : {0u, 10u, 100u, 1000u, 10000u})
+        {
+                if (rank >= cfg.vocabulary)
+                        break;
+
+                const auto term = c.terms[rank];
+                const auto tctx = src->resolve_term_ctx(term);
+                const auto fields = quoted("codec", codec) + "," + quoted("term", std::string(term.data(), term.size())) + ",\"documents\":" + std::to_string(tctx.documents);
+                uint64_t n{0};
+
+                if (!tctx.documents)
+                        continue;
+
+                const auto next = measure(cfg.reps, [&]() {
+                        std::unique_ptr<Codecs::Decoder> dec(src->new_postings_decoder(term, tctx));
+                        std::unique_ptr<Codecs::PostingsListIterator> it(dec->new_iterator());
+
+                        for (n = 0; it->next() != DocIDsEND; ++n)
+                                continue;
+                });
+
+                r.add("next", fields, next, n);
+
+                // advance() to targets ~64 document IDs apart
+                const auto advance = measure(cfg.reps, [&]() {
+                        std::unique_ptr<Codecs::Decoder> dec(src->new_postings_decoder(term, tctx));
+                        std::unique_ptr<Codecs::PostingsListIterator> it(dec->new_iterator());
+
+                        n = 0;
+                        for (isrc_docid_t id = it->next(); id != DocIDsEND; id = it->advance(id + 64))
+                                ++n;
+                });
+
+                r.add("advance", fields, advance, n);
+        }
+}
+
+static void bench_queries(const bench_config &cfg, const corpus &c, const std::string &codec, SegmentIndexSource *const src, report &r)
+{
+        const auto t = [&](const uint32_t rank) {
+                const auto term = c.terms[std::min(rank, cfg.vocabulary - 1)];
+
+                return std::string(term.data(), term.size());
+        };
+        const std::pair<const char *, std::string> queries[] = {
+            {"conjunction", t(0) + " " + t(1)},
+            {"conjunction", t(0) + " " + t(100)},
+            {"conjunction", t(10) + " " + t(200) + " " + t(1000)},
+            {"disjunction", t(0) + " OR " + t(1)},
+            {"disjunction", t(5) + " OR " + t(50) + " OR " + t(500)},
+            {"phrase", "\"" + t(0) + " " + t(1) + "\""},
+            {"phrase", "\"" + t(2) + " " + t(3) + " " + t(4) + "\""},
+        };
+
+        for (const auto &it : queries)
+        {
+                const query q(strwlen32_t(it.second.data(), it.second.size()));
+
+                for (const uint32_t flags : {uint32_t(ExecFlags::DocumentsOnly), 0u})
+                {
+                        counting_filter f;
+                        const auto s = measure(cfg.reps, [&]() {
+                                f.n = 0;
+                                exec_query(q, src, nullptr, &f, nullptr, flags);
+                        });
+                        auto query = it.second;
+
+                        for (size_t i{0}; (i = query.find('"', i)) != std::string::npos; i += 2)
+                                query.insert(i, 1, '\\');
+
+                        r.add(it.first, quoted("codec", codec) + "," + quoted("query", query) + "," + quoted("mode", flags ? "documents" : "default"), s, f.n);
+                }
+        }
+}
+
+static void bench_merge(const bench_config &cfg, const std::string &codec, SegmentIndexSource *const base, SegmentIndexSource *const updates, report &r)
+{
+        const auto in = file_size(cfg.dir + "/" + codec + "/1/index") + file_size(cfg.dir + "/" + codec + "/2/index");
+        const auto s = measure(cfg.reps, [&]() {
+                const auto path = segment_path(cfg, codec, 3);
+                MergeCandidatesCollection collection;
+                simple_allocator allocator;
+                std::vector<std::pair<str8_t, term_index_ctx>> terms;
+                std::vector<docid_t> updatedDocumentIDs;
+                IndexSource::field_statistics fs;
+                std::unique_ptr<Codecs::IndexSession> is(new_index_session(codec, path.c_str()));
+                std::unique_ptr<IndexSourceTermsView> baseTerms(base->segment_terms()->new_terms_view()), updatesTerms(updates->segment_terms()->new_terms_view());
+
+                collection.insert({base->generation(), baseTerms.get(), base->access_proxy(), base->masked_documents(), base->doc_norms()});
+                collection.insert({updates->generation(), updatesTerms.get(), updates->access_proxy(), updates->masked_documents(), updates->doc_norms()});
+                collection.commit();
+
+                is->begin();
+                collection.merge(is.get(), &allocator, &terms, &fs);
+                is->persist_terms(terms);
+                persist_segment(fs, is.get(), updatedDocumentIDs);
+        });
+
+        r.add("merge", quoted("codec", codec) + ",\"input_bytes\":" + std::to_string(in), s, in);
+}
+
+static void bench_scanner(const bench_config &cfg, SegmentIndexSource *const updates, report &r)
+{
+        const auto ud = updates->masked_documents();
+
+        for (const uint32_t stride : {1u, 64u})
+        {
+                uint64_t n{0}, masked{0};
+                const auto s = measure(cfg.reps, [&]() {
+                        updated_documents_scanner scanner(ud);
+
+                        n = masked = 0;
+                        for (docid_t id{1}; id <= cfg.documents; id += stride, ++n)
+                                masked += scanner.test(id);
+                });
+
+                r.add("scanner_test", "\"stride\":" + std::to_string(stride) + ",\"masked\":" + std::to_string(masked), s, n);
+        }
+}
+
+static void usage(const char *const name)
+{
+        fprintf(stderr, "Usage: %s [-d documents] [-v vocabulary] [-s skew] [-p positions] [-P payload bytes] [-u updates%%] [-r reps] [-S seed] [-c codec,..] [-o report] [directory]\n", name);
+        exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+        bench_config cfg;
+        const char *reportPath{nullptr};
+        int r;
+
+        while ((r = getopt(argc, argv, "d:v:s:p:P:u:r:S:c:o:h")) != -1)
+        {
+                switch (r)
+                {
+                        case 'd':
+                                cfg.documents = strtoul(optarg, nullptr, 10);
+                                break;
+
+                        case 'v':
+                                cfg.vocabulary = strtoul(optarg, nullptr, 10);
+                                break;
+
+                        case 's':
+                                cfg.skew = strtod(optarg, nullptr);
+                                break;
+
+                        case 'p':
+                                cfg.positions = strtoul(optarg, nullptr, 10);
+                                break;
+
+                        case 'P':
+                                cfg.payload = std::min<unsigned long>(strtoul(optarg, nullptr, 10), sizeof(uint64_t));
+                                break;
+
+                        case 'u':
+                                cfg.updates = std::min<unsigned long>(strtoul(optarg, nullptr, 10), 100);
+                                break;
+
+                        case 'r':
+                                cfg.reps = strtoul(optarg, nullptr, 10);
+                                break;
+
+                        case 'S':
+                                cfg.seed = strtoull(optarg, nullptr, 10);
+                                break;
+
+                        case 'c':
+                                cfg.codecs.clear();
+                                for (const char *p = optarg, *e; *p; p = *e ? e + 1 : e)
+                                {
+                                        e = strchrnul(p, ',');
+                                        if (e != p)
+                                                cfg.codecs.emplace_back(p, e - p);
+                                }
+                                break;
+
+                        case 'o':
+                                reportPath = optarg;
+                                break;
+
+                        default:
+                                usage(argv[0]);
+                }
+        }
+
+        if (!cfg.documents || !cfg.vocabulary || !cfg.positions)
+                usage(argv[0]);
+
+        cfg.dir = optind < argc ? argv[optind] : "/tmp/trinity-bench." + std::to_string(getpid());
+
+        const corpus c(cfg);
+        report rep;
+
+        for (const auto &codec : cfg.codecs)
+        {
+                uint64_t hits{0};
+                const auto path = segment_path(cfg, codec, 1);
+                const auto s = measure(1, [&]() { hits = index_segment(c, codec, path, 0); });
+
+                rep.add("index", quoted("codec", codec) + ",\"documents\":" + std::to_string(cfg.documents) + ",\"index_bytes\":" + std::to_string(file_size(path + "/index")), s, hits);
+
+                if (cfg.updates)
+                        index_segment(c, codec, segment_path(cfg, codec, 2), 100 / cfg.updates);
+
+                auto base = new SegmentIndexSource(path.c_str());
+
+                bench_postings(cfg, c, codec, base, rep);
+                bench_queries(cfg, c, codec, base, rep);
+
+                if (cfg.updates)
+                {
+                        auto updates = new SegmentIndexSource(segment_path(cfg, codec, 2).c_str());
+
+                        bench_merge(cfg, codec, base, updates, rep);
+                        if (&codec == &cfg.codecs.front())
+                                bench_scanner(cfg, updates, rep);
+                        updates->Release();
+                }
+
+                base->Release();
+        }
+
+        const auto json = rep.json(cfg);
+
+        if (reportPath)
+        {
+                if (Utilities::to_file(json.data(), json.size(), reportPath) == -1)
+                        throw Switch::system_error("Failed to persist report");
+        }
+        else
+                fwrite(json.data(), json.size(), 1, stdout);
+
+        return 0;
+}
@@ -78,7 +78,9 @@ namespace Trinity
 			{
 				// append_index_chunk() is implemented
 				AppendIndexChunk = 1,
-				Merge = 1<<1
+				Merge = 1<<1,
+				// new_private_session() and append_private_session() are implemented
+				ParallelEncoding = 1<<2
 			};
 
 			const uint8_t caps;
@@ -187,6 +189,26 @@ namespace Trinity
 			{
 
 			}
+
+			// Parallel encoding support(optional; set Capabilities::ParallelEncoding if you implement those)
+			//
+			// new_private_session() returns a new session for the same codec that encodes into its own in-memory buffers.
+			// It is not begin()ed, and is never flushed, so that another thread can use an encoder of that session to encode terms independently.
+			// Once done, append_private_session() moves all data encoded in the private session into this session, and adjusts
+			// the term_index_ctx of all the terms encoded in it (tctxs[], in the order they were encoded).
+			// Only append_private_session() needs to be serialized.
+			//
+			// See SegmentIndexSession::build_index()
+			virtual IndexSession *new_private_session()
+			{
+				std::abort();
+				return nullptr;
+			}
+
+			virtual void append_private_session(IndexSession *src, term_index_ctx *tctxs, const size_t n)
+			{
+				std::abort();
+			}
                 };
 
                 // Encoder interface for encoding a single term's posting list
@@ -238,6 +260,11 @@ namespace Trinity
 			// For current document
                         tokenpos_t freq;
 
+                        // Execution statistics(see exec_stats); maintained by codecs that decode postings in blocks, once per block
+                        // decodedDocs: documents in the blocks decoded so far
+                        // skippedBlocks: blocks skipped(through skiplists, or blocks headers) without decoding them
+                        uint32_t decodedDocs{0}, skippedBlocks{0};
+
                         PostingsListIterator(Decoder *const d)
                             : Iterator{Trinity::DocsSetIterators::Type::PostingsListIterator}, dec{d}
                         {
@@ -254,6 +281,49 @@ namespace Trinity
                         // so you should not materialize if have already done so.
                         virtual void materialize_hits(DocWordsSpace *dwspace, term_hit *out) = 0;
 
+                        // Block-max metadata access, for dynamic pruning schemes (e.g Block-Max WAND/MaxScore) where
+                        // we want to skip whole blocks of documents that can't possibly make it into the top-k.
+                        //
+                        // advance_shallow() moves a cursor, independent of the current document, to the block that
+                        // would contain `target`, without decoding it, and returns the last document ID in that block (i.e the next block boundary)
+                        // block_max_freq() then returns an upper bound of the freq of any document in that block.
+                        //
+                        // The default impl. is conservative; a single block that spans the whole postings list, with no upper bound, which is always correct.
+                        // Codecs that track per-block metadata(e.g Lucene's) should override both.
+                        // If you want the upper bound for the current block, use advance_shallow(current()).
+                        virtual isrc_docid_t advance_shallow(const isrc_docid_t target)
+                        {
+                                return DocIDsEND;
+                        }
+
+                        virtual tokenpos_t block_max_freq()
+                        {
+                                return std::numeric_limits<tokenpos_t>::max();
+                        }
+
+                        // Batch access to the decoded block
+                        // Hands out the current document, followed by the documents remaining in the currently decoded block
+                        // as long as they are < upto, and no more than `max` of them, in `out`(and their freqs in `freqs`, unless it's nullptr).
+                        // It then moves to the document that follows the last one handed out, exactly as if next() was invoked for each of them,
+                        // so you can still materialize_hits() for the (new) current document.
+                        // Returns how many documents were handed out; 0 if current() >= upto. The iterator must have been positioned(next() or advance()) before.
+                        //
+                        // This is so that e.g Docs Sets Spans can fill their windows without paying for a virtual next() call per document.
+                        // The default impl. just uses next(). Codecs should override it.
+                        virtual uint32_t next_block(isrc_docid_t *const out, tokenpos_t *const freqs, const uint32_t max, const isrc_docid_t upto = DocIDsEND)
+                        {
+                                uint32_t n{0};
+
+                                for (auto id = current(); id < upto && n != max; id = next())
+                                {
+                                        out[n] = id;
+                                        if (freqs)
+                                                freqs[n] = freq;
+                                        ++n;
+                                }
+                                return n;
+                        }
+
                         inline auto decoder() noexcept
                         {
                                 return dec;
@@ -301,6 +371,13 @@ namespace Trinity
 			// This is how you are going to access the postings list
 			virtual PostingsListIterator *new_iterator() = 0;
 
+                        // An upper bound of the freq of any document in the postings list, for dynamic pruning schemes(see also PostingsListIterator::block_max_freq())
+                        // Codecs should track it while encoding the postings list; the default impl. provides no upper bound
+                        virtual tokenpos_t max_freq() const noexcept
+                        {
+                                return std::numeric_limits<tokenpos_t>::max();
+                        }
+
                         Decoder()
                         {
                         }
@@ -345,6 +422,19 @@ namespace Trinity
                         // See IndexSession::codec_identifier()
                         virtual strwlen8_t codec_identifier() = 0;
 
+                        // Codecs that cache decoded state across decoders(e.g Lucene's decoded skiplists)
+                        // should override this to report how effective the cache is
+                        struct cache_stats
+                        {
+                                uint64_t hits{0};
+                                uint64_t misses{0};
+                        };
+
+                        virtual cache_stats decoders_cache_stats() const
+                        {
+                                return {};
+                        }
+
                         virtual ~AccessProxy()
                         {
                         }
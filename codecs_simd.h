@@ -0,0 +1,98 @@
+// Vectorized kernels for codecs decoders
+// Decoders turn each decoded block of document ID deltas into absolute document IDs up front (prefix_sum_docids()),
+// so that next() is just an array load, and advance() within a block is a search for the first document ID >= target (first_docid_geq()).
+//
+// There are AVX2 and SSE4.1 impl., selected at compile time (e.g -mavx2 or -msse4.1, or -march=native), and a scalar fallback.
+#pragma once
+#include "common.h"
+#include <switch_bitops.h>
+#if defined(__AVX2__) || defined(__SSE4_1__)
+#include <immintrin.h>
+#endif
+
+static_assert(sizeof(Trinity::isrc_docid_t) == sizeof(uint32_t));
+
+namespace Trinity
+{
+        namespace Codecs
+        {
+                // In-place inclusive prefix sum of the n deltas in values[], starting from base
+                // i.e values[i] = base + values[0] + .. + values[i]
+                [[gnu::always_inline]] inline void prefix_sum_docids(isrc_docid_t *const __restrict__ values, const uint32_t n, const isrc_docid_t base) noexcept
+                {
+                        uint32_t i{0};
+
+#if defined(__AVX2__)
+                        // prefix sum within each 128bit lane, and then propagate the lower lane's last value to the upper lane
+                        __m256i carry = _mm256_set1_epi32(base);
+                        const __m256i last = _mm256_set1_epi32(7);
+
+                        for (; i + 8 <= n; i += 8)
+                        {
+                                auto *const ptr = reinterpret_cast<__m256i *>(values + i);
+                                __m256i v = _mm256_loadu_si256(ptr);
+
+                                v = _mm256_add_epi32(v, _mm256_slli_si256(v, 4));
+                                v = _mm256_add_epi32(v, _mm256_slli_si256(v, 8));
+                                v = _mm256_add_epi32(v, _mm256_permute2x128_si256(_mm256_shuffle_epi32(v, _MM_SHUFFLE(3, 3, 3, 3)), v, 0x08));
+                                v = _mm256_add_epi32(v, carry);
+
+                                _mm256_storeu_si256(ptr, v);
+                                carry = _mm256_permutevar8x32_epi32(v, last);
+                        }
+#elif defined(__SSE4_1__)
+                        __m128i carry = _mm_set1_epi32(base);
+
+                        for (; i + 4 <= n; i += 4)
+                        {
+                                auto *const ptr = reinterpret_cast<__m128i *>(values + i);
+                                __m128i v = _mm_loadu_si128(ptr);
+
+                                v = _mm_add_epi32(v, _mm_slli_si128(v, 4));
+                                v = _mm_add_epi32(v, _mm_slli_si128(v, 8));
+                                v = _mm_add_epi32(v, carry);
+
+                                _mm_storeu_si128(ptr, v);
+                                carry = _mm_shuffle_epi32(v, _MM_SHUFFLE(3, 3, 3, 3));
+                        }
+#endif
+
+                        for (auto prev = i ? values[i - 1] : base; i < n; ++i)
+                                values[i] = prev += values[i];
+                }
+
+                // Returns the index of the first document ID in values[from, to) that is >= target, or `to` if there is none
+                // values[] must be sorted(ascending), as is the case for all decoded blocks
+                [[gnu::always_inline]] inline uint32_t first_docid_geq(const isrc_docid_t *const __restrict__ values, uint32_t from, const uint32_t to, const isrc_docid_t target) noexcept
+                {
+#if defined(__AVX2__)
+                        const __m256i t = _mm256_set1_epi32(target);
+
+                        for (; from + 8 <= to; from += 8)
+                        {
+                                const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(values + from));
+                                // unsigned (v >= t) <=> max(v, t) == v
+                                const auto mask = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_max_epu32(v, t), v)));
+
+                                if (mask)
+                                        return from + SwitchBitOps::TrailingZeros(uint32_t(mask));
+                        }
+#elif defined(__SSE4_1__)
+                        const __m128i t = _mm_set1_epi32(target);
+
+                        for (; from + 4 <= to; from += 4)
+                        {
+                                const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(values + from));
+                                const auto mask = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(_mm_max_epu32(v, t), v)));
+
+                                if (mask)
+                                        return from + SwitchBitOps::TrailingZeros(uint32_t(mask));
+                        }
+#endif
+
+                        while (from < to && values[from] < target)
+                                ++from;
+                        return from;
+                }
+        }
+}
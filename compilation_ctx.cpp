@@ -1895,6 +1895,83 @@ exec_node Trinity::compile_query(ast_node *root, compilation_ctx &cctx)
         return compile(reorder_root(root), cctx, a);
 }
 
+exec_node Trinity::copy_execnodes(const exec_node n, simple_allocator &a)
+{
+        auto res = n;
+
+        switch (n.fp)
+        {
+                case ENT::logicaland:
+                case ENT::logicalor:
+                case ENT::logicalnot:
+                {
+                        const auto ctx = static_cast<const compilation_ctx::binop_ctx *>(n.ptr);
+                        auto copy = a.New<compilation_ctx::binop_ctx>();
+
+                        copy->lhs = copy_execnodes(ctx->lhs, a);
+                        copy->rhs = copy_execnodes(ctx->rhs, a);
+                        res.ptr = copy;
+                }
+                break;
+
+                case ENT::unaryand:
+                case ENT::unarynot:
+                case ENT::consttrueexpr:
+                {
+                        const auto ctx = static_cast<const compilation_ctx::unaryop_ctx *>(n.ptr);
+                        auto copy = a.New<compilation_ctx::unaryop_ctx>();
+
+                        copy->expr = copy_execnodes(ctx->expr, a);
+                        res.ptr = copy;
+                }
+                break;
+
+                case ENT::matchallterms:
+                case ENT::matchanyterms:
+                {
+                        const auto run = static_cast<const compilation_ctx::termsrun *>(n.ptr);
+                        const auto size = sizeof(compilation_ctx::termsrun) + sizeof(exec_term_id_t) * run->size;
+                        auto copy = (compilation_ctx::termsrun *)a.Alloc(size);
+
+                        memcpy(copy, run, size);
+                        res.ptr = copy;
+                }
+                break;
+
+                case ENT::matchsome:
+                {
+                        const auto pm = static_cast<const compilation_ctx::partial_match_ctx *>(n.ptr);
+                        auto copy = (compilation_ctx::partial_match_ctx *)a.Alloc(sizeof(compilation_ctx::partial_match_ctx) + sizeof(exec_node) * pm->size);
+
+                        copy->size = pm->size;
+                        copy->min = pm->min;
+                        for (uint32_t i{0}; i != pm->size; ++i)
+                                copy->nodes[i] = copy_execnodes(pm->nodes[i], a);
+                        res.ptr = copy;
+                }
+                break;
+
+                case ENT::matchallnodes:
+                case ENT::matchanynodes:
+                {
+                        const auto g = static_cast<const compilation_ctx::nodes_group *>(n.ptr);
+                        auto copy = (compilation_ctx::nodes_group *)a.Alloc(sizeof(compilation_ctx::nodes_group) + sizeof(exec_node) * g->size);
+
+                        copy->size = g->size;
+                        for (uint32_t i{0}; i != g->size; ++i)
+                                copy->nodes[i] = copy_execnodes(g->nodes[i], a);
+                        res.ptr = copy;
+                }
+                break;
+
+                default:
+                        // matchterm, matchphrase, matchallphrases, matchanyphrases and constant nodes
+                        break;
+        }
+
+        return res;
+}
+
 void Trinity::group_execnodes(exec_node &n, simple_allocator &a)
 {
         if (n.fp == ENT::logicaland)
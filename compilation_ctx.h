@@ -160,5 +160,9 @@ namespace Trinity
 
 	exec_node compile_query(ast_node *root, compilation_ctx &cctx);
 
+        // Deep copies an exec_nodes tree into a; prepare_tree() modifies the tree it is given, so this is used to execute cached compiled trees.
+        // Phrases and phrase runs are not modified once compiled and are shared with the source tree
+        exec_node copy_execnodes(const exec_node n, simple_allocator &a);
+
         void group_execnodes(exec_node &, simple_allocator &);
 }
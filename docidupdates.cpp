@@ -2,63 +2,184 @@
 #include <ansifmt.h>
 #include <switch_bitops.h>
 
-// packs a list of updated/delete documents into a buffer that also contains
-// a skiplist for random access to the bitmaps
-void Trinity::pack_updates(std::vector<docid_t> &updatedDocumentIDs, IOBuffer *const buf)
+namespace // static/local this module
 {
-        if (updatedDocumentIDs.size())
+        using ud_container = Trinity::updated_documents_container;
+
+        // Follows the containers directory; see pack_updates()
+        // The legacy format ends with the highest updated document ID, which can't be DocIDsEND, so that's how we tell them apart
+        struct containers_trailer final
         {
-                static constexpr size_t BANK_SIZE{32 * 1024};
-                static_assert((BANK_SIZE & 63) == 0, "Not divisable by 64");
-                IOBuffer skiplist;
+                uint32_t containersCnt;
+                Trinity::docid_t lowest, highest;
+                uint32_t version;
+                uint32_t marker;
+        };
 
-                std::sort(updatedDocumentIDs.begin(), updatedDocumentIDs.end());
+        static constexpr uint32_t ContainersFormatVersion{1};
 
-#if 0 	// We are now throwing an exception if we attempt to erase or update the same document more than once in Trinity::SegmentIndexSession
-		// We could have filtered dupes int he main loop, but keep it simple
-		// We will throw an exception if we attempt to update a document twice, but we can safely erase a document however many times
-                updatedDocumentIDs.resize(std::unique(updatedDocumentIDs.begin(), updatedDocumentIDs.end()) - updatedDocumentIDs.begin());
-#endif
+        // An array container with more values than that would be larger than a bitmap container
+        static constexpr uint32_t MaxArrayContainerSize{4096};
 
-                for (const auto *p = updatedDocumentIDs.data(), *const e = p + updatedDocumentIDs.size(); p != e;)
+        static constexpr size_t BitmapContainerSize{65536 / 8};
+
+        static void align(IOBuffer *const buf, const size_t base, const uint32_t n)
+        {
+                while ((buf->size() - base) & (n - 1))
+                        buf->pack(uint8_t(0));
+        }
+
+        // Packs the updated documents in [first, last), all with the same high 16 bits, into the smallest container; see pack_updates()
+        // The container offset is relative to base
+        static ud_container pack_container(const Trinity::docid_t *const first, const Trinity::docid_t *const last, IOBuffer *const buf, const size_t base, std::vector<std::pair<uint16_t, uint16_t>> *const runs)
+        {
+                const uint16_t key = *first >> 16;
+                const uint32_t cnt = last - first;
+                ud_container c{key, ud_container::Type::Array, 0, cnt, 0};
+
+                runs->clear();
+                for (const auto *p = first; p != last; ++p)
                 {
-                        // We can create a bitmap
-                        // which will come down to about 4k that can hold 32k documents
-                        // which allows for O(1) access
-                        // For 10million IDs, this comes down to about 2MBs which is not much, considering
-                        // how we are going to be advancing one range/time
-                        const auto id = *p, base = id;
-                        const auto upto = id + BANK_SIZE;
+                        const uint16_t low = *p & 0xffff;
 
-                        buf->reserve(BANK_SIZE / 8);
+                        if (runs->size() && uint32_t(runs->back().first) + runs->back().second + 1 == low)
+                                ++(runs->back().second);
+                        else
+                                runs->push_back({low, 0});
+                }
 
-                        auto *const bm = (uint64_t *)buf->end();
+                if (runs->size() * 4 < std::min<size_t>(cnt * 2, BitmapContainerSize))
+                {
+                        c.type = ud_container::Type::Run;
+                        c.size = runs->size();
+                }
+                else if (cnt > MaxArrayContainerSize)
+                        c.type = ud_container::Type::Bitmap;
 
-                        memset(bm, 0, BANK_SIZE / 8);
+                align(buf, base, 8);
+                c.offset = buf->size() - base;
 
-                        skiplist.pack(id);
-                        do
+                switch (c.type)
+                {
+                        case ud_container::Type::Array:
+                                for (const auto *it = first; it != last; ++it)
+                                        buf->pack(uint16_t(*it & 0xffff));
+                                break;
+
+                        case ud_container::Type::Run:
+                                for (const auto &it : *runs)
+                                        buf->pack(it.first, it.second);
+                                break;
+
+                        case ud_container::Type::Bitmap:
                         {
-                                const auto rel = *p - base;
+                                buf->reserve(BitmapContainerSize);
 
-                                SwitchBitOps::Bitmap<uint64_t>::Set(bm, rel);
-                        } while (++p != e && *p < upto);
+                                auto *const bm = (uint64_t *)buf->end();
 
-                        buf->advance_size(BANK_SIZE / 8);
+                                memset(bm, 0, BitmapContainerSize);
+                                for (const auto *it = first; it != last; ++it)
+                                        SwitchBitOps::Bitmap<uint64_t>::Set(bm, *it & 0xffff);
+                                buf->advance_size(BitmapContainerSize);
+                        }
+                        break;
                 }
 
-                buf->pack(uint8_t(log2(BANK_SIZE)));                              // 1 byte will suffice
-                buf->serialize(skiplist.data(), skiplist.size());                 // skiplist
-                buf->pack(uint32_t(skiplist.size() / sizeof(docid_t)));           // TODO: use varint encoding here
-                buf->pack(updatedDocumentIDs.front(), updatedDocumentIDs.back()); //lowest, highest
+                return c;
         }
+
+        // Returns the first index in [from, size) where below(index) is false(or size), galloping from `from`
+        // Updated documents are tested in ascending order, so the next match is usually close to the previous one
+        template <typename L>
+        static inline uint32_t gallop(uint32_t from, const uint32_t size, L &&below) noexcept
+        {
+                if (from == size || !below(from))
+                        return from;
+
+                uint32_t step{1};
+
+                while (from + step < size && below(from + step))
+                {
+                        from += step;
+                        step <<= 1;
+                }
+
+                // below(from) is true, and below(hi) is false if (hi != size)
+                auto hi = std::min(from + step, size);
+
+                for (++from; from < hi;)
+                {
+                        const auto mid = (from + hi) / 2;
+
+                        if (below(mid))
+                                from = mid + 1;
+                        else
+                                hi = mid;
+                }
+
+                return from;
+        }
+}
+
+// Packs a list of updated/deleted documents, partitioned by their high 16 bits, into containers(see updated_documents_container)
+// For each partition we pick the smallest container: an array of the low 16 bits(2 bytes/document), a bitmap(8k), or a list of runs(4 bytes/run).
+// The containers data are followed by the containers directory, and a containers_trailer.
+//
+// Compared to the previous fixed-size bitmap banks(4k for every 32k documents range, even for a single document), that's 2 bytes for sparse
+// updates, and e.g a few bytes for large ranges of deleted documents.
+void Trinity::pack_updates(std::vector<docid_t> &updatedDocumentIDs, IOBuffer *const buf)
+{
+        if (updatedDocumentIDs.empty())
+                return;
+
+        const auto base = buf->size();
+        std::vector<ud_container> directory;
+        std::vector<std::pair<uint16_t, uint16_t>> runs; // (start, length - 1)
+
+        std::sort(updatedDocumentIDs.begin(), updatedDocumentIDs.end());
+        // erase() may be invoked for the same document more than once; see SegmentIndexSession::erase()
+        updatedDocumentIDs.resize(std::unique(updatedDocumentIDs.begin(), updatedDocumentIDs.end()) - updatedDocumentIDs.begin());
+
+        for (const auto *p = updatedDocumentIDs.data(), *const e = p + updatedDocumentIDs.size(); p != e;)
+        {
+                const auto *const first = p;
+                const uint16_t key = *p >> 16;
+
+                while (++p != e && (*p >> 16) == key)
+                        continue;
+
+                directory.push_back(pack_container(first, p, buf, base, &runs));
+        }
+
+        align(buf, base, sizeof(uint32_t));
+        buf->serialize(directory.data(), directory.size() * sizeof(ud_container));
+        buf->pack(uint32_t(directory.size()), updatedDocumentIDs.front(), updatedDocumentIDs.back(), ContainersFormatVersion, uint32_t(DocIDsEND));
 }
 
 // see pack_updates()
-// use this function to unpack the represetnation we need to access the packed (into bitmaps)
+// use this function to unpack the represetnation we need to access the packed (into containers, or bitmaps for the legacy format)
 // updated documents
 Trinity::updated_documents Trinity::unpack_updates(const range_base<const uint8_t *, uint32_t> content)
 {
+        if (content.size() >= sizeof(containers_trailer))
+        {
+                containers_trailer t;
+
+                memcpy(&t, content.start() + content.size() - sizeof(t), sizeof(t));
+                if (t.marker == DocIDsEND)
+                {
+                        if (t.version != ContainersFormatVersion)
+                                throw Switch::data_error("Unsupported updated documents format version ", t.version);
+                        else if (sizeof(t) + t.containersCnt * sizeof(ud_container) > content.size())
+                                throw Switch::data_error("Unexpected updated documents containers directory size");
+
+                        const auto *const directory = content.start() + content.size() - sizeof(t) - t.containersCnt * sizeof(ud_container);
+
+                        return {nullptr, 0, 0, nullptr, t.lowest, t.highest, reinterpret_cast<const ud_container *>(directory), t.containersCnt, content.start()};
+                }
+        }
+
+        // Legacy format: fixed-size bitmap banks, and a skiplist
         if (content.size() <= sizeof(uint32_t) + sizeof(uint8_t))
                 return {};
 
@@ -81,75 +202,403 @@ Trinity::updated_documents Trinity::unpack_updates(const range_base<const uint8_
         return {skiplist, skiplistSize, bankSize, b, lowest, highest};
 }
 
+void Trinity::updated_documents_scanner::enter(const updated_documents_container *const c)
+{
+        container = c;
+        // the range of the last possible container can't include DocIDsEND
+        curBankRange.Set(docid_t(c->key) << 16, c->key == UINT16_MAX ? UINT16_MAX : 65536);
+        curBank = containersData + c->offset;
+        cursor = 0;
+}
+
+// Moves to the bank/container that contains id, or the first past it if there is no such bank/container
+// Expects (id >= curBankRange.stop() && id <= maxDocID)
+// Returns true if the current bank/container contains id
+bool Trinity::updated_documents_scanner::seek(const docid_t id) noexcept
+{
+        static constexpr bool traceAdvances{false};
+
+        if (udBanks)
+        {
+                int32_t btm{0};
+
+                if (traceAdvances)
+                        SLog("Binary search FOR ", id, " ", curBankRange, " ", curBankRange.size(), ", maxDocID = ", maxDocID, "\n");
+
+                // binary search highest bank, where id < bank.end
+                // There's no need to check for success, we already checked for (id > maxDocID)
+                for (int32_t top{int32_t(end - skiplistBase) - 1}; btm <= top;)
+                {
+                        const auto mid = (btm + top) / 2;
+                        const auto end = skiplistBase[mid] + bankSize;
+
+                        if (id < end)
+                                top = mid - 1;
+                        else
+                                btm = mid + 1;
+                }
+
+                skiplistBase += btm;
+                curBankRange.Set(*skiplistBase, bankSize);
+                curBank = udBanks + ((skiplistBase - udSkipList) * (bankSize / 8));
+
+                if (traceAdvances)
+                        SLog("Now at ", skiplistBase - udSkipList, " => ", curBankRange, " ", curBankRange.Contains(id), "\n");
+
+                return curBankRange.Contains(id);
+        }
+
+        const uint16_t key = id >> 16;
+        // there is such a container, because id <= maxDocID
+        const auto it = std::lower_bound(container + 1, containersEnd, key, [](const auto &c, const uint16_t k) noexcept { return c.key < k; });
+
+        if (unlikely(it == containersEnd))
+        {
+                reset();
+                return false;
+        }
+
+        enter(it);
+        return it->key == key;
+}
+
+bool Trinity::updated_documents_scanner::test_container(const uint16_t low) noexcept
+{
+        switch (container->type)
+        {
+                case updated_documents_container::Type::Bitmap:
+                        return SwitchBitOps::Bitmap<uint64_t>::IsSet((uint64_t *)curBank, low);
+
+                case updated_documents_container::Type::Array:
+                {
+                        const auto *const values = reinterpret_cast<const uint16_t *>(curBank);
+                        const auto size = container->size;
+
+                        if (cursor && values[cursor - 1] >= low)
+                        {
+                                // not in ascending order
+                                cursor = 0;
+                        }
+
+                        cursor = gallop(cursor, size, [values, low](const uint32_t i) noexcept { return values[i] < low; });
+                        return cursor != size && values[cursor] == low;
+                }
+
+                case updated_documents_container::Type::Run:
+                {
+                        const auto *const runs = reinterpret_cast<const uint16_t *>(curBank);
+                        const auto size = container->size;
+                        const auto below = [runs, low](const uint32_t i) noexcept { return uint32_t(runs[i * 2]) + runs[i * 2 + 1] < low; };
+
+                        if (cursor && !below(cursor - 1))
+                                cursor = 0;
+
+                        cursor = gallop(cursor, size, below);
+                        return cursor != size && runs[cursor * 2] <= low;
+                }
+        }
+
+        return false;
+}
+
 bool Trinity::updated_documents_scanner::test(const docid_t id) noexcept
 {
-        static constexpr bool trace{false}, traceAdvances{false};
+        static constexpr bool trace{false};
 
         if (trace)
                 SLog(ansifmt::bold, "Check for ", id, ", curBankRange = ", curBankRange, ", contains ", curBankRange.Contains(id), ansifmt::reset, "\n");
 
-        if (id >= curBankRange.start())
+        if (id < curBankRange.start())
+                return false;
+        else if (id >= curBankRange.stop())
+        {
+                if (id > maxDocID)
+                {
+                        reset();
+                        return false;
+                }
+                else if (!seek(id))
+                        return false;
+        }
+
+        if (udBanks)
+                return SwitchBitOps::Bitmap<uint64_t>::IsSet((uint64_t *)curBank, id - curBankRange.offset);
+        else
+                return test_container(id - curBankRange.offset);
+}
+
+uint32_t Trinity::updated_documents_scanner::test_range(const docid_t *const ids, const uint32_t n, uint64_t *const outMask) noexcept
+{
+        uint32_t res{0};
+        const auto set = [&](const uint32_t i) noexcept {
+                outMask[i >> 6] |= uint64_t(1) << (i & 63);
+                ++res;
+        };
+
+        for (uint32_t i{0}; i < n;)
         {
-                if (id < curBankRange.stop())
+                const auto id = ids[i];
+
+                if (id < curBankRange.start())
+                {
+                        ++i;
+                        continue;
+                }
+                else if (id >= curBankRange.stop())
                 {
-                        if (trace)
-                                SLog("In bank range ", id - curBankRange.offset, "\n");
+                        if (id > maxDocID)
+                        {
+                                reset();
+                                break;
+                        }
 
-                        return SwitchBitOps::Bitmap<uint64_t>::IsSet((uint64_t *)curBank, id - curBankRange.offset);
+                        // either we are now in the bank/container of id, or past it
+                        seek(id);
+                        continue;
                 }
-                else if (id > maxDocID)
+
+                // all IDs in the current bank/container
+                const auto base = curBankRange.start();
+                const auto stop = curBankRange.stop();
+                uint32_t upto{i + 1};
+
+                while (upto < n && ids[upto] < stop)
+                        ++upto;
+
+                if (udBanks || container->type == updated_documents_container::Type::Bitmap)
                 {
-                        reset();
-                        return false;
+                        const auto *const bm = reinterpret_cast<const uint64_t *>(curBank);
+
+                        for (; i != upto; ++i)
+                        {
+                                if (SwitchBitOps::Bitmap<uint64_t>::IsSet(bm, ids[i] - base))
+                                        set(i);
+                        }
                 }
                 else
                 {
-                        int32_t btm{0};
+                        // test_container() is cheap enough for arrays and runs; we gallop from the last match
+                        for (; i != upto; ++i)
+                        {
+                                if (test_container(ids[i] - base))
+                                        set(i);
+                        }
+                }
+        }
 
-                        if (traceAdvances)
-                                SLog("Binary search FOR ", id, " ", curBankRange, " ", curBankRange.size(), ", maxDocID = ", maxDocID, "\n");
+        return res;
+}
+
+// Returns the first value, not lower than low, that is not set in the current bank/container; curBankRange.size() if there is no such value
+uint32_t Trinity::updated_documents_scanner::next_unset_in_container(uint32_t low) noexcept
+{
+        if (udBanks || container->type == updated_documents_container::Type::Bitmap)
+        {
+                const auto *const bm = reinterpret_cast<const uint64_t *>(curBank);
+                const uint32_t words = udBanks ? bankSize / 64 : BitmapContainerSize / sizeof(uint64_t);
+                uint32_t i = low / 64;
+
+                if (i == words)
+                        return curBankRange.size();
+
+                for (auto w = ~bm[i] & (~uint64_t(0) << (low & 63));; w = ~bm[i])
+                {
+                        if (w)
+                                return std::min<uint32_t>(i * 64 + __builtin_ctzll(w), curBankRange.size());
+                        else if (++i == words)
+                                return curBankRange.size();
+                }
+        }
+        else if (container->type == updated_documents_container::Type::Array)
+        {
+                if (!test_container(low))
+                        return low;
+
+                // test_container() moved the cursor to low
+                const auto *const values = reinterpret_cast<const uint16_t *>(curBank);
+                const auto size = container->size;
+
+                do
+                {
+                        ++low;
+                } while (++cursor != size && values[cursor] == low);
+
+                return low;
+        }
+        else
+        {
+                if (!test_container(low))
+                        return low;
+
+                // test_container() moved the cursor to the run that includes low
+                const auto *const runs = reinterpret_cast<const uint16_t *>(curBank);
 
-                        // binary search highest bank, where id < bank.end
-                        // There's no need to check for success, we already checked for (id > maxDocID)
-                        for (int32_t top{int32_t(end - skiplistBase) - 1}; btm <= top;)
+                return std::min<uint32_t>(uint32_t(runs[cursor * 2]) + runs[cursor * 2 + 1] + 1, curBankRange.size());
+        }
+}
+
+Trinity::docid_t Trinity::updated_documents_scanner::next_unset(docid_t id) noexcept
+{
+        for (;;)
+        {
+                if (id < curBankRange.start())
+                        return id;
+                else if (id >= curBankRange.stop())
+                {
+                        if (id > maxDocID)
                         {
-                                const auto mid = (btm + top) / 2;
-                                const auto end = skiplistBase[mid] + bankSize;
+                                reset();
+                                return id;
+                        }
+                        else if (!seek(id))
+                                return id;
+                }
+
+                const auto base = curBankRange.start();
+                const auto next = next_unset_in_container(id - base);
+
+                if (next != curBankRange.size())
+                        return base + next;
+
+                // everything up to the end of this bank/container is set
+                id = curBankRange.stop();
+        }
+}
+
+void Trinity::collect_updates(const updated_documents &ud, std::vector<docid_t> *const out)
+{
+        const auto collect_bitmap = [out](const uint64_t *const bm, const size_t words, const uint64_t base) {
+                for (size_t i{0}; i != words; ++i)
+                {
+                        for (auto w = bm[i]; w; w &= w - 1)
+                                out->push_back(base + i * 64 + __builtin_ctzll(w));
+                }
+        };
+
+        if (ud.banks)
+        {
+                for (uint32_t i{0}; i != ud.skiplistSize; ++i)
+                        collect_bitmap(reinterpret_cast<const uint64_t *>(ud.banks + i * (ud.bankSize / 8)), ud.bankSize / 64, ud.skiplist[i]);
+                return;
+        }
+
+        for (const auto *c = ud.containers, *const e = c + ud.containersCnt; c != e; ++c)
+        {
+                const auto base = docid_t(c->key) << 16;
+                const auto *const data = ud.containersData + c->offset;
+
+                switch (c->type)
+                {
+                        case updated_documents_container::Type::Array:
+                                for (const auto *it = reinterpret_cast<const uint16_t *>(data), *const end = it + c->size; it != end; ++it)
+                                        out->push_back(base | *it);
+                                break;
+
+                        case updated_documents_container::Type::Run:
+                                for (const auto *it = reinterpret_cast<const uint16_t *>(data), *const end = it + c->size * 2; it != end; it += 2)
+                                {
+                                        for (uint32_t v = it[0], upto = v + it[1]; v <= upto; ++v)
+                                                out->push_back(base | v);
+                                }
+                                break;
+
+                        case updated_documents_container::Type::Bitmap:
+                                collect_bitmap(reinterpret_cast<const uint64_t *>(data), BitmapContainerSize / sizeof(uint64_t), base);
+                                break;
+                }
+        }
+}
+
+// Source k(most recent first) is masked by the union of ud[0, k), so we build that union incrementally.
+// Each union only differs from the previous one in the containers of the keys ud[k] touches, so all other containers are shared
+// among the unions(all of them are packed in `data`), and building them is O(sum of ud[] sizes + containers of the unions).
+void Trinity::merged_updated_documents::build(const updated_documents *const ud, const std::size_t n)
+{
+        std::vector<docid_t> ids, containerIDs, u;
+        std::vector<std::pair<uint16_t, uint16_t>> runs;
+        std::vector<std::pair<docid_t, docid_t>> bounds; // (lowest, highest) of each union
+        std::vector<updated_documents_container> cur, next;
+        docid_t lowest{DocIDsEND}, highest{0};
 
-                                if (id < end)
-                                        top = mid - 1;
-                                else
-                                        btm = mid + 1;
+        clear();
+        if (n < 2)
+                return;
+
+        for (std::size_t i{0}; i != n; ++i)
+        {
+                const auto *c = cur.data(), *const ce = c + cur.size();
+
+                ids.clear();
+                collect_updates(ud[i], &ids);
+                next.clear();
+
+                for (const auto *p = ids.data(), *const e = p + ids.size(); p != e || c != ce;)
+                {
+                        if (p == e || (c != ce && c->key < (*p >> 16)))
+                        {
+                                // not updated by ud[i]; shared with the previous union
+                                next.push_back(*c++);
+                                continue;
                         }
 
-                        skiplistBase += btm;
-                        curBankRange.Set(*skiplistBase, bankSize);
-                        curBank = udBanks + ((skiplistBase - udSkipList) * (bankSize / 8));
+                        const auto *const first = p;
+                        const uint16_t key = *p >> 16;
 
-                        if (trace || traceAdvances)
-                                SLog("Now at ", skiplistBase - udSkipList, " => ", curBankRange, " ", curBankRange.Contains(id), "\n");
+                        while (++p != e && (*p >> 16) == key)
+                                continue;
 
-                        if (curBankRange.Contains(id))
+                        if (c != ce && c->key == key)
                         {
-                                if (trace)
-                                        SLog("REL = ", id - curBankRange.offset, "\n");
+                                const updated_documents v{nullptr, 0, 0, nullptr, 0, 0, c, 1, reinterpret_cast<const uint8_t *>(data.data())};
 
-                                return SwitchBitOps::Bitmap<uint64_t>::IsSet((uint64_t *)curBank, id - curBankRange.offset);
+                                containerIDs.clear();
+                                collect_updates(v, &containerIDs);
+                                u.clear();
+                                std::set_union(containerIDs.begin(), containerIDs.end(), first, p, std::back_inserter(u));
+                                next.push_back(pack_container(u.data(), u.data() + u.size(), &data, 0, &runs));
+                                ++c;
                         }
                         else
-                        {
-                                if (trace)
-                                        SLog("id ", id, " out of range of ", curBankRange, "\n");
+                                next.push_back(pack_container(first, p, &data, 0, &runs));
+                }
 
-                                return false;
-                        }
+                if (ids.size())
+                {
+                        lowest = std::min(lowest, ids.front());
+                        highest = std::max(highest, ids.back());
+                }
+
+                std::swap(cur, next);
+                if (i)
+                {
+                        directories.push_back(cur);
+                        bounds.push_back({lowest, highest});
                 }
         }
-        else
+
+        // data won't grow anymore
+        for (std::size_t i{0}; i != directories.size(); ++i)
         {
-                if (trace)
-                        SLog("Not Even\n");
+                const auto &dir = directories[i];
 
-                return false;
+                if (dir.empty())
+                        merged.push_back({});
+                else
+                        merged.push_back({nullptr, 0, 0, nullptr, bounds[i].first, bounds[i].second, dir.data(), uint32_t(dir.size()), reinterpret_cast<const uint8_t *>(data.data())});
         }
 }
+
+void Trinity::merged_updated_documents::clear()
+{
+        merged.clear();
+        directories.clear();
+        data.clear();
+}
+
+std::unique_ptr<Trinity::masked_documents_registry> Trinity::merged_updated_documents::registry_for(const updated_documents *const ud, const std::size_t n) const
+{
+        if (n < 2 || n - 2 >= merged.size())
+                return masked_documents_registry::make(ud, n);
+        else
+                return masked_documents_registry::make(merged.data() + n - 2, 1);
+}
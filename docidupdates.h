@@ -1,9 +1,14 @@
 #pragma once
 #include <switch.h>
+#include <switch_bitops.h>
 #include <memory>
 #include "common.h"
 
-// Efficient, lean, fixed-size bitmaps based document IDs tracking
+// Efficient, lean, compressed bitmaps based document IDs tracking
+// Updated/deleted document IDs are partitioned by their high 16 bits, and the low 16 bits of each partition are stored in the
+// smallest of three containers(roaring bitmaps style): a sorted array(sparse), a bitmap(dense), or a list of runs(clustered). See pack_updates().
+// Segments persisted before that used fixed-size bitmap banks; those are still supported(see unpack_updates()).
+//
 // You are expected to test for document IDs in ascending order, but if you need a different behavior, it should be easy to modify
 // the implementation to accomplish it.
 //
@@ -13,32 +18,59 @@
 // almost as fast, takes up less memory and is great for random access
 namespace Trinity
 {
+        // Directory entry of a container; see pack_updates()
+        struct updated_documents_container final
+        {
+                enum class Type : uint8_t
+                {
+                        Array = 0, // size sorted uint16_t values
+                        Bitmap,    // 65536 bits
+                        Run        // size (start, length - 1) uint16_t pairs
+                };
+
+                uint16_t key; // high 16 bits of the document IDs
+                Type type;
+                uint8_t _unused;
+                uint32_t size;
+                uint32_t offset; // of the container data, aligned to 8 bytes
+        };
+
+        static_assert(sizeof(updated_documents_container) == 12);
+
         struct updated_documents final
         {
 		// Each bitmaps bank can be accessed by a skiplist via binary search
+		// (Legacy format) 
                 const docid_t *skiplist;
                 const uint32_t skiplistSize;
 
 		// Fixed size bitmap banks
+		// (Legacy format) 
                 const uint32_t bankSize;
                 const uint8_t *banks;
 
 		docid_t lowestID;
 		docid_t highestID;
+
+                // Containers, in ascending key order, and their data
+                const updated_documents_container *containers{nullptr};
+                uint32_t containersCnt{0};
+                const uint8_t *containersData{nullptr};
 		
 		inline operator bool() const
 		{
-			return banks;
+			return banks || containers;
 		}
         };
 
         // Facilitates fast set test operations for updated/deleted documents packed
-        // as bitmaps using pack_updates()
+        // using pack_updates()
         struct updated_documents_scanner final
         {
                 const docid_t *const end;
                 const uint32_t bankSize;
 
+                // the current bank, or container
                 range_base<docid_t, docid_t> curBankRange;
                 const docid_t *skiplistBase;
                 const uint8_t *curBank;
@@ -46,6 +78,11 @@ namespace Trinity
                 const docid_t *const udSkipList;
                 const uint8_t *const udBanks;
 
+                const updated_documents_container *container;
+                const updated_documents_container *const containersEnd;
+                const uint8_t *const containersData;
+                // index of the first array value or run, in the current container, that is not lower than the last tested ID
+                uint32_t cursor;
 
                 void reset()
                 {
@@ -54,42 +91,65 @@ namespace Trinity
                 }
 
                 updated_documents_scanner(const updated_documents &ud)
-                    : end{ud.skiplist + ud.skiplistSize}, bankSize{ud.bankSize}, skiplistBase{ud.skiplist}, udSkipList{ud.skiplist}, udBanks{ud.banks}, maxDocID{ud.highestID}
+                    : end{ud.skiplist + ud.skiplistSize}, bankSize{ud.bankSize}, skiplistBase{ud.skiplist}, maxDocID{ud.highestID}, udSkipList{ud.skiplist}, udBanks{ud.banks},
+                      container{ud.containers}, containersEnd{ud.containers + ud.containersCnt}, containersData{ud.containersData}, cursor{0}
                 {
-                        if (skiplistBase != end)
+                        if (udBanks)
                         {
-                                curBankRange.Set(*skiplistBase, ud.bankSize);
-                                curBank = udBanks;
+                                if (skiplistBase != end)
+                                {
+                                        curBankRange.Set(*skiplistBase, ud.bankSize);
+                                        curBank = udBanks;
+                                }
                         }
+                        else if (container != containersEnd)
+                                enter(container);
+                        else
+                                reset();
                 }
 
-		updated_documents_scanner(const updated_documents_scanner &o)
-			: end{o.end}, bankSize{o.bankSize}, skiplistBase{o.skiplistBase}, udSkipList{o.udSkipList}, udBanks{o.udBanks}
-		{
-			curBankRange = o.curBankRange;
-			curBank = o.curBank;
-		}
-
+		updated_documents_scanner(const updated_documents_scanner &o) = default;
 
                 constexpr bool drained() const noexcept
                 {
                         return curBankRange.offset == UINT32_MAX;
                 }
 
+              private:
+                void enter(const updated_documents_container *);
 
+                bool seek(const docid_t id) noexcept;
+
+                bool test_container(const uint16_t low) noexcept;
+
+                uint32_t next_unset_in_container(uint32_t low) noexcept;
+
+              public:
                 // You are expected to test monotonically increasing document IDs
                 bool test(const docid_t id) noexcept;
 
+                // Tests n document IDs, in ascending order, and sets bit i of outMask if ids[i] is set(other bits are not modified)
+                // Returns how many of them are set. This is considerably faster than test()ing each ID.
+                uint32_t test_range(const docid_t *ids, const uint32_t n, uint64_t *outMask) noexcept;
+
+                // Returns the first document ID, not lower than id, that is not set(id itself, unless it's set)
+                // Like test(), you are expected to invoke it with monotonically increasing document IDs
+                docid_t next_unset(docid_t id) noexcept;
+
 		inline bool operator==(const updated_documents_scanner &o) const noexcept
                 {
-                        return end == o.end && bankSize == o.bankSize && curBankRange == o.curBankRange && skiplistBase == o.skiplistBase && curBank == o.curBank && udSkipList == o.udSkipList && udBanks == o.udBanks;
+                        return end == o.end && bankSize == o.bankSize && curBankRange == o.curBankRange && skiplistBase == o.skiplistBase && curBank == o.curBank && udSkipList == o.udSkipList && udBanks == o.udBanks && container == o.container && cursor == o.cursor;
                 }
         };
 
 	void pack_updates(std::vector<docid_t> &updatedDocumentIDs, IOBuffer *const buf);
 
+	// Supports both the current and the legacy(fixed-size bitmap banks) format
 	updated_documents unpack_updates(const range_base<const uint8_t *, uint32_t> content);
 
+	// Appends all document IDs of ud to out, in ascending order
+	void collect_updates(const updated_documents &ud, std::vector<docid_t> *const out);
+
 
 	// manages multiple scanners and tests among all of them, and if any of them is exchausted, it is removed from the collection
 	struct masked_documents_registry final
@@ -111,6 +171,59 @@ namespace Trinity
                         return false;
                 }
 
+                // Returns the first document ID, not lower than id, that is not masked by any of the scanners
+                // This is so that we can advance() iterators past ranges of masked documents(e.g documents of an older segment that were
+                // all re-indexed), instead of testing each of them.
+                docid_t next_unmasked(docid_t id)
+                {
+                        for (bool changed{true}; changed && rem;)
+                        {
+                                changed = false;
+                                for (uint8_t i{0}; i < rem;)
+                                {
+                                        auto it = scanners + i;
+
+                                        if (const auto next = it->next_unset(id); next != id)
+                                        {
+                                                id = next;
+                                                // may be masked by a scanner we have already checked
+                                                changed = rem != 1;
+                                        }
+
+                                        if (it->drained())
+                                                new (it) updated_documents_scanner(scanners[--rem]);
+                                        else
+                                                ++i;
+                                }
+                        }
+
+                        return id;
+                }
+
+                // See updated_documents_scanner::test_range()
+                // outMask is expected to hold at least n bits; bit i is set if ids[i] is masked by any of the scanners, and cleared otherwise
+                uint32_t test_range(const docid_t *const ids, const uint32_t n, uint64_t *const outMask)
+                {
+                        const auto words = (n + 63) / 64;
+                        uint32_t res{0};
+
+                        memset(outMask, 0, words * sizeof(uint64_t));
+                        for (uint8_t i{0}; i < rem;)
+                        {
+                                auto it = scanners + i;
+
+                                it->test_range(ids, n, outMask);
+                                if (it->drained())
+                                        new (it) updated_documents_scanner(scanners[--rem]);
+                                else
+                                        ++i;
+                        }
+
+                        for (uint32_t i{0}; i != words; ++i)
+                                res += SwitchBitOps::PopCnt(outMask[i]);
+                        return res;
+                }
+
                 uint8_t rem;
 		updated_documents_scanner scanners[0];		
 
@@ -146,4 +259,28 @@ namespace Trinity
                         return std::unique_ptr<Trinity::masked_documents_registry>(ptr);
                 }
         };
+
+        // A masked_documents_registry tests every document against the scanners of all more recent sources, so the
+        // cost of masking grows with the number of sources.
+        // Given the updated_documents of a collection's sources, most recent first, this builds the union of the first n of them, for
+        // every n, so that a source masked by the n more recent sources needs a single scanner. See IndexSourcesCollection::commit()
+        class merged_updated_documents final
+        {
+              private:
+                // containers of all unions; a container that's not updated by a more recent source is shared by all subsequent unions
+                IOBuffer data;
+                // directories[i] is the containers directory of merged[i]
+                std::vector<std::vector<updated_documents_container>> directories;
+                // merged[i] is the union of the first (i + 2) updated_documents
+                std::vector<updated_documents> merged;
+
+              public:
+                void build(const updated_documents *ud, const std::size_t n);
+
+                void clear();
+
+                // ud and n are what you 'd otherwise pass to masked_documents_registry::make()
+                // If build() wasn't invoked for at least n updated_documents, this falls back to one scanner for each of them
+                std::unique_ptr<masked_documents_registry> registry_for(const updated_documents *ud, const std::size_t n) const;
+        };
 }
@@ -455,6 +455,40 @@ Trinity::isrc_docid_t Trinity::DocsSetIterators::DisjunctionAllPLI::next()
         return curDocument.id;
 }
 
+uint32_t Trinity::DocsSetIterators::DisjunctionAllPLI::fill_window(const isrc_docid_t windowBase, const isrc_docid_t windowMax, uint64_t *const matching)
+{
+        isrc_docid_t batch[BATCH_SIZE];
+        uint32_t m{0};
+
+        while (likely(pq.size()))
+        {
+                auto top = pq.top();
+
+                if (top->current() >= windowMax)
+                        break;
+
+                while (const auto n = top->next_block(batch, nullptr, BATCH_SIZE, windowMax))
+                {
+                        for (uint32_t k{0}; k != n; ++k)
+                        {
+                                const auto i = batch[k] - windowBase;
+
+                                matching[i >> 6] |= uint64_t(1) << (i & 63);
+                        }
+
+                        m = std::max<uint32_t>(m, (batch[n - 1] - windowBase) >> 6);
+                }
+
+                if (top->current() == DocIDsEND)
+                        pq.erase(top);
+                else
+                        pq.update_top();
+        }
+
+        curDocument.id = pq.empty() ? DocIDsEND : pq.top()->current();
+        return m;
+}
+
 Trinity::isrc_docid_t Trinity::DocsSetIterators::DisjunctionAllPLI::advance(const isrc_docid_t target)
 {
         if (pq.empty())
@@ -264,6 +264,10 @@ namespace Trinity
                       public:
                         Switch::priority_queue<Codecs::PostingsListIterator *, Compare> pq;
 
+                      public:
+                        // see Codecs::PostingsListIterator::next_block()
+                        static constexpr uint32_t BATCH_SIZE{128};
+
                       public:
                         DisjunctionAllPLI(Iterator **iterators, const isrc_docid_t cnt)
                             : Iterator{Type::DisjunctionAllPLI}, istack(cnt), pq{cnt}
@@ -276,6 +280,11 @@ namespace Trinity
 
                         isrc_docid_t advance(const isrc_docid_t target) override final;
 
+                        // For Docs Sets Spans: sets the bits in matching[] for all documents in [current(), windowMax), relative to windowBase
+                        // and advances to the first document >= windowMax. Returns the max. matching[] index set (0 if none).
+                        // Drains every postings list iterator using next_block(), instead of next() on each for every matched document.
+                        uint32_t fill_window(const isrc_docid_t windowBase, const isrc_docid_t windowMax, uint64_t *matching);
+
 #ifdef RDP_NEED_TOTAL_MATCHES
 			uint32_t total_matches() override final
 			{
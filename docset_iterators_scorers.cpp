@@ -37,6 +37,16 @@ static IteratorScorer *default_wrapper(queryexec_ctx *const rctx, DocsSetIterato
 
                                         return scorer->score(i->current(), i->freq, weight);
                                 }
+
+                                uint32_t next_scored_block(isrc_docid_t *const ids, float *const scores, const uint32_t max, const isrc_docid_t upto) override final
+                                {
+                                        tokenpos_t freqs[max];
+                                        const auto n = static_cast<Codecs::PostingsListIterator *>(it)->next_block(ids, freqs, max, upto);
+
+                                        if (n)
+                                                scorer->score_batch(ids, freqs, n, weight, scores);
+                                        return n;
+                                }
                         };
 
                         return new Wrapper(it, rctx);
@@ -279,6 +289,19 @@ static IteratorScorer *default_wrapper(queryexec_ctx *const rctx, DocsSetIterato
         return nullptr;
 }
 
+uint32_t Trinity::IteratorScorer::next_scored_block(isrc_docid_t *const ids, float *const scores, const uint32_t max, const isrc_docid_t upto)
+{
+        uint32_t n{0};
+
+        for (auto id = it->current(); id < upto && n != max; id = it->next())
+        {
+                ids[n] = id;
+                scores[n] = iterator_score();
+                ++n;
+        }
+        return n;
+}
+
 DocsSetIterators::Iterator *DocsSetIterators::wrap_iterator(queryexec_ctx *const rctx, DocsSetIterators::Iterator *it)
 {
         it->rdp = default_wrapper(rctx, it);
@@ -1,4 +1,5 @@
 #include "docset_spans.h"
+#include "codecs.h"
 #include "queryexec_ctx.h"
 #include <switch_bitops.h>
 
@@ -12,6 +13,14 @@ Trinity::isrc_docid_t Trinity::DocsSetSpanForPartialMatch::process(MatchesProxy
         isrc_docid_t id{DocIDsEND};
         relevant_document relDoc;
 
+        // Seek to min; iterators are only positioned(next()) when the span is constructed, but we
+        // may be asked to process a documents range(see exec_query_range())
+        while (pq.top()->current() < min)
+        {
+                pq.top()->advance(min);
+                pq.update_top();
+        }
+
         for (;;)
         {
                 auto it = pq.top();
@@ -109,11 +118,93 @@ Trinity::DocsSetSpanForDisjunctionsWithSpans::DocsSetSpanForDisjunctionsWithSpan
         require(pq.size());
 }
 
+// Sets the bits in matching[] for all documents of `it` in [it->current(), windowMax), and
+// advances it to the first document >= windowMax. Returns the max. matching[] index set, or m if none was set.
+//
+// PostingsListIterators(and DisjunctionAllPLI, which is just a collection of them) hand out documents in batches
+// using next_block(), so that we don't need to go through the vtable for every document.
+static uint32_t fill_window(DocsSetIterators::Iterator *const it, const isrc_docid_t windowBase, const isrc_docid_t windowMax, uint64_t *const matching, uint32_t m)
+{
+        switch (it->type)
+        {
+                case DocsSetIterators::Type::PostingsListIterator:
+                {
+                        auto *const pli = static_cast<Codecs::PostingsListIterator *>(it);
+                        isrc_docid_t batch[DocsSetIterators::DisjunctionAllPLI::BATCH_SIZE];
+
+                        while (const auto n = pli->next_block(batch, nullptr, sizeof_array(batch), windowMax))
+                        {
+                                for (uint32_t k{0}; k != n; ++k)
+                                {
+                                        const auto i = batch[k] - windowBase;
+
+                                        matching[i >> 6] |= uint64_t(1) << (i & 63);
+                                }
+
+                                m = std::max<uint32_t>(m, (batch[n - 1] - windowBase) >> 6);
+                        }
+                }
+                break;
+
+                case DocsSetIterators::Type::DisjunctionAllPLI:
+                        m = std::max<uint32_t>(m, static_cast<DocsSetIterators::DisjunctionAllPLI *>(it)->fill_window(windowBase, windowMax, matching));
+                        break;
+
+                default:
+                        for (auto id = it->current(); id < windowMax; id = it->next())
+                        {
+                                const auto i = id - windowBase;
+                                const auto mi = i >> 6;
+
+                                // std::max() is at least as fast as the branchless alt.
+                                // m = m ^ ((m ^ mi) & -(m < mi));
+                                m = std::max<uint32_t>(m, mi);
+                                matching[mi] |= uint64_t(1) << (i & 63);
+                        }
+                        break;
+        }
+
+        return m;
+}
+
+// Like fill_window(), except that it also accumulates the score of each document into tracker[]
+// Scores are computed in batches(see IteratorScorer::next_scored_block()), which for postings lists
+// means that whole decoded blocks are scored with a single Similarity::IndexSourceTermsScorer::score_batch() call
+static uint32_t score_window(DocsSetIterators::Iterator *const it, const isrc_docid_t windowBase, const isrc_docid_t windowMax, uint64_t *const matching, std::pair<double, uint32_t> *const tracker, uint32_t m)
+{
+        auto *const rdp = static_cast<IteratorScorer *>(it->rdp);
+        isrc_docid_t ids[DocsSetIterators::DisjunctionAllPLI::BATCH_SIZE];
+        float scores[DocsSetIterators::DisjunctionAllPLI::BATCH_SIZE];
+
+        while (const auto n = rdp->next_scored_block(ids, scores, sizeof_array(ids), windowMax))
+        {
+                for (uint32_t k{0}; k != n; ++k)
+                {
+                        const auto i = ids[k] - windowBase;
+
+                        matching[i >> 6] |= uint64_t(1) << (i & 63);
+                        tracker[i].first += scores[k];
+                        tracker[i].second++;
+                }
+
+                m = std::max<uint32_t>(m, (ids[n - 1] - windowBase) >> 6);
+        }
+
+        return m;
+}
+
 Trinity::isrc_docid_t Trinity::DocsSetSpanForDisjunctions::process(MatchesProxy *const mp, const isrc_docid_t min, const isrc_docid_t max)
 {
         isrc_docid_t id{DocIDsEND};
         relevant_document relDoc;
 
+        // see DocsSetSpanForPartialMatch::process()
+        while (pq.top()->current() < min)
+        {
+                pq.top()->advance(min);
+                pq.update_top();
+        }
+
         for (;;)
         {
                 auto it = pq.top();
@@ -142,11 +233,28 @@ Trinity::isrc_docid_t Trinity::DocsSetSpanForDisjunctions::process(MatchesProxy
                         // fast-path: one iterator can match in this window
                         auto *const it = collected[0];
 
-                        for (auto id = it->current(); id < windowMax; id = it->next())
-			{
-				relDoc.set_document(id);
-                                mp->process(&relDoc);
-			}
+                        if (it->type == DocsSetIterators::Type::PostingsListIterator)
+                        {
+                                auto *const pli = static_cast<Codecs::PostingsListIterator *>(it);
+                                isrc_docid_t batch[DocsSetIterators::DisjunctionAllPLI::BATCH_SIZE];
+
+                                while (const auto n = pli->next_block(batch, nullptr, sizeof_array(batch), windowMax))
+                                {
+                                        for (uint32_t k{0}; k != n; ++k)
+                                        {
+                                                relDoc.set_document(batch[k]);
+                                                mp->process(&relDoc);
+                                        }
+                                }
+                        }
+                        else
+                        {
+                                for (auto id = it->current(); id < windowMax; id = it->next())
+                                {
+                                        relDoc.set_document(id);
+                                        mp->process(&relDoc);
+                                }
+                        }
 
                         pq.push(it);
                 }
@@ -159,18 +267,7 @@ Trinity::isrc_docid_t Trinity::DocsSetSpanForDisjunctions::process(MatchesProxy
                         {
                                 auto *const it = collected[i_];
 
-                                for (auto id = it->current(); id < windowMax; id = it->next())
-                                {
-                                        const auto i = id - windowBase;
-                                        const auto mi = i >> 6;
-
-
-                                        // std::max() is at least as fast as the branchless alt.
-                                        // m = m ^ ((m ^ mi) & -(m < mi));
-                                        m = std::max<uint32_t>(m, mi);
-                                        matching[mi] |= uint64_t(1) << (i & 63);
-                                }
-
+                                m = fill_window(it, windowBase, windowMax, matching, m);
                                 pq.push(it);
                         }
 
@@ -647,22 +744,11 @@ void Trinity::DocsSetSpanForDisjunctionsWithThresholdAndCost::score_window_many(
                         for (uint16_t i{0}; i != leadsCnt; ++i)
                         {
                                 auto *const it = leads[i]->it;
-				const auto rdp{it->rdp};
 
                                 if (it->current() < min)
                                         it->advance(min);
 
-                                for (auto id = it->current(); id < max; id = it->next())
-                                {
-                                        const auto i = id - windowBase;
-                                        const auto mi = i >> 6;
-
-                                        m = std::max<uint32_t>(m, mi);
-                                        matching[mi] |= uint64_t(1) << (i & 63);
-
-                                        matchesTracker[i].second++;
-                                        matchesTracker[i].first += rdp->score();
-                                }
+                                m = score_window(it, windowBase, max, matching, matchesTracker, m);
                                 leads[i]->next = it->current();
                         }
 
@@ -786,6 +872,13 @@ Trinity::isrc_docid_t Trinity::DocsSetSpanForDisjunctionsWithThreshold::process(
         isrc_docid_t id{DocIDsEND};
         relevant_document relDoc;
 
+        // see DocsSetSpanForPartialMatch::process()
+        while (pq.top()->current() < min)
+        {
+                pq.top()->advance(min);
+                pq.update_top();
+        }
+
         for (;;)
         {
                 auto it = pq.top();
@@ -834,20 +927,8 @@ Trinity::isrc_docid_t Trinity::DocsSetSpanForDisjunctionsWithThreshold::process(
                                 for (uint32_t i_{0}; i_ != collectedCnt; ++i_)
                                 {
                                         auto *const it = collected[i_];
-                                        const auto rdp{it->rdp};
-
-                                        for (auto id = it->current(); id < windowMax; id = it->next())
-                                        {
-                                                const auto i = id - windowBase;
-                                                const auto mi = i >> 6;
-
-                                                m = std::max<uint32_t>(m, mi);
-                                                matching[mi] |= uint64_t(1) << (i & 63);
-
-                                                tracker[i].first += rdp->score();
-                                                tracker[i].second++;
-                                        }
 
+                                        m = score_window(it, windowBase, windowMax, matching, tracker, m);
                                         pq.push(it);
                                 }
                         }
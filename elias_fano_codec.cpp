@@ -0,0 +1,635 @@
+#include "elias_fano_codec.h"
+#include "utils.h"
+#include <ansifmt.h>
+#include <compress.h>
+#include <switch_bitops.h>
+
+static constexpr bool trace{false};
+
+// Partitions are not aligned in the index, so we need to use memcpy() to access their words
+[[gnu::always_inline]] static inline uint64_t load_word(const uint8_t *const p, const uint32_t idx) noexcept
+{
+        uint64_t v;
+
+        memcpy(&v, p + (idx << 3), sizeof(uint64_t));
+        return v;
+}
+
+static void set_bits(uint64_t *const words, const uint32_t offset, const uint8_t width, const uint64_t v) noexcept
+{
+        if (!width)
+                return;
+
+        const auto idx = offset >> 6;
+        const auto shift = offset & 63;
+
+        words[idx] |= v << shift;
+        if (shift + width > 64)
+                words[idx + 1] |= v >> (64 - shift);
+}
+
+[[gnu::always_inline]] static inline uint32_t get_bits(const uint8_t *const p, const uint32_t offset, const uint8_t width) noexcept
+{
+        if (!width)
+                return 0;
+
+        const auto idx = offset >> 6;
+        const auto shift = offset & 63;
+        auto v = load_word(p, idx) >> shift;
+
+        if (shift + width > 64)
+                v |= load_word(p, idx + 1) << (64 - shift);
+
+        return v & ((uint64_t(1) << width) - 1);
+}
+
+// position of the first set bit at or after `from`
+// there must be one
+[[gnu::always_inline]] static inline uint32_t next_set_bit(const uint8_t *const p, const uint32_t from) noexcept
+{
+        auto idx = from >> 6;
+        auto w = load_word(p, idx) & (~uint64_t(0) << (from & 63));
+
+        while (!w)
+                w = load_word(p, ++idx);
+
+        return (idx << 6) + SwitchBitOps::TrailingZeros(w);
+}
+
+// position of the nth (1-based) unset bit
+// The high bits of a partition are at most a few words long (PARTITION_SIZE * 3 bits), so this is effectively constant time
+static uint32_t select0(const uint8_t *const p, uint32_t n) noexcept
+{
+        for (uint32_t idx{0};; ++idx)
+        {
+                auto w = ~load_word(p, idx);
+                const uint32_t cnt = SwitchBitOps::PopCnt(w);
+
+                if (n <= cnt)
+                {
+                        while (--n)
+                                w &= w - 1;
+
+                        return (idx << 6) + SwitchBitOps::TrailingZeros(w);
+                }
+
+                n -= cnt;
+        }
+}
+
+static inline uint32_t high_bits_cnt(const uint32_t n, const uint32_t universe, const uint8_t lowBits) noexcept
+{
+        return n + ((universe - 1) >> lowBits) + 1;
+}
+
+void Trinity::Codecs::EliasFano::IndexSession::begin()
+{
+}
+
+void Trinity::Codecs::EliasFano::IndexSession::flush_positions_data()
+{
+        if (positionsOutFd == -1)
+        {
+                positionsOutFd = open(Buffer{}.append(basePath, "/hits.data.t").c_str(), O_WRONLY | O_LARGEFILE | O_CREAT, 0775);
+
+                if (positionsOutFd == -1)
+                        throw Switch::data_error("Failed to persist hits.data");
+        }
+
+        if (Utilities::to_file(positionsOut.data(), positionsOut.size(), positionsOutFd) == -1)
+                throw Switch::data_error("Failed to persist hits.data");
+
+        positionsOutFlushed += positionsOut.size();
+        positionsOut.clear();
+}
+
+void Trinity::Codecs::EliasFano::IndexSession::end()
+{
+        if (positionsOut.size())
+                flush_positions_data();
+
+        if (positionsOutFd != -1)
+        {
+                if (close(positionsOutFd) == -1)
+                        throw Switch::data_error("Failed to persist hits.data");
+
+                positionsOutFd = -1;
+
+                if (rename(Buffer{}.append(basePath, "/hits.data.t").c_str(), Buffer{}.append(basePath, "/hits.data").c_str()) == -1)
+                {
+                        unlink(Buffer{}.append(basePath, "/hits.data.t").c_str());
+                        throw Switch::data_error("Failed to persist hits.data");
+                }
+        }
+}
+
+Trinity::Codecs::Encoder *Trinity::Codecs::EliasFano::IndexSession::new_encoder()
+{
+        return new Trinity::Codecs::EliasFano::Encoder(this);
+}
+
+range32_t Trinity::Codecs::EliasFano::IndexSession::append_index_chunk(const Trinity::Codecs::AccessProxy *src_, const term_index_ctx srcTCTX)
+{
+        const auto src = static_cast<const Trinity::Codecs::EliasFano::AccessProxy *>(src_);
+        const auto o = indexOut.size() + indexOutFlushed;
+
+        require(srcTCTX.indexChunk.size());
+
+        auto *p = src->indexPtr + srcTCTX.indexChunk.offset, *const end = p + srcTCTX.indexChunk.size();
+        const auto hitsDataOffset = *(uint32_t *)p;
+        p += sizeof(uint32_t);
+        const auto sumHits = *(uint32_t *)p;
+        p += sizeof(uint32_t);
+        const auto positionsChunkSize = *(uint32_t *)p;
+        p += sizeof(uint32_t);
+        const auto newHitsDataOffset = positionsOut.size() + positionsOutFlushed;
+
+        // partitions offsets are relative to the term chunk, and hits offsets are relative
+        // to the term hits chunk, so we only need to adjust the hits chunk offset
+        positionsOut.serialize(src->hitsDataPtr + hitsDataOffset, positionsChunkSize);
+        indexOut.pack(uint32_t(newHitsDataOffset), sumHits, positionsChunkSize);
+        indexOut.serialize(p, end - p);
+
+        return {uint32_t(o), srcTCTX.indexChunk.size()};
+}
+
+void Trinity::Codecs::EliasFano::IndexSession::append_private_session(Trinity::Codecs::IndexSession *const src_, term_index_ctx *const tctxs, const size_t n)
+{
+        auto src = static_cast<Trinity::Codecs::EliasFano::IndexSession *>(src_);
+        const auto o = indexOut.size() + indexOutFlushed;
+        const auto base = indexOut.size();
+        const uint32_t hitsBase = positionsOut.size() + positionsOutFlushed;
+
+        positionsOut.serialize(src->positionsOut.data(), src->positionsOut.size());
+        indexOut.serialize(src->indexOut.data(), src->indexOut.size());
+
+        // see append_index_chunk(); only the hits chunk offset needs to be adjusted
+        for (size_t i{0}; i != n; ++i)
+        {
+                auto &tctx = tctxs[i];
+
+                *reinterpret_cast<uint32_t *>(indexOut.data() + base + tctx.indexChunk.offset) += hitsBase;
+                tctx.indexChunk.offset += o;
+        }
+
+        src->indexOut.clear();
+        src->positionsOut.clear();
+
+        if (flushFreq && unlikely(positionsOut.size() > flushFreq))
+                flush_positions_data();
+}
+
+#pragma mark ENCODER
+void Trinity::Codecs::EliasFano::Encoder::begin_term()
+{
+        const auto s = static_cast<Trinity::Codecs::EliasFano::IndexSession *>(sess);
+
+        partitions.clear();
+        partitionsData.clear();
+        buffered = 0;
+        termDocuments = 0;
+        sumHits = 0;
+        lastDocID = 0;
+        partitionBase = 0;
+        partitionHitsOffset = 0;
+        termPositionsOffset = s->positionsOut.size() + s->positionsOutFlushed;
+}
+
+void Trinity::Codecs::EliasFano::Encoder::begin_document(const isrc_docid_t documentID)
+{
+        require(documentID > lastDocID);
+
+        if (unlikely(buffered == PARTITION_SIZE))
+                output_partition();
+
+        if (!buffered)
+        {
+                const auto s = static_cast<Trinity::Codecs::EliasFano::IndexSession *>(sess);
+
+                partitionHitsOffset = (s->positionsOut.size() + s->positionsOutFlushed) - termPositionsOffset;
+        }
+
+        docIDs[buffered] = documentID;
+        freqs[buffered] = 0;
+        ++termDocuments;
+
+        lastDocID = documentID;
+        lastPosition = 0;
+        lastPayloadLen = 0;
+}
+
+void Trinity::Codecs::EliasFano::Encoder::new_hit(const uint32_t pos, const range_base<const uint8_t *, const uint8_t> payload)
+{
+        if (!pos && !payload)
+        {
+                // This is perfectly fine
+                return;
+        }
+
+        require(pos >= lastPosition);
+
+        auto positionsOut = &static_cast<Trinity::Codecs::EliasFano::IndexSession *>(sess)->positionsOut;
+        const auto delta = pos - lastPosition;
+        const uint8_t payloadLen = payload.size();
+
+        if (payloadLen != lastPayloadLen)
+        {
+                lastPayloadLen = payloadLen;
+                positionsOut->encode_varbyte32((delta << 1) | 1);
+                positionsOut->pack(payloadLen);
+        }
+        else
+                positionsOut->encode_varbyte32(delta << 1);
+
+        if (payloadLen)
+        {
+                require(payloadLen <= sizeof(uint64_t));
+                positionsOut->serialize(payload.offset, payloadLen);
+        }
+
+        lastPosition = pos;
+        ++freqs[buffered];
+        ++sumHits;
+}
+
+void Trinity::Codecs::EliasFano::Encoder::end_document()
+{
+        ++buffered;
+}
+
+void Trinity::Codecs::EliasFano::Encoder::output_partition()
+{
+        const auto n{buffered};
+        const auto partitionLastDocID = docIDs[n - 1];
+        // we encode (documentID - partitionBase - 1), so all values are in [0, universe)
+        const uint32_t universe = partitionLastDocID - partitionBase;
+        uint8_t lowBits{0};
+        uint32_t maxFreq{0};
+        uint8_t freqBits{0};
+
+        require(n && n <= PARTITION_SIZE);
+
+        if (universe > n)
+                lowBits = 31 - SwitchBitOps::LeadingZeros(uint32_t(universe / n));
+
+        for (uint32_t i{0}; i != n; ++i)
+                maxFreq = std::max(maxFreq, freqs[i]);
+
+        if (maxFreq)
+                freqBits = 32 - SwitchBitOps::LeadingZeros(maxFreq);
+
+        const auto lowWords = (n * lowBits + 63) / 64;
+        const auto highWords = (high_bits_cnt(n, universe, lowBits) + 63) / 64;
+        const auto freqWords = (n * freqBits + 63) / 64;
+
+        words.clear();
+        words.resize(lowWords + highWords + freqWords, 0);
+
+        auto *const low = words.data(), *const high = low + lowWords, *const fw = high + highWords;
+
+        for (uint32_t i{0}; i != n; ++i)
+        {
+                const uint32_t v = docIDs[i] - partitionBase - 1;
+                const auto h = (v >> lowBits) + i;
+
+                set_bits(low, i * lowBits, lowBits, v & ((uint64_t(1) << lowBits) - 1));
+                high[h >> 6] |= uint64_t(1) << (h & 63);
+                set_bits(fw, i * freqBits, freqBits, freqs[i]);
+        }
+
+        if (trace)
+                SLog("Partition of ", n, " documents, universe = ", universe, ", lowBits = ", lowBits, ", freqBits = ", freqBits, "\n");
+
+        partitions.push_back({partitionLastDocID, uint32_t(partitionsData.size()), partitionHitsOffset});
+        partitionsData.pack(uint8_t(n - 1), lowBits, freqBits);
+        partitionsData.serialize(words.data(), words.size() * sizeof(uint64_t));
+
+        partitionBase = partitionLastDocID;
+        buffered = 0;
+}
+
+void Trinity::Codecs::EliasFano::Encoder::end_term(term_index_ctx *out)
+{
+        auto *const __restrict__ s = static_cast<Trinity::Codecs::EliasFano::IndexSession *>(sess);
+        auto indexOut = &sess->indexOut;
+        const auto termIndexOffset = indexOut->size() + sess->indexOutFlushed;
+
+        if (buffered)
+                output_partition();
+
+        const uint32_t partitionsBase = TERM_HEADER_SIZE + partitions.size() * PARTITION_REF_SIZE;
+        const uint32_t positionsChunkSize = (s->positionsOut.size() + s->positionsOutFlushed) - termPositionsOffset;
+
+        indexOut->pack(uint32_t(termPositionsOffset), sumHits, positionsChunkSize, uint32_t(partitions.size()));
+        for (const auto &it : partitions)
+                indexOut->pack(it.lastDocID, it.offset + partitionsBase, it.hitsOffset);
+        indexOut->serialize(partitionsData.data(), partitionsData.size());
+
+        out->documents = termDocuments;
+        out->indexChunk.Set(termIndexOffset, uint32_t((indexOut->size() + sess->indexOutFlushed) - termIndexOffset));
+
+        if (const auto f = s->flushFreq; f && unlikely(s->positionsOut.size() > f))
+                s->flush_positions_data();
+}
+
+#pragma mark DECODER
+void Trinity::Codecs::EliasFano::Decoder::init(const term_index_ctx &tctx, Trinity::Codecs::AccessProxy *access)
+{
+        auto ap = static_cast<Trinity::Codecs::EliasFano::AccessProxy *>(access);
+        const auto *p = ap->indexPtr + tctx.indexChunk.offset;
+
+        indexTermCtx = tctx;
+        chunkBase = p;
+
+        const auto hitsDataOffset = *(uint32_t *)p;
+        p += sizeof(uint32_t);
+        p += sizeof(uint32_t); // sumHits
+        p += sizeof(uint32_t); // positions chunk size
+        partitionsCnt = *(uint32_t *)p;
+        p += sizeof(uint32_t);
+
+        partitionsDir = p;
+        hitsBase = ap->hitsDataPtr + hitsDataOffset;
+}
+
+Trinity::Codecs::PostingsListIterator *Trinity::Codecs::EliasFano::Decoder::new_iterator()
+{
+        auto it = std::make_unique<Trinity::Codecs::EliasFano::PostingsListIterator>(this);
+
+        // partition.size == 0: we haven't accessed any partitions yet
+        it->partition.idx = 0;
+        it->partition.size = 0;
+        it->partition.lastDocID = 0;
+        it->i = 0;
+        it->freq = 0;
+
+        return it.release();
+}
+
+void Trinity::Codecs::EliasFano::Decoder::update_curdoc(PostingsListIterator *const __restrict__ it) noexcept
+{
+        const auto &partition{it->partition};
+        const auto i{it->i};
+        const uint64_t v = (uint64_t(it->highBit - i) << partition.lowBits) | get_bits(partition.low, i * partition.lowBits, partition.lowBits);
+
+        it->curDocument.id = partition.base + 1 + v;
+        it->freq = get_bits(partition.freqs, i * partition.freqBits, partition.freqBits);
+}
+
+void Trinity::Codecs::EliasFano::Decoder::load_partition(PostingsListIterator *const it, const uint32_t idx)
+{
+        const auto *const ref = reinterpret_cast<const uint32_t *>(partitionsDir + idx * PARTITION_REF_SIZE);
+        auto &partition{it->partition};
+        const auto *p = chunkBase + ref[1];
+
+        partition.idx = idx;
+        partition.lastDocID = ref[0];
+        partition.base = idx ? partition_last_docid(idx - 1) : 0;
+        partition.size = uint16_t(*p++) + 1;
+        partition.lowBits = *p++;
+        partition.freqBits = *p++;
+        it->decodedDocs += partition.size;
+
+        const auto universe = partition.lastDocID - partition.base;
+        const auto lowWords = (partition.size * partition.lowBits + 63) / 64;
+        const auto highWords = (high_bits_cnt(partition.size, universe, partition.lowBits) + 63) / 64;
+
+        partition.low = p;
+        partition.high = p + lowWords * sizeof(uint64_t);
+        partition.freqs = partition.high + highWords * sizeof(uint64_t);
+
+        it->hdp = hitsBase + ref[2];
+        it->hitsDocIdx = 0;
+
+        it->i = 0;
+        it->highBit = next_set_bit(partition.high, 0);
+        update_curdoc(it);
+}
+
+[[gnu::hot]] void Trinity::Codecs::EliasFano::Decoder::next(PostingsListIterator *const __restrict__ it)
+{
+        auto &partition{it->partition};
+
+        if (unlikely(partition.size == 0))
+        {
+                // first access
+                if (partitionsCnt)
+                        load_partition(it, 0);
+                else
+                        finalize(it);
+                return;
+        }
+
+        if (unlikely(++(it->i) >= partition.size))
+        {
+                if (partition.idx + 1 >= partitionsCnt)
+                        finalize(it);
+                else
+                        load_partition(it, partition.idx + 1);
+                return;
+        }
+
+        it->highBit = next_set_bit(partition.high, it->highBit + 1);
+        update_curdoc(it);
+}
+
+// The "decoded block" here is the current partition
+[[gnu::hot]] uint32_t Trinity::Codecs::EliasFano::Decoder::next_block(PostingsListIterator *const __restrict__ it, isrc_docid_t *const __restrict__ out, tokenpos_t *const __restrict__ freqs, const uint32_t max, const isrc_docid_t upto)
+{
+        const auto &partition{it->partition};
+        uint32_t n{0};
+
+        for (auto id = it->curDocument.id; id < upto && n != max; id = it->curDocument.id)
+        {
+                out[n] = id;
+                if (freqs)
+                        freqs[n] = it->freq;
+                ++n;
+
+                if (unlikely(++(it->i) >= partition.size))
+                {
+                        if (partition.idx + 1 >= partitionsCnt)
+                                finalize(it);
+                        else
+                                load_partition(it, partition.idx + 1);
+                        break;
+                }
+
+                it->highBit = next_set_bit(partition.high, it->highBit + 1);
+                update_curdoc(it);
+        }
+
+        return n;
+}
+
+[[gnu::hot]] void Trinity::Codecs::EliasFano::Decoder::advance(PostingsListIterator *const __restrict__ it, const isrc_docid_t target)
+{
+        auto &partition{it->partition};
+
+        if (partition.size && it->curDocument.id >= target)
+                return;
+
+        if (unlikely(partition.size == 0 || target > partition.lastDocID))
+        {
+                // find the first partition where lastDocID >= target
+                uint32_t btm = partition.size ? partition.idx + 1 : 0, top = partitionsCnt;
+
+                if (trace)
+                        SLog("Searching partitions [", btm, ", ", top, ") for ", target, "\n");
+
+                while (btm < top)
+                {
+                        const auto mid = (btm + top) / 2;
+
+                        if (partition_last_docid(mid) < target)
+                                btm = mid + 1;
+                        else
+                                top = mid;
+                }
+
+                if (btm >= partitionsCnt)
+                {
+                        finalize(it);
+                        return;
+                }
+
+                it->skippedBlocks += btm - (partition.size ? partition.idx + 1 : 0);
+                load_partition(it, btm);
+                if (it->curDocument.id >= target)
+                        return;
+        }
+
+        // target is in (partition.base, partition.lastDocID], so there's a document >= target in this partition
+        // Jump straight to the first document with the same high bits as the target using select0
+        const auto h = (target - partition.base - 1) >> partition.lowBits;
+
+        if (h > it->highBit - it->i)
+        {
+                const auto pos = select0(partition.high, h) + 1;
+
+                it->i = pos - h;
+                it->highBit = next_set_bit(partition.high, pos);
+                update_curdoc(it);
+        }
+
+        while (it->curDocument.id < target)
+        {
+                ++(it->i);
+                it->highBit = next_set_bit(partition.high, it->highBit + 1);
+                update_curdoc(it);
+        }
+}
+
+void Trinity::Codecs::EliasFano::Decoder::skip_hits(PostingsListIterator *const it, const uint16_t upto)
+{
+        const auto &partition{it->partition};
+        auto p{it->hdp};
+
+        for (auto i{it->hitsDocIdx}; i < upto; ++i)
+        {
+                const auto freq = get_bits(partition.freqs, i * partition.freqBits, partition.freqBits);
+                uint8_t payloadLen{0};
+                uint32_t v;
+
+                for (uint32_t k{0}; k != freq; ++k)
+                {
+                        varbyte_get32(p, v);
+                        if (v & 1)
+                                payloadLen = *p++;
+                        p += payloadLen;
+                }
+        }
+
+        it->hdp = p;
+        it->hitsDocIdx = upto;
+}
+
+void Trinity::Codecs::EliasFano::Decoder::materialize_hits(PostingsListIterator *const it, DocWordsSpace *const __restrict__ dws, term_hit *const __restrict__ out)
+{
+        const auto termID{execCtxTermID};
+        const auto i{it->i};
+
+        if (unlikely(it->hitsDocIdx > i))
+        {
+                // already materialized
+                return;
+        }
+
+        skip_hits(it, i);
+
+        const auto freq = it->freq;
+        auto p{it->hdp};
+        tokenpos_t pos{0};
+        uint8_t payloadLen{0};
+        uint32_t v;
+
+        for (uint32_t k{0}; k != freq; ++k)
+        {
+                uint64_t payload{0};
+
+                varbyte_get32(p, v);
+                if (v & 1)
+                        payloadLen = *p++;
+
+                pos += v >> 1;
+                if (payloadLen)
+                {
+                        memcpy(&payload, p, payloadLen);
+                        p += payloadLen;
+                }
+
+                if (pos)
+                        dws->set(termID, pos);
+
+                out[k] = {payload, pos, payloadLen};
+        }
+
+        it->hdp = p;
+        it->hitsDocIdx = i + 1;
+}
+
+#pragma mark ACCESS PROXY
+Trinity::Codecs::Decoder *Trinity::Codecs::EliasFano::AccessProxy::new_decoder(const term_index_ctx &tctx)
+{
+        auto d = std::make_unique<Trinity::Codecs::EliasFano::Decoder>();
+
+        d->init(tctx, this);
+        return d.release();
+}
+
+Trinity::Codecs::EliasFano::AccessProxy::~AccessProxy()
+{
+        if (hitsDataSize)
+        {
+                // mmmaped()/owned by this AccessProxy
+                munmap((void *)hitsDataPtr, hitsDataSize);
+        }
+}
+
+Trinity::Codecs::EliasFano::AccessProxy::AccessProxy(const char *bp, const uint8_t *p, const uint8_t *hd)
+    : Trinity::Codecs::AccessProxy{bp, p}, hitsDataPtr{hd}
+{
+        if (hd == nullptr)
+        {
+                int fd = open(Buffer{}.append(basePath, "/hits.data").c_str(), O_RDONLY | O_LARGEFILE);
+
+                if (fd == -1)
+                {
+                        if (errno != ENOENT)
+                                throw Switch::data_error("Unable to access hits.data");
+                }
+                else if (const auto fileSize = lseek64(fd, 0, SEEK_END); fileSize > 0)
+                {
+                        hitsDataPtr = reinterpret_cast<const uint8_t *>(mmap(nullptr, fileSize, PROT_READ, MAP_SHARED, fd, 0));
+
+                        close(fd);
+                        expect(hitsDataPtr != MAP_FAILED);
+                        madvise((void *)hitsDataPtr, fileSize, MADV_DONTDUMP);
+                        hitsDataSize = fileSize;
+                }
+                else
+                {
+                        close(fd);
+                }
+        }
+}
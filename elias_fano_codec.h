@@ -0,0 +1,258 @@
+// A codec based on partitioned Elias-Fano encoding of document IDs
+// See "Partitioned Elias-Fano Indexes" (Ottaviano, Venturini) and Sebastiano Vigna's "Quasi-Succinct Indices"
+//
+// Each term's postings list is split into fixed size partitions, each encoded independently using Elias-Fano relative
+// to the last document ID of the previous partition (so the universe of each partition is small, even for very skewed terms).
+// A partitions directory (last document ID and offset of each partition) is stored ahead of the partitions, so that
+// advance() can seek to the partition that may contain the target, and then, within the partition, it's a select over
+// the high bits (which are a few 64bit words at most) -- no need to decode whole blocks like the Lucene and Google codecs do.
+//
+// Frequencies are bit-packed per partition so that they can be accessed randomly, and
+// hits(positions and payloads) are stored in a separate file (hits.data), similar to what the Lucene codec does.
+#pragma once
+#include "codecs.h"
+
+#define TRINITY_CODECS_ELIASFANO_AVAILABLE 1
+
+static_assert(sizeof(Trinity::isrc_docid_t) <= sizeof(uint32_t));
+
+namespace Trinity
+{
+        namespace Codecs
+        {
+                namespace EliasFano
+                {
+                        static constexpr size_t PARTITION_SIZE{128};
+
+                        // u32 hitsDataOffset, u32 sumHits, u32 positionsChunkSize, u32 partitionsCnt
+                        static constexpr size_t TERM_HEADER_SIZE{sizeof(uint32_t) * 4};
+
+                        // u32 lastDocID, u32 partition offset(relative to the term chunk), u32 hits offset(relative to the term hits chunk)
+                        static constexpr size_t PARTITION_REF_SIZE{sizeof(uint32_t) * 3};
+
+                        struct IndexSession final
+                            : public Trinity::Codecs::IndexSession
+                        {
+                                IOBuffer positionsOut;
+                                uint32_t positionsOutFlushed;
+                                int positionsOutFd;
+                                uint32_t flushFreq;
+
+                                // private
+                                void flush_positions_data();
+
+                                IndexSession(const char *bp)
+                                    : Trinity::Codecs::IndexSession{bp, unsigned(Capabilities::AppendIndexChunk) | unsigned(Capabilities::ParallelEncoding)}, positionsOutFlushed{0}, positionsOutFd{-1}, flushFreq{0}
+                                {
+                                }
+
+                                ~IndexSession()
+                                {
+                                        if (positionsOutFd != -1)
+                                                close(positionsOutFd);
+                                }
+
+                                constexpr void set_flush_freq(const uint32_t f)
+                                {
+                                        flushFreq = f;
+                                }
+
+                                void begin() override final;
+
+                                void end() override final;
+
+                                Trinity::Codecs::Encoder *new_encoder() override final;
+
+                                strwlen8_t codec_identifier() override final
+                                {
+                                        return "ELIASFANO"_s8;
+                                }
+
+                                range32_t append_index_chunk(const Trinity::Codecs::AccessProxy *, const term_index_ctx srcTCTX) override final;
+
+                                Trinity::Codecs::IndexSession *new_private_session() override final
+                                {
+                                        return new IndexSession(basePath);
+                                }
+
+                                void append_private_session(Trinity::Codecs::IndexSession *, term_index_ctx *, const size_t) override final;
+
+                                // No codec specific merge(); MergeCandidatesCollection::merge() will
+                                // use the generic decode/encode path for postings lists of the same term across multiple segments
+                        };
+
+                        class Encoder final
+                            : public Trinity::Codecs::Encoder
+                        {
+                              private:
+                                struct partition_ref final
+                                {
+                                        isrc_docid_t lastDocID;
+                                        uint32_t offset;
+                                        uint32_t hitsOffset;
+                                };
+
+                              private:
+                                std::vector<partition_ref> partitions;
+                                std::vector<uint64_t> words;
+                                IOBuffer partitionsData;
+                                isrc_docid_t docIDs[PARTITION_SIZE];
+                                uint32_t freqs[PARTITION_SIZE];
+                                uint32_t buffered, termDocuments, sumHits;
+                                uint32_t termPositionsOffset, partitionHitsOffset;
+                                isrc_docid_t lastDocID, partitionBase;
+                                uint32_t lastPosition;
+                                uint8_t lastPayloadLen;
+
+                              private:
+                                void output_partition();
+
+                              public:
+                                Encoder(Trinity::Codecs::IndexSession *s)
+                                    : Trinity::Codecs::Encoder{s}
+                                {
+                                }
+
+                                void begin_term() override final;
+
+                                void begin_document(const isrc_docid_t documentID) override final;
+
+                                void new_hit(const uint32_t pos, const range_base<const uint8_t *, const uint8_t> payload) override final;
+
+                                inline void new_position(const uint32_t pos)
+                                {
+                                        new_hit(pos, {});
+                                }
+
+                                void end_document() override final;
+
+                                void end_term(term_index_ctx *tctx) override final;
+                        };
+
+                        struct AccessProxy final
+                            : public Trinity::Codecs::AccessProxy
+                        {
+                                const uint8_t *hitsDataPtr;
+                                uint64_t hitsDataSize{0};
+
+                                AccessProxy(const char *bp, const uint8_t *p, const uint8_t *hd = nullptr);
+
+                                ~AccessProxy();
+
+                                strwlen8_t codec_identifier() override final
+                                {
+                                        return "ELIASFANO"_s8;
+                                }
+
+                                Trinity::Codecs::Decoder *new_decoder(const term_index_ctx &tctx) override final;
+                        };
+
+                        class Decoder;
+
+                        struct PostingsListIterator final
+                            : public Trinity::Codecs::PostingsListIterator
+                        {
+                                friend class Decoder;
+
+                              protected:
+                                // current partition
+                                struct
+                                {
+                                        uint32_t idx;
+                                        isrc_docid_t base, lastDocID;
+                                        uint16_t size;
+                                        uint8_t lowBits, freqBits;
+                                        const uint8_t *low, *high, *freqs;
+                                } partition;
+
+                                // index of the current document in the partition, and its bit in partition.high
+                                uint16_t i;
+                                uint32_t highBit;
+
+                                // hits of the document (in the current partition) at hitsDocIdx begin at hdp
+                                const uint8_t *hdp;
+                                uint16_t hitsDocIdx;
+
+                              public:
+                                inline isrc_docid_t next() override final;
+
+                                inline isrc_docid_t advance(const isrc_docid_t) override final;
+
+                                inline void materialize_hits(DocWordsSpace *dwspace, term_hit *out) override final;
+
+                                inline uint32_t next_block(isrc_docid_t *, tokenpos_t *, const uint32_t, const isrc_docid_t) override final;
+
+                                PostingsListIterator(Decoder *const d)
+                                    : Trinity::Codecs::PostingsListIterator{reinterpret_cast<Trinity::Codecs::Decoder *>(d)}
+                                {
+                                }
+                        };
+
+                        class Decoder final
+                            : public Trinity::Codecs::Decoder
+                        {
+                                friend struct PostingsListIterator;
+
+                              protected:
+                                void next(PostingsListIterator *);
+
+                                void advance(PostingsListIterator *, const isrc_docid_t);
+
+                                uint32_t next_block(PostingsListIterator *, isrc_docid_t *, tokenpos_t *, const uint32_t, const isrc_docid_t);
+
+                                void materialize_hits(PostingsListIterator *, DocWordsSpace *, term_hit *);
+
+                              private:
+                                const uint8_t *chunkBase, *partitionsDir, *hitsBase;
+                                uint32_t partitionsCnt;
+
+                              private:
+                                inline isrc_docid_t partition_last_docid(const uint32_t idx) const noexcept
+                                {
+                                        return *reinterpret_cast<const uint32_t *>(partitionsDir + idx * PARTITION_REF_SIZE);
+                                }
+
+                                void load_partition(PostingsListIterator *, const uint32_t idx);
+
+                                void skip_hits(PostingsListIterator *, const uint16_t upto);
+
+                                void update_curdoc(PostingsListIterator *) noexcept;
+
+                                inline void finalize(PostingsListIterator *const it) noexcept
+                                {
+                                        it->partition.idx = partitionsCnt;
+                                        it->partition.lastDocID = DocIDsEND;
+                                        it->curDocument.id = DocIDsEND;
+                                        it->freq = 0;
+                                }
+
+                              public:
+                                void init(const term_index_ctx &tctx, Trinity::Codecs::AccessProxy *access) override final;
+
+                                Trinity::Codecs::PostingsListIterator *new_iterator() override final;
+                        };
+
+                        isrc_docid_t PostingsListIterator::next()
+                        {
+                                static_cast<Codecs::EliasFano::Decoder *>(dec)->next(this);
+                                return curDocument.id;
+                        }
+
+                        isrc_docid_t PostingsListIterator::advance(const isrc_docid_t target)
+                        {
+                                static_cast<Codecs::EliasFano::Decoder *>(dec)->advance(this, target);
+                                return curDocument.id;
+                        }
+
+                        void PostingsListIterator::materialize_hits(DocWordsSpace *dwspace, term_hit *out)
+                        {
+                                static_cast<Codecs::EliasFano::Decoder *>(dec)->materialize_hits(this, dwspace, out);
+                        }
+
+                        uint32_t PostingsListIterator::next_block(isrc_docid_t *const out, tokenpos_t *const freqs, const uint32_t max, const isrc_docid_t upto)
+                        {
+                                return static_cast<Codecs::EliasFano::Decoder *>(dec)->next_block(this, out, freqs, max, upto);
+                        }
+                }
+        }
+}
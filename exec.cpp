@@ -2,9 +2,12 @@
 #include "docset_spans.h"
 #include "docwordspace.h"
 #include "matches.h"
+#include "plans_cache.h"
 #include "queryexec_ctx.h"
 #include "similarity.h"
+#include <chrono>
 #include <prioqueue.h>
+#include <queue>
 
 using namespace Trinity;
 thread_local Trinity::queryexec_ctx *curRCTX;
@@ -595,6 +598,321 @@ static std::unique_ptr<DocsSetSpan> build_span(DocsSetIterators::Iterator *root,
         }
 }
 
+#pragma mark execution budget
+// Budgets are checked once for every window of that many documents
+// This is the same as DocsSetSpan::SIZE, so that we don't split the spans windows
+static constexpr isrc_docid_t BudgetWindow{8192};
+
+// Processes [min, max), one window at a time if there is a budget, or masked documents to skip
+// Throws aborted_search_exception if the budget is exhausted
+//
+// If masked is provided(only if documents IDs don't require translation), each window begins at the first unmasked document, so that
+// the iterators advance() past ranges of masked documents, instead of matching them only for the handler to reject them.
+// The handler is still expected to test() the documents it considers.
+static void process_span(DocsSetSpan *const span, MatchesProxy *const handler, isrc_docid_t min, const isrc_docid_t max, exec_budget *const budget, masked_documents_registry *const masked)
+{
+        if (!budget && !masked)
+        {
+                span->process(handler, min, max);
+                return;
+        }
+
+        while (min < max)
+        {
+                if (masked && (min = masked->next_unmasked(min)) >= max)
+                        break;
+
+                const isrc_docid_t windowEnd = max - min > BudgetWindow ? (min & ~(BudgetWindow - 1)) + BudgetWindow : max;
+                // process() returns the next document ID we need to consider, so we can skip ranges with no matches
+                const auto next = span->process(handler, min, windowEnd);
+
+                if (budget && !budget->charge(windowEnd - min))
+                        throw aborted_search_exception();
+
+                min = std::max(windowEnd, next);
+        }
+}
+
+#pragma mark top-k dynamic pruning
+// MaxScore(Turtle, Flood) over a disjunction of terms
+// Terms are sorted by their score upper bound(ascending); the longest prefix of terms whose upper bounds sum to at most
+// the current k-th best score(threshold) are `non-essential`: a document that matches none of the remaining, `essential` terms
+// cannot make it into the top-k, so we only iterate the essential terms, and only advance() the non-essential terms
+// to candidates produced by the essential terms, for as long as the candidate can still beat the threshold.
+//
+// accept(documentID, score) is expected to return false if the document was filtered/masked, so that it won't affect the threshold
+// Only documents in [minDocID, maxDocID) are considered
+template <typename L>
+static std::size_t exec_topk_maxscore(queryexec_ctx &rctx, Codecs::PostingsListIterator **const its, const uint16_t n, const uint32_t k, const isrc_docid_t minDocID, const isrc_docid_t maxDocID, exec_budget *const budget, L &&accept)
+{
+        static constexpr bool trace{false};
+        auto *const scorer = rctx.scorer;
+        std::vector<std::unique_ptr<Similarity::ScorerWeight>> weights(n);
+        float upperBounds[n], cum[n], blockCum[n];
+        uint16_t order[n];
+        std::priority_queue<float, std::vector<float>, std::greater<float>> topScores;
+        float threshold{0};
+        uint16_t firstEssential{0};
+        std::size_t matched{0};
+        isrc_docid_t sinceCharge{0};
+
+        for (uint16_t i{0}; i != n; ++i)
+        {
+                auto *const it = its[i];
+                const auto termID = it->decoder()->execCtxTermID;
+                const auto term = rctx.tctxMap[termID].second;
+
+                weights[i].reset(scorer->new_scorer_weight(&term, 1));
+                // term-level bound, tracked by the codec when the postings list was encoded
+                upperBounds[i] = scorer->max_score(it->decoder()->max_freq(), weights[i].get());
+                order[i] = i;
+                if (minDocID > 1)
+                        it->advance(minDocID);
+                else
+                        it->next();
+        }
+
+        std::sort(order, order + n, [&upperBounds](const auto a, const auto b) noexcept {
+                return upperBounds[a] < upperBounds[b];
+        });
+
+        for (uint16_t i{0}; i != n; ++i)
+                cum[i] = (i ? cum[i - 1] : 0) + upperBounds[order[i]];
+
+        if (trace)
+        {
+                for (uint16_t i{0}; i != n; ++i)
+                        SLog("Term ", rctx.tctxMap[its[order[i]]->decoder()->execCtxTermID].second, " upper bound ", upperBounds[order[i]], "\n");
+        }
+
+        for (;;)
+        {
+                isrc_docid_t candidate{DocIDsEND};
+                double score{0};
+
+                for (uint16_t i{firstEssential}; i != n; ++i)
+                        candidate = std::min(candidate, its[order[i]]->current());
+
+                if (candidate >= maxDocID)
+                        break;
+
+                if (budget && ++sinceCharge == BudgetWindow)
+                {
+                        if (!budget->charge(sinceCharge))
+                                throw aborted_search_exception();
+                        sinceCharge = 0;
+                }
+
+                for (uint16_t i{firstEssential}; i != n; ++i)
+                {
+                        auto *const it = its[order[i]];
+
+                        if (it->current() == candidate)
+                        {
+                                score += scorer->score(candidate, it->freq, weights[order[i]].get());
+                                it->next();
+                        }
+                }
+
+                if (topScores.size() == k)
+                {
+                        // tighten the non-essential terms bounds with the block-max bounds of the blocks that may contain the candidate
+                        for (uint16_t i{0}; i != firstEssential; ++i)
+                        {
+                                auto *const it = its[order[i]];
+                                auto ub = upperBounds[order[i]];
+
+                                if (it->advance_shallow(candidate) != DocIDsEND)
+                                        ub = std::min(ub, scorer->max_score(it->block_max_freq(), weights[order[i]].get()));
+
+                                blockCum[i] = (i ? blockCum[i - 1] : 0) + ub;
+                        }
+                }
+
+                // non-essential terms, highest upper bound first, so that we can give up on the candidate as soon as possible
+                for (int32_t i = int32_t(firstEssential) - 1; i >= 0; --i)
+                {
+                        if (topScores.size() == k && score + blockCum[i] <= threshold)
+                                break;
+
+                        auto *const it = its[order[i]];
+
+                        if (it->current() < candidate)
+                                it->advance(candidate);
+                        if (it->current() == candidate)
+                                score += scorer->score(candidate, it->freq, weights[order[i]].get());
+                }
+
+                if (topScores.size() == k && score <= threshold)
+                        continue;
+
+                if (!accept(candidate, score))
+                        continue;
+
+                ++matched;
+                if (topScores.size() == k)
+                        topScores.pop();
+                topScores.push(score);
+
+                if (topScores.size() == k)
+                {
+                        threshold = topScores.top();
+
+                        while (firstEssential != n && cum[firstEssential] <= threshold)
+                        {
+                                if (trace)
+                                        SLog("Term ", rctx.tctxMap[its[order[firstEssential]]->decoder()->execCtxTermID].second, " is no longer essential, threshold = ", threshold, "\n");
+
+                                ++firstEssential;
+                        }
+                }
+        }
+
+        return matched;
+}
+
+#pragma mark execution statistics
+namespace // static/local this module
+{
+        // Every matched document is provided to filter(), before it's provided to consider()
+        struct profiling_documents_filter final
+            : public IndexDocumentsFilter
+        {
+                IndexDocumentsFilter *const target;
+                masked_documents_registry *const maskedDocumentsRegistry;
+                exec_stats *const stats;
+
+                profiling_documents_filter(IndexDocumentsFilter *const t, masked_documents_registry *const r, exec_stats *const s)
+                    : target{t}, maskedDocumentsRegistry{r}, stats{s}
+                {
+                }
+
+                bool filter(const docid_t id) override final
+                {
+                        ++(stats->matched);
+
+                        if (target && target->filter(id))
+                        {
+                                ++(stats->rejected);
+                                return true;
+                        }
+                        else if (maskedDocumentsRegistry && maskedDocumentsRegistry->test(id))
+                        {
+                                ++(stats->masked);
+                                return true;
+                        }
+                        else
+                                return false;
+                }
+        };
+
+        struct profiling_matches_filter final
+            : public MatchedIndexDocumentsFilter
+        {
+                MatchedIndexDocumentsFilter *const target;
+                exec_stats *const stats;
+
+                profiling_matches_filter(MatchedIndexDocumentsFilter *const t, exec_stats *const s)
+                    : target{t}, stats{s}
+                {
+                }
+
+                template <typename L>
+                inline void timed(L &&l)
+                {
+                        const auto before = std::chrono::steady_clock::now();
+
+                        l();
+                        stats->considerTime += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - before).count();
+                        ++(stats->considered);
+                }
+
+                void consider(const matched_document &match) override final
+                {
+                        timed([&]() { target->consider(match); });
+                }
+
+                void consider(const docid_t id) override final
+                {
+                        timed([&]() { target->consider(id); });
+                }
+
+                void consider(const docid_t id, const double score) override final
+                {
+                        timed([&]() { target->consider(id, score); });
+                }
+
+                void prepare(const query_index_terms **queryIndicesTerms_) override final
+                {
+                        MatchedIndexDocumentsFilter::prepare(queryIndicesTerms_);
+                        target->prepare(queryIndicesTerms_);
+                }
+        };
+}
+
+// Iterators built, and the postings decoding statistics of the terms iterators
+static void collect_stats(queryexec_ctx &rctx, exec_stats *const stats)
+{
+        ska::flat_hash_map<const Codecs::Decoder *, str8_t> decoders;
+
+        for (const auto &it : rctx.tctxMap)
+        {
+                if (const auto termID = it.first; termID < rctx.decode_ctx.capacity)
+                {
+                        if (const auto dec = rctx.decode_ctx.decoders[termID])
+                                decoders.insert({dec, it.second.second});
+                }
+        }
+
+        for (const auto it : rctx.allIterators)
+        {
+                ++(stats->iterators[size_t(DocsSetIterators::Type::PostingsListIterator)]);
+
+                if (const auto res = decoders.find(it->dec); res != decoders.end())
+                {
+                        auto t = stats->term(res->second);
+
+                        t->postingsDecoded += it->decodedDocs;
+                        t->blocksSkipped += it->skippedBlocks;
+                }
+        }
+
+        for (const auto it : rctx.docsetsIterators)
+                ++(stats->iterators[size_t(it->type)]);
+}
+
+exec_stats::term_stats *exec_stats::term(const str8_t token)
+{
+        for (auto &it : terms)
+        {
+                if (it.token.size() == token.size() && !memcmp(it.token.data(), token.data(), token.size()))
+                        return &it;
+        }
+
+        terms.push_back({std::string(token.data(), token.size())});
+        return &terms.back();
+}
+
+void exec_stats::merge(const exec_stats &o)
+{
+        compileTime += o.compileTime;
+        prepareTime += o.prepareTime;
+        for (size_t i{0}; i != sizeof_array(iterators); ++i)
+                iterators[i] += o.iterators[i];
+        for (const auto &it : o.terms)
+        {
+                auto t = term({it.token.data(), uint8_t(it.token.size())});
+
+                t->postingsDecoded += it.postingsDecoded;
+                t->blocksSkipped += it.blocksSkipped;
+        }
+        matched += o.matched;
+        masked += o.masked;
+        rejected += o.rejected;
+        considered += o.considered;
+        considerTime += o.considerTime;
+}
+
 #pragma mark Trinity Queries Execution Engine
 
 void Trinity::exec_query(const query &in,
@@ -603,14 +921,27 @@ void Trinity::exec_query(const query &in,
                          MatchedIndexDocumentsFilter *__restrict__ const matchesFilter,
                          IndexDocumentsFilter *__restrict__ const documentsFilter,
                          const uint32_t execFlags,
-                         Similarity::IndexSourceTermsScorer *scorer)
+                         Similarity::IndexSourceTermsScorer *scorer,
+                         const uint32_t topK,
+                         exec_budget *const budget,
+                         exec_stats *const stats)
 {
-        struct query_term_instance final
-            : public query_term_ctx::instance_struct
-        {
-                str8_t token;
-        };
+        exec_query_range(in, idxsrc, maskedDocumentsRegistry, matchesFilter, documentsFilter, execFlags, scorer, topK, 1, DocIDsEND, budget, stats);
+}
 
+static void exec_query_impl(const query &in,
+                            IndexSource *const __restrict__ idxsrc,
+                            masked_documents_registry *const __restrict__ maskedDocumentsRegistry,
+                            MatchedIndexDocumentsFilter *__restrict__ const matchesFilter,
+                            IndexDocumentsFilter *__restrict__ const documentsFilter,
+                            const uint32_t execFlags,
+                            Similarity::IndexSourceTermsScorer *scorer,
+                            const uint32_t topK,
+                            isrc_docid_t minDocID,
+                            const isrc_docid_t maxDocID,
+                            exec_budget *const budget,
+                            exec_stats *const stats)
+{
         if (!in)
         {
                 if (traceCompile)
@@ -619,33 +950,21 @@ void Trinity::exec_query(const query &in,
                 return;
         }
 
-        // We need a copy of that query here
-        // for we we will need to modify it
-        const auto _start = Timings::Microseconds::Tick();
-        query q(in, true); // shallow copy, no need for a deep copy here
-
-        // Normalize just in case
-        if (!q.normalize())
-        {
-                if (traceCompile)
-                        SLog("No root node after normalization\n");
-
-                return;
-        }
-
         const bool documentsOnly = execFlags & uint32_t(ExecFlags::DocumentsOnly);
         const bool accumScoreMode = execFlags & uint32_t(ExecFlags::AccumulatedScoreScheme);
         const bool defaultMode = !documentsOnly && !accumScoreMode;
 
-        // We need to collect all term instances in the query
-        // so that we the score function will be able to take that into account (See matched_document::queryTermInstances)
-        // We only need to do this for specific AST branches and node types(i.e we ignore all RHS expressions of logical NOT nodes)
-        //
-        // This must be performed before any query optimizations, for otherwise because the optimiser will most definitely rearrange the query, doing it after
-        // the optimization passes will not capture the original, input query tokens instances information.
-        //
-        // This is required if the default execution mode is selected
-        std::vector<query_term_instance> originalQueryTokenInstances;
+        // document IDs begin from 1
+        minDocID = std::max<isrc_docid_t>(minDocID, 1);
+        if (minDocID >= maxDocID)
+                return;
+
+        // e.g exhausted by another execution sharing the budget
+        if (budget && budget->exhausted())
+                return;
+
+        // the single term specializations scan the whole postings list, and don't check the budget
+        const bool allDocuments = minDocID == 1 && maxDocID == DocIDsEND && !budget;
 
         if (accumScoreMode)
         {
@@ -653,74 +972,30 @@ void Trinity::exec_query(const query &in,
                 expect(scorer);
         }
 
-        if (defaultMode)
-        {
-                std::vector<ast_node *> stack{q.root}; // use a stack because we don't care about the evaluation order
-                std::vector<phrase *> collected;
-
-                // collect phrases from the AST
-                do
-                {
-                        auto n = stack.back();
-
-                        stack.pop_back();
-                        switch (n->type)
-                        {
-                                case ast_node::Type::Token:
-                                case ast_node::Type::Phrase:
-                                        collected.push_back(n->p);
-                                        break;
-
-                                case ast_node::Type::MatchSome:
-                                        stack.insert(stack.end(), n->match_some.nodes, n->match_some.nodes + n->match_some.size);
-                                        break;
-
-                                case ast_node::Type::UnaryOp:
-                                        if (n->unaryop.op != Operator::NOT)
-                                                stack.push_back(n->unaryop.expr);
-                                        break;
-
-                                case ast_node::Type::ConstTrueExpr:
-                                        stack.push_back(n->expr);
-                                        break;
-
-                                case ast_node::Type::BinOp:
-                                        if (n->binop.op == Operator::AND || n->binop.op == Operator::STRICT_AND || n->binop.op == Operator::OR)
-                                        {
-                                                stack.push_back(n->binop.lhs);
-                                                stack.push_back(n->binop.rhs);
-                                        }
-                                        else if (n->binop.op == Operator::NOT)
-                                                stack.push_back(n->binop.lhs);
-                                        break;
+        // We need a normalized copy of that query here, for we will need to modify it, and
+        // the query term instances (see query_plan::make()), which are required if the default execution mode is selected.
+        // If there is a plans cache, that's all done once for each distinct query; see plans_cache.h
+        const auto _start = Timings::Microseconds::Tick();
+        std::shared_ptr<query_plan> plan;
+        auto plansCache = QueryPlansCache::default_cache();
 
-                                default:
-                                        break;
-                        }
-                } while (stack.size());
+        if (plansCache)
+                plan = plansCache->plan_for(in);
+        else
+                plan = query_plan::make(in, 0, false, defaultMode); // shallow copy, no need for a deep copy here
 
-                for (const auto it : collected) // collected phrases
-                {
-                        const uint8_t rep = it->size == 1 ? it->rep : 1;
-                        const auto toNextSpan{it->toNextSpan};
-                        const auto flags{it->flags};
-                        const auto rewriteRange{it->rewrite_ctx.range};
-                        const auto translationCoefficient{it->rewrite_ctx.translationCoefficient};
-                        const auto srcSeqSize{it->rewrite_ctx.srcSeqSize};
-
-                        // for each phrase token
-                        for (uint16_t pos{it->index}, i{0}; i != it->size; ++i, ++pos)
-                        {
-                                if (traceCompile)
-                                        SLog("Collected instance: [", it->terms[i].token, "] index:", pos, " rep:", rep, " toNextSpan:", i == (it->size - 1) ? toNextSpan : 1, "\n");
+        if (!plan->normalized)
+        {
+                if (traceCompile)
+                        SLog("No root node after normalization\n");
 
-                                originalQueryTokenInstances.push_back({{pos, flags, rep, uint8_t(i == (it->size - 1) ? toNextSpan : 1), {rewriteRange, translationCoefficient, srcSeqSize}}, it->terms[i].token}); // need to be careful to get this right for phrases
-                        }
-                }
+                return;
         }
 
+        const auto &originalQueryTokenInstances = plan->instances;
+
         if (traceCompile)
-                SLog("Compiling:", q, "\n");
+                SLog("Compiling:", plan->normalized, "\n");
 
         queryexec_ctx rctx(idxsrc, documentsOnly, accumScoreMode);
 
@@ -742,7 +1017,38 @@ void Trinity::exec_query(const query &in,
         } compilationCtx(&rctx);
 
         const auto before = Timings::Microseconds::Tick();
-        auto rootExecNode = compile_query(q.root, compilationCtx);
+        exec_node rootExecNode;
+
+        if (plansCache && plan->can_compile())
+        {
+                // Reconstruct the terms dictionary and term contexts compile_query() would have built, and
+                // copy the compiled tree, for prepare_tree() will modify it
+                std::vector<term_index_ctx> tctxs;
+                const auto compiled = plan->compiled_for(idxsrc, &tctxs);
+
+                for (const auto &it : compiled->terms)
+                {
+                        const auto token = plan->tokens[it.first];
+
+                        rctx.termsDict.insert({token, it.second});
+                        if (it.second)
+                                rctx.tctxMap.insert({it.second, {tctxs[it.first], token}});
+                }
+
+                rootExecNode = copy_execnodes(compiled->root, rctx.allocator);
+        }
+        else if (plansCache)
+        {
+                // compile_query() modifies the AST
+                query q(plan->normalized, true);
+
+                rootExecNode = compile_query(q.root, compilationCtx);
+        }
+        else
+                rootExecNode = compile_query(plan->normalized.root, compilationCtx);
+
+        if (stats)
+                stats->compileTime += Timings::Microseconds::Since(before);
 
         if (traceCompile)
                 SLog(duration_repr(Timings::Microseconds::Since(before)), " to compile, ", duration_repr(Timings::Microseconds::Since(_start)), " since start\n");
@@ -756,7 +1062,15 @@ void Trinity::exec_query(const query &in,
         }
 
         // Prepare and further optimize tree for execution
-        rootExecNode = prepare_tree(rootExecNode, rctx);
+        if (stats)
+        {
+                const auto before = Timings::Microseconds::Tick();
+
+                rootExecNode = prepare_tree(rootExecNode, rctx);
+                stats->prepareTime += Timings::Microseconds::Since(before);
+        }
+        else
+                rootExecNode = prepare_tree(rootExecNode, rctx);
 
         // Now that we have compiled the AST into an execution nodes tree, we could
         // group nodes into matchallnodes and matchanynodes groups.
@@ -776,7 +1090,7 @@ void Trinity::exec_query(const query &in,
 
         if (defaultMode)
         {
-                std::vector<const query_term_instance *> collected;
+                std::vector<const query_plan::term_instance *> collected;
                 std::vector<std::pair<uint16_t, query_index_term>> originalQueryTokensTracker; // query index => (termID, toNextSpan)
                 std::vector<query_index_term> list;
                 uint16_t maxIndex{0};
@@ -789,8 +1103,6 @@ void Trinity::exec_query(const query &in,
                 rctx.originalQueryTermCtx = (query_term_ctx **)rctx.allocator.Alloc(sizeof(query_term_ctx *) * maxQueryTermIDPlus1);
 
                 memset(rctx.originalQueryTermCtx, 0, sizeof(query_term_ctx *) * maxQueryTermIDPlus1);
-                std::sort(originalQueryTokenInstances.begin(), originalQueryTokenInstances.end(), [](const auto &a, const auto &b) { return terms_cmp(a.token.data(), a.token.size(), b.token.data(), b.token.size()) < 0; });
-
                 for (const auto *p = originalQueryTokenInstances.data(), *const e = p + originalQueryTokenInstances.size(); p != e;)
                 {
                         const auto token = p->token;
@@ -957,6 +1269,8 @@ void Trinity::exec_query(const query &in,
         isrc_docid_t matchedDocuments{0}; // isrc_docid_t so that we can support whatever number of distinct documents are allowed by sizeof(isrc_docid_t)
         [[maybe_unused]] const auto start = Timings::Microseconds::Tick();
         const auto requireDocIDTranslation = idxsrc->require_docid_translation();
+        // We can only skip ranges of masked documents if they are in the same order as the index source documents
+        auto *const skipMasked = !requireDocIDTranslation && maskedDocumentsRegistry && !maskedDocumentsRegistry->empty() ? maskedDocumentsRegistry : nullptr;
 
         if (defaultMode)
         {
@@ -970,7 +1284,7 @@ void Trinity::exec_query(const query &in,
 #pragma mark Execution
         try
         {
-                if (rootExecNode.fp == ENT::matchterm && !accumScoreMode)
+                if (rootExecNode.fp == ENT::matchterm && !accumScoreMode && allDocuments)
                 {
                         isrc_docid_t docID;
 
@@ -994,7 +1308,7 @@ void Trinity::exec_query(const query &in,
                                         {
                                                 const auto globalDocID = requireDocIDTranslation ? idxsrc->translate_docid(docID) : docID;
 
-                                                if (!documentsFilter->filter(globalDocID) && !maskedDocumentsRegistry->test(globalDocID))
+                                                if (!documentsFilter->filter(globalDocID) && (!maskedDocumentsRegistry || !maskedDocumentsRegistry->test(globalDocID)))
                                                         matchesFilter->consider(globalDocID);
                                         }
                                 }
@@ -1003,6 +1317,19 @@ void Trinity::exec_query(const query &in,
                                         while (likely((docID = it->next()) != DocIDsEND))
                                                 matchesFilter->consider(requireDocIDTranslation ? idxsrc->translate_docid(docID) : docID);
                                 }
+                                else if (skipMasked)
+                                {
+                                        for (docID = it->next(); likely(docID != DocIDsEND);)
+                                        {
+                                                if (const auto next = skipMasked->next_unmasked(docID); next != docID)
+                                                        docID = it->advance(next);
+                                                else
+                                                {
+                                                        matchesFilter->consider(docID);
+                                                        docID = it->next();
+                                                }
+                                        }
+                                }
                                 else
                                 {
                                         while (likely((docID = it->next()) != DocIDsEND))
@@ -1073,6 +1400,24 @@ void Trinity::exec_query(const query &in,
                                                 }
                                         }
                                 }
+                                else if (skipMasked)
+                                {
+                                        if (traceExec)
+                                                SLog("maskedDocumentsRegistry, skipping masked documents\n");
+
+                                        for (docID = it->next(); likely(docID != DocIDsEND);)
+                                        {
+                                                if (const auto next = skipMasked->next_unmasked(docID); next != docID)
+                                                        docID = it->advance(next);
+                                                else
+                                                {
+                                                        it->materialize_hits(dws, th->all);
+                                                        matchedDocument.id = docID;
+                                                        matchesFilter->consider(matchedDocument);
+                                                        docID = it->next();
+                                                }
+                                        }
+                                }
                                 else if (maskedDocumentsRegistry && false == maskedDocumentsRegistry->empty())
                                 {
                                         if (traceExec)
@@ -1106,6 +1451,50 @@ void Trinity::exec_query(const query &in,
                                 }
                         }
                 }
+                else if (accumScoreMode && topK && (rootExecNode.fp == ENT::matchterm || rootExecNode.fp == ENT::matchanyterms) && scorer->provides_max_score())
+                {
+                        // SPECIALIZATION: top-k, disjunction of terms
+                        // We don't need the iterators wrappers(see reg_pli()); exec_topk_maxscore() scores the postings lists directly
+                        const exec_term_id_t singleTermID = rootExecNode.u16;
+                        const exec_term_id_t *terms;
+                        uint16_t termsCnt;
+
+                        if (rootExecNode.fp == ENT::matchterm)
+                        {
+                                terms = &singleTermID;
+                                termsCnt = 1;
+                        }
+                        else
+                        {
+                                const auto run = static_cast<const compilation_ctx::termsrun *>(rootExecNode.ptr);
+
+                                terms = run->terms;
+                                termsCnt = run->size;
+                        }
+
+                        Codecs::PostingsListIterator *its[termsCnt];
+
+                        if (traceCompile)
+                                SLog("SPECIALIZATION: top-", topK, " MaxScore over ", termsCnt, " terms\n");
+
+                        for (uint16_t i{0}; i != termsCnt; ++i)
+                        {
+                                its[i] = rctx.decode_ctx.decoders[terms[i]]->new_iterator();
+                                rctx.allIterators.push_back(its[i]);
+                        }
+
+                        matchedDocuments = exec_topk_maxscore(rctx, its, termsCnt, topK, minDocID, maxDocID, budget, [&](const isrc_docid_t id, const double score) {
+                                const auto globalDocID = requireDocIDTranslation ? idxsrc->translate_docid(id) : id;
+
+                                if (documentsFilter && documentsFilter->filter(globalDocID))
+                                        return false;
+                                if (maskedDocumentsRegistry && maskedDocumentsRegistry->test(globalDocID))
+                                        return false;
+
+                                matchesFilter->consider(globalDocID, score);
+                                return true;
+                        });
+                }
                 else
                 {
                         auto *const sit = rctx.build_iterator(rootExecNode, execFlags);
@@ -1156,7 +1545,7 @@ void Trinity::exec_query(const query &in,
 
                                                 } handler(&rctx, idxsrc, matchesFilter, maskedDocumentsRegistry, documentsFilter);
 
-                                                span->process(&handler, 1, DocIDsEND);
+                                                process_span(span, &handler, minDocID, maxDocID, budget, skipMasked);
                                                 matchedDocuments = handler.n;
                                         }
                                         else
@@ -1190,7 +1579,7 @@ void Trinity::exec_query(const query &in,
 
                                                 } handler(&rctx, idxsrc, matchesFilter, documentsFilter);
 
-                                                span->process(&handler, 1, DocIDsEND);
+                                                process_span(span, &handler, minDocID, maxDocID, budget, skipMasked);
                                                 matchedDocuments = handler.n;
                                         }
                                 }
@@ -1225,7 +1614,7 @@ void Trinity::exec_query(const query &in,
 
                                         } handler(&rctx, idxsrc, matchesFilter, maskedDocumentsRegistry);
 
-                                        span->process(&handler, 1, DocIDsEND);
+                                        process_span(span, &handler, minDocID, maxDocID, budget, skipMasked);
                                         matchedDocuments = handler.n;
                                 }
                                 else
@@ -1255,7 +1644,7 @@ void Trinity::exec_query(const query &in,
 
                                                 } handler(&rctx, idxsrc, matchesFilter);
 
-                                                span->process(&handler, 1, DocIDsEND);
+                                                process_span(span, &handler, minDocID, maxDocID, budget, skipMasked);
                                                 matchedDocuments = handler.n;
                                         }
                                         else
@@ -1283,7 +1672,7 @@ void Trinity::exec_query(const query &in,
 
                                                 } handler(&rctx, idxsrc, matchesFilter);
 
-                                                span->process(&handler, 1, DocIDsEND);
+                                                process_span(span, &handler, minDocID, maxDocID, budget, skipMasked);
                                                 matchedDocuments = handler.n;
                                         }
                                 }
@@ -1324,7 +1713,7 @@ void Trinity::exec_query(const query &in,
 
                                                 } handler(&rctx, idxsrc, matchesFilter, maskedDocumentsRegistry, documentsFilter);
 
-                                                span->process(&handler, 1, DocIDsEND);
+                                                process_span(span, &handler, minDocID, maxDocID, budget, skipMasked);
                                                 matchedDocuments = handler.n;
                                         }
                                         else
@@ -1358,7 +1747,7 @@ void Trinity::exec_query(const query &in,
 
                                                 } handler(&rctx, idxsrc, matchesFilter, documentsFilter);
 
-                                                span->process(&handler, 1, DocIDsEND);
+                                                process_span(span, &handler, minDocID, maxDocID, budget, skipMasked);
                                                 matchedDocuments = handler.n;
                                         }
                                 }
@@ -1393,7 +1782,7 @@ void Trinity::exec_query(const query &in,
 
                                         } handler(&rctx, idxsrc, matchesFilter, maskedDocumentsRegistry);
 
-                                        span->process(&handler, 1, DocIDsEND);
+                                        process_span(span, &handler, minDocID, maxDocID, budget, skipMasked);
                                         matchedDocuments = handler.n;
                                 }
                                 else
@@ -1423,7 +1812,7 @@ void Trinity::exec_query(const query &in,
 
                                         } handler(&rctx, idxsrc, matchesFilter);
 
-                                        span->process(&handler, 1, DocIDsEND);
+                                        process_span(span, &handler, minDocID, maxDocID, budget, skipMasked);
                                         matchedDocuments = handler.n;
                                 }
                         }
@@ -1473,7 +1862,7 @@ void Trinity::exec_query(const query &in,
 
                                                 } handler(&rctx, idxsrc, matchesFilter, maskedDocumentsRegistry, documentsFilter);
 
-                                                span->process(&handler, 1, DocIDsEND);
+                                                process_span(span, &handler, minDocID, maxDocID, budget, skipMasked);
                                                 matchedDocuments = handler.n;
                                         }
                                         else
@@ -1517,7 +1906,7 @@ void Trinity::exec_query(const query &in,
 
                                                 } handler(&rctx, idxsrc, matchesFilter, documentsFilter);
 
-                                                span->process(&handler, 1, DocIDsEND);
+                                                process_span(span, &handler, minDocID, maxDocID, budget, skipMasked);
                                                 matchedDocuments = handler.n;
                                         }
                                 }
@@ -1562,7 +1951,7 @@ void Trinity::exec_query(const query &in,
 
                                         } handler(&rctx, idxsrc, matchesFilter, maskedDocumentsRegistry);
 
-                                        span->process(&handler, 1, DocIDsEND);
+                                        process_span(span, &handler, minDocID, maxDocID, budget, skipMasked);
                                         matchedDocuments = handler.n;
                                 }
                                 else
@@ -1601,7 +1990,7 @@ void Trinity::exec_query(const query &in,
 
                                         } handler(&rctx, idxsrc, matchesFilter);
 
-                                        span->process(&handler, 1, DocIDsEND);
+                                        process_span(span, &handler, minDocID, maxDocID, budget, skipMasked);
                                         matchedDocuments = handler.n;
                                 }
                         }
@@ -1617,9 +2006,38 @@ void Trinity::exec_query(const query &in,
                 throw;
         }
 
+        if (stats)
+                collect_stats(rctx, stats);
+
         const auto duration = Timings::Microseconds::Since(start);
         const auto durationAll = Timings::Microseconds::Since(_start);
 
         if (traceCompile || traceExec)
                 SLog(ansifmt::bold, ansifmt::color_red, dotnotation_repr(matchedDocuments), " matched in ", duration_repr(duration), ansifmt::reset, " (", Timings::Microseconds::ToMillis(duration), " ms) ", duration_repr(durationAll), " all\n");
 }
+
+void Trinity::exec_query_range(const query &in,
+                               IndexSource *const __restrict__ idxsrc,
+                               masked_documents_registry *const __restrict__ maskedDocumentsRegistry,
+                               MatchedIndexDocumentsFilter *__restrict__ const matchesFilter,
+                               IndexDocumentsFilter *__restrict__ const documentsFilter,
+                               const uint32_t execFlags,
+                               Similarity::IndexSourceTermsScorer *scorer,
+                               const uint32_t topK,
+                               isrc_docid_t minDocID,
+                               const isrc_docid_t maxDocID,
+                               exec_budget *const budget,
+                               exec_stats *const stats)
+{
+        if (!stats)
+        {
+                exec_query_impl(in, idxsrc, maskedDocumentsRegistry, matchesFilter, documentsFilter, execFlags, scorer, topK, minDocID, maxDocID, budget, nullptr);
+                return;
+        }
+
+        // masked documents are accounted for by the documents filter; see exec_stats
+        profiling_documents_filter df(documentsFilter, maskedDocumentsRegistry, stats);
+        profiling_matches_filter mf(matchesFilter, stats);
+
+        exec_query_impl(in, idxsrc, nullptr, &mf, &df, execFlags, scorer, topK, minDocID, maxDocID, budget, stats);
+}
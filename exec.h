@@ -1,11 +1,15 @@
 // Please refer to https://github.com/phaistos-networks/Trinity/wiki/Query-Execution-Engine-Internals
 #pragma once
 #include "docidupdates.h"
+#include "executor.h"
 #include "index_source.h"
 #include "matches.h"
 #include "queries.h"
+#include "results_cache.h"
 #include "similarity.h"
 #include <future>
+#include <thread>
+#include <typeinfo>
 
 namespace Trinity
 {
@@ -44,15 +48,212 @@ namespace Trinity
                 DisregardTokenFlagsForQueryIndicesTerms = 4
         };
 
+        // Bounds the work of a query execution: a deadline, and/or (approximately) how many documents may be evaluated
+        // The same budget can be shared by all executions of a query(e.g exec_query_par()). It is checked once for every window of 8192 documents
+        // a DocsSetSpan processes, so it's cheap, but not precise.
+        // Once exhausted, execution stops cleanly; the documents matched so far have been provided to MatchedIndexDocumentsFilter::consider(), and exhausted() is set.
+        struct exec_budget final
+        {
+                // Timings::Microseconds::Tick() based; 0 for no deadline
+                uint64_t deadline{0};
+                // 0 for no limit
+                uint64_t maxDocuments{0};
+                std::atomic<uint64_t> evaluated{0};
+                std::atomic<bool> expired{false};
+
+                exec_budget(const uint64_t d = 0, const uint64_t m = 0)
+                    : deadline{d}, maxDocuments{m}
+                {
+                }
+
+                // Accounts for n more evaluated documents; returns false if the budget is exhausted
+                bool charge(const uint64_t n) noexcept
+                {
+                        if (expired.load(std::memory_order_relaxed))
+                                return false;
+
+                        if ((maxDocuments && evaluated.fetch_add(n, std::memory_order_relaxed) + n > maxDocuments) || (deadline && Timings::Microseconds::Tick() >= deadline))
+                        {
+                                expired.store(true, std::memory_order_relaxed);
+                                return false;
+                        }
+
+                        return true;
+                }
+
+                inline bool exhausted() const noexcept
+                {
+                        return expired.load(std::memory_order_relaxed);
+                }
+        };
+
+        // Execution statistics, filled in by exec_query() if provided; for profiling queries
+        // Collecting them is not free(e.g consider() invocations are timed), but nothing is collected unless requested. Counters are accumulated
+        // into, so that the same exec_stats can be used for multiple executions of a query, though not concurrently(see merge()).
+        //
+        // If requested, maskedDocumentsRegistry tests are performed after the IndexDocumentsFilter, on every matched document, which may result
+        // in a different(but equivalent) execution path.
+        struct exec_stats final
+        {
+                struct term_stats final
+                {
+                        std::string token;
+                        // Reported by the codecs; see Codecs::PostingsListIterator::decodedDocs
+                        uint64_t postingsDecoded{0};
+                        uint64_t blocksSkipped{0};
+                };
+
+                // microseconds; compile_query() (or copying a cached plan), and prepare_tree() respectively
+                uint64_t compileTime{0};
+                uint64_t prepareTime{0};
+                // indexed by DocsSetIterators::Type
+                uint64_t iterators[size_t(DocsSetIterators::Type::Dummy) + 1]{0};
+                std::vector<term_stats> terms;
+                // documents matched by the query, and of those, how many were masked by the masked_documents_registry, rejected by
+                // the IndexDocumentsFilter, and provided to MatchedIndexDocumentsFilter::consider()
+                uint64_t matched{0};
+                uint64_t masked{0};
+                uint64_t rejected{0};
+                uint64_t considered{0};
+                // nanoseconds spent in MatchedIndexDocumentsFilter::consider()
+                uint64_t considerTime{0};
+
+                term_stats *term(const str8_t token);
+
+                // Accumulates o into this, e.g the stats of another partition or index source of the same query
+                void merge(const exec_stats &o);
+        };
+
         static inline void validate_flags(const uint32_t f)
         {
                 if (const auto mask = f & (unsigned(ExecFlags::DocumentsOnly) | unsigned(ExecFlags::AccumulatedScoreScheme)); mask && (mask & (mask - 1)))
                         throw Switch::invalid_argument("DocumentsOnly and AccumulatedScoreScheme are mutually exclusive modes");
         }
 
+        // If topK is set and ExecFlags::AccumulatedScoreScheme is selected, you are only interested in the topK highest scored documents.
+        // For queries that are a disjunction of terms(e.g [apple OR iphone OR ipad], or a single term), if the scorer provides_max_score(), documents that
+        // can't possibly make it into the top-k are skipped(MaxScore dynamic pruning), so MatchedIndexDocumentsFilter::consider() will be invoked
+        // for a superset of the top-k documents, not for all matching documents. Other queries are executed as if topK was not set.
+        //
+        // If budget is set, execution stops once it's exhausted; see exec_budget
+        // If stats is set, execution statistics are accumulated into it; see exec_stats
         void exec_query(const query &in, IndexSource *, masked_documents_registry *const maskedDocumentsRegistry, MatchedIndexDocumentsFilter *, IndexDocumentsFilter *const f = nullptr,
                         const uint32_t flags = 0,
-                        Similarity::IndexSourceTermsScorer *scorer = nullptr);
+                        Similarity::IndexSourceTermsScorer *scorer = nullptr,
+                        const uint32_t topK = 0,
+                        exec_budget *budget = nullptr,
+                        exec_stats *stats = nullptr);
+
+        // Like exec_query(), except that only documents in [minDocID, maxDocID) are considered
+        // Iterators are advance()d to minDocID and execution stops at maxDocID, so executing a query for disjoint ranges of the same index source
+        // in parallel is cheap(see exec_query_partitioned()). maskedDocumentsRegistry must not be shared among concurrent executions.
+        void exec_query_range(const query &in, IndexSource *, masked_documents_registry *const maskedDocumentsRegistry, MatchedIndexDocumentsFilter *, IndexDocumentsFilter *const f,
+                              const uint32_t flags,
+                              Similarity::IndexSourceTermsScorer *scorer,
+                              const uint32_t topK,
+                              isrc_docid_t minDocID,
+                              const isrc_docid_t maxDocID,
+                              exec_budget *budget = nullptr,
+                              exec_stats *stats = nullptr);
+
+        // Smallest documents range exec_query_partitioned() will bother executing in parallel, by default
+        static constexpr isrc_docid_t PartitionMinDocuments{256 * 1024};
+
+        // Executes the query on collection->sources[idx], split into up to `partitions` document ID ranges, each executed in parallel, on
+        // its own execution context, with its own T filter, and returns them all; you are expected to merge them, same as with exec_query_par().
+        //
+        // If partitions is 0, it will use up to std::thread::hardware_concurrency() ranges, but no range will be smaller than PartitionMinDocuments.
+        // A single range is used if IndexSource::docids_bounds() are unknown.
+        // If ExecFlags::AccumulatedScoreScheme is set, cs must be set, and you are expected to have cs->reset() for the collection.
+        // budget(optional) is shared by all ranges.
+        //
+        // If there is a default QueryResultsCache, and the results of the source for that query are cached, they are replayed into a single T
+        // instead, and otherwise they are recorded and cached; see results_cache.h
+        // For ExecFlags::AccumulatedScoreScheme, that's only if cs provides a fingerprint(); see IndexSourcesCollectionTermsScorer::fingerprint()
+        template <typename T, typename... Arg>
+        std::vector<std::unique_ptr<T>> exec_query_partitioned(const query &in, IndexSourcesCollection *collection, const uint16_t idx, IndexDocumentsFilter *f, const uint32_t flags, Trinity::Similarity::IndexSourcesCollectionTermsScorer *cs, const uint32_t topK, exec_budget *budget, uint32_t partitions, Arg &&... args)
+        {
+                static_assert(std::is_base_of<MatchedIndexDocumentsFilter, T>::value, "Expected a MatchedIndexDocumentsFilter subclass");
+                auto source = collection->sources[idx];
+                const auto bounds = source->docids_bounds();
+                const bool accumScoreScheme = flags & unsigned(ExecFlags::AccumulatedScoreScheme);
+                const uint64_t span = bounds.second ? uint64_t(bounds.second - bounds.first) + 1 : 0;
+                std::vector<std::unique_ptr<T>> out;
+
+                validate_flags(flags);
+
+                if (accumScoreScheme && !cs)
+                        throw Switch::invalid_argument("IndexSourcesCollectionTermsScorer not set");
+
+                auto resultsCache = QueryResultsCache::default_cache();
+                // scores are only cached if they can be told apart from scores of other scorers, or of the same scorer for other collection statistics
+                const uint64_t scorerFingerprint = accumScoreScheme && !(flags & unsigned(ExecFlags::DocumentsOnly)) && cs->fingerprint()
+                                                       ? cs->fingerprint() ^ (typeid(*cs).hash_code() * 0x9e3779b97f4a7c15ull)
+                                                       : 0;
+                const bool cacheable = resultsCache && !f && ((flags & unsigned(ExecFlags::DocumentsOnly)) || scorerFingerprint);
+                const uint64_t cacheKey = cacheable ? QueryResultsCache::key(in, flags, topK) : 0;
+                const uint64_t maskingState = cacheable ? collection->masking_state_for(idx) : 0;
+
+                if (cacheable)
+                {
+                        if (const auto res = resultsCache->lookup(in, cacheKey, flags, topK, source->generation(), source->instance_id(), maskingState, scorerFingerprint))
+                        {
+                                auto filter = std::make_unique<T>(std::forward<Arg>(args)...);
+
+                                res->replay(filter.get());
+                                out.push_back(std::move(filter));
+                                return out;
+                        }
+                }
+
+                if (!partitions)
+                        partitions = std::max<uint64_t>(1, std::min<uint64_t>(std::thread::hardware_concurrency(), span / PartitionMinDocuments));
+                if (!span)
+                        partitions = 1;
+                else
+                        partitions = std::min<uint64_t>(partitions, span);
+
+                std::unique_ptr<cached_results[]> recorded(cacheable ? new cached_results[partitions] : nullptr);
+                const auto exec = [&](const uint32_t i) {
+                        // the last range extends to DocIDsEND, and the first one to 1, in case the bounds are not precise
+                        const isrc_docid_t min = i ? bounds.first + span * i / partitions : 1;
+                        const isrc_docid_t max = i + 1 == partitions ? DocIDsEND : bounds.first + span * (i + 1) / partitions;
+                        auto scanner = collection->scanner_registry_for(idx);
+                        auto filter = std::make_unique<T>(std::forward<Arg>(args)...);
+                        std::unique_ptr<Similarity::IndexSourceTermsScorer> scorer;
+
+                        if (accumScoreScheme)
+                                scorer.reset(cs->new_source_scorer(source));
+
+                        if (recorded)
+                        {
+                                recording_documents_filter recorder(filter.get(), recorded.get() + i, QueryResultsCache::MaxCachedMatches);
+
+                                exec_query_range(in, source, scanner.get(), &recorder, f, flags, scorer.get(), topK, min, max, budget);
+                        }
+                        else
+                                exec_query_range(in, source, scanner.get(), filter.get(), f, flags, scorer.get(), topK, min, max, budget);
+
+                        return filter;
+                };
+
+                std::vector<std::future<std::unique_ptr<T>>> futures;
+                task_group group;
+
+                for (uint32_t i{1}; i < partitions; ++i)
+                        futures.push_back(group.submit([&exec, i]() { return exec(i); }));
+
+                out.push_back(exec(0));
+
+                for (auto &it : futures)
+                        out.push_back(group.get(it));
+
+                // partial results are not cached
+                if (recorded && !(budget && budget->exhausted()))
+                        resultsCache->store(in, cacheKey, flags, topK, source->generation(), source->instance_id(), maskingState, scorerFingerprint, recorded.get(), partitions);
+
+                return out;
+        }
 
         // Handy utility function; executes query on all index sources in the provided collection in sequence and returns
         // a vector with the match filters/results of each execution.
@@ -85,11 +286,20 @@ namespace Trinity
                 return out;
         }
 
-        // Parallel queries execution, using std::async()
+        // Parallel queries execution, using the default Executor(or std::async() if there is none); see executor.h
+        // All tasks of a query are scheduled in the same task_group, so Executor::set_default()'s groupConcurrency bounds the concurrency of each query.
         // This variant also supports ExecFlags::AccumulatedScoreScheme
         // You will need to provide a cs for this to work
+        //
+        // topK and budget are passed to exec_query() for each index source; see exec_query_par()
+        // If budget is set, it is shared by all sources, and if budget->exhausted() when this returns, the results are partial.
+        // You get one T for each(non-empty) index source.
+        //
+        // If there is only one index source, and ExecFlags::DocumentsOnly or ExecFlags::AccumulatedScoreScheme is selected, it is executed
+        // with exec_query_partitioned(), and the documents matched in each range are buffered and then provided, in order, to a single T.
+        // matched_document instances can't be buffered, so otherwise the source is executed in a single range.
         template <typename T, typename... Arg>
-        std::vector<std::unique_ptr<T>> exec_query_par(const query &in, IndexSourcesCollection *collection, IndexDocumentsFilter *f, const uint32_t flags, Trinity::Similarity::IndexSourcesCollectionTermsScorer *cs, Arg &&... args)
+        std::vector<std::unique_ptr<T>> exec_query_par_topk(const query &in, IndexSourcesCollection *collection, IndexDocumentsFilter *f, const uint32_t flags, Trinity::Similarity::IndexSourcesCollectionTermsScorer *cs, const uint32_t topK, exec_budget *budget, Arg &&... args)
         {
                 static_assert(std::is_base_of<MatchedIndexDocumentsFilter, T>::value, "Expected a MatchedIndexDocumentsFilter subclass");
                 const auto n = collection->sources.size();
@@ -113,69 +323,62 @@ namespace Trinity
 
                 if (n == 1)
                 {
-                        // fast-path: single source
-                        if (false == collection->sources[0]->index_empty())
-                        {
-                                auto source = collection->sources[0];
-                                auto scanner = collection->scanner_registry_for(0);
-                                auto filter = std::make_unique<T>(std::forward<Arg>(args)...);
-                                std::unique_ptr<Similarity::IndexSourceTermsScorer> scorer;
+                        if (collection->sources[0]->index_empty())
+                                return out;
 
-                                if (accumScoreScheme)
-                                        scorer.reset(cs->new_source_scorer(source));
+                        if (0 == (flags & (unsigned(ExecFlags::DocumentsOnly) | unsigned(ExecFlags::AccumulatedScoreScheme))))
+                                return exec_query_partitioned<T>(in, collection, 0, f, flags, cs, topK, budget, 1, std::forward<Arg>(args)...);
 
-                                exec_query(in, source, scanner.get(), filter.get(), f, flags, scorer.get());
-                                out.push_back(std::move(filter));
-                        }
+                        // fast-path: single source (e.g after a merge), so we 'll split it into documents ranges instead
+                        // and merge the ranges results back into a single T
+                        auto filter = std::make_unique<T>(std::forward<Arg>(args)...);
+
+                        for (const auto &it : exec_query_partitioned<buffered_documents_filter>(in, collection, 0, f, flags, cs, topK, budget, 0))
+                                it->results.replay(filter.get());
+
+                        out.push_back(std::move(filter));
                         return out;
                 }
 
-                std::vector<std::future<std::unique_ptr<T>>> futures;
+                // Each source is executed in a single range by exec_query_partitioned(), which also takes care of the results cache
+                std::vector<std::future<std::vector<std::unique_ptr<T>>>> futures;
+                task_group group;
 
-                // Schedule all but the first via std::async()
+                // Schedule all but the first in the group
                 // we 'll handle the first here.
                 for (uint32_t i{1}; i != n; ++i)
                 {
                         if (false == collection->sources[i]->index_empty())
                         {
-                                futures.push_back(
-                                    std::async(std::launch::async, [&, accumScoreScheme](const uint32_t i) {
-                                            auto source = collection->sources[i];
-                                            auto scanner = collection->scanner_registry_for(i);
-                                            auto filter = std::make_unique<T>(std::forward<Arg>(args)...);
-                                            std::unique_ptr<Similarity::IndexSourceTermsScorer> scorer;
-
-                                            if (accumScoreScheme)
-                                                    scorer.reset(cs->new_source_scorer(source));
-
-                                            exec_query(in, source, scanner.get(), filter.get(), f, flags, scorer.get());
-                                            return filter;
-                                    },
-                                               i));
+                                futures.push_back(group.submit([&, i]() {
+                                        return exec_query_partitioned<T>(in, collection, i, f, flags, cs, topK, budget, 1, std::forward<Arg>(args)...);
+                                }));
                         }
                 }
 
-                if (auto source = collection->sources[0]; false == source->index_empty())
-                {
-                        auto scanner = collection->scanner_registry_for(0);
-                        auto filter = std::make_unique<T>(std::forward<Arg>(args)...);
-                        std::unique_ptr<Similarity::IndexSourceTermsScorer> scorer;
-
-                        if (accumScoreScheme)
-                                scorer.reset(cs->new_source_scorer(source));
-
-                        exec_query(in, source, scanner.get(), filter.get(), f, flags, scorer.get());
-                        out.push_back(std::move(filter));
-                }
+                if (false == collection->sources[0]->index_empty())
+                        out = exec_query_partitioned<T>(in, collection, 0, f, flags, cs, topK, budget, 1, std::forward<Arg>(args)...);
 
                 while (futures.size())
                 {
-                        auto &f = futures.back();
-
-                        out.push_back(std::move(f.get()));
+                        for (auto &it : group.get(futures.back()))
+                                out.push_back(std::move(it));
                         futures.pop_back();
                 }
 
                 return out;
         }
+
+        // budget(optional) is shared by all sources, same as with exec_query_par_topk(); if budget->exhausted() when this returns, the results are partial
+        template <typename T, typename... Arg>
+        std::vector<std::unique_ptr<T>> exec_query_par(const query &in, IndexSourcesCollection *collection, IndexDocumentsFilter *f, const uint32_t flags, Trinity::Similarity::IndexSourcesCollectionTermsScorer *cs, exec_budget *budget, Arg &&... args)
+        {
+                return exec_query_par_topk<T>(in, collection, f, flags, cs, 0, budget, std::forward<Arg>(args)...);
+        }
+
+        template <typename T, typename... Arg>
+        std::vector<std::unique_ptr<T>> exec_query_par(const query &in, IndexSourcesCollection *collection, IndexDocumentsFilter *f, const uint32_t flags, Trinity::Similarity::IndexSourcesCollectionTermsScorer *cs, Arg &&... args)
+        {
+                return exec_query_par_topk<T>(in, collection, f, flags, cs, 0, nullptr, std::forward<Arg>(args)...);
+        }
 };
@@ -0,0 +1,263 @@
+#include "executor.h"
+
+static std::atomic<Trinity::Executor *> defaultExecutor{nullptr};
+static std::atomic<uint32_t> defaultGroupConcurrency{0};
+
+// set for worker threads, so that tasks scheduled from a worker are pushed to its own deque
+static thread_local Trinity::Executor *curExecutor{nullptr};
+static thread_local int32_t curWorker{-1};
+
+void Trinity::Executor::set_default(Executor *const e, const uint32_t groupConcurrency) noexcept
+{
+        defaultGroupConcurrency.store(groupConcurrency, std::memory_order_relaxed);
+        defaultExecutor.store(e, std::memory_order_release);
+}
+
+Trinity::Executor *Trinity::Executor::default_executor() noexcept
+{
+        return defaultExecutor.load(std::memory_order_acquire);
+}
+
+uint32_t Trinity::Executor::default_group_concurrency() noexcept
+{
+        return defaultGroupConcurrency.load(std::memory_order_relaxed);
+}
+
+Trinity::Executor::Executor(const uint32_t threadsCnt)
+    : workersCnt{threadsCnt ?: std::max<uint32_t>(1, std::thread::hardware_concurrency())}, queues(new worker_queue[workersCnt])
+{
+        threads.reserve(workersCnt);
+        for (uint32_t i{0}; i != workersCnt; ++i)
+                threads.emplace_back([this, i]() { worker(i); });
+}
+
+Trinity::Executor::~Executor()
+{
+        {
+                std::lock_guard<std::mutex> g(sleepLock);
+
+                stop = true;
+        }
+
+        sleepCond.notify_all();
+        for (auto &t : threads)
+                t.join();
+}
+
+void Trinity::Executor::schedule(task &&t)
+{
+        auto q = curExecutor == this ? queues.get() + curWorker : &injected;
+
+        {
+                std::lock_guard<std::mutex> g(q->lock);
+
+                q->tasks.push_back(std::move(t));
+        }
+
+        // workers bump sleeping before they check queued, and we bump queued before we check sleeping, so
+        // either we will notice the worker, or the worker will notice the task
+        queued.fetch_add(1);
+        if (sleeping.load())
+        {
+                std::lock_guard<std::mutex> g(sleepLock);
+
+                sleepCond.notify_one();
+        }
+}
+
+bool Trinity::Executor::try_pop(const int32_t self, task *const out)
+{
+        const auto pop = [&](worker_queue *const q, const bool back) {
+                std::lock_guard<std::mutex> g(q->lock);
+
+                if (q->tasks.empty())
+                        return false;
+                else if (back)
+                {
+                        *out = std::move(q->tasks.back());
+                        q->tasks.pop_back();
+                }
+                else
+                {
+                        *out = std::move(q->tasks.front());
+                        q->tasks.pop_front();
+                }
+
+                queued.fetch_sub(1);
+                return true;
+        };
+
+        if (!queued.load(std::memory_order_relaxed))
+                return false;
+
+        if (self != -1 && pop(queues.get() + self, true))
+                return true;
+
+        if (pop(&injected, false))
+                return true;
+
+        // steal the oldest task of another worker
+        const uint32_t first = self == -1 ? 0 : self + 1;
+
+        for (uint32_t i{0}; i != workersCnt; ++i)
+        {
+                const auto idx = (first + i) % workersCnt;
+
+                if (int32_t(idx) != self && pop(queues.get() + idx, false))
+                        return true;
+        }
+
+        return false;
+}
+
+void Trinity::Executor::worker(const uint32_t idx)
+{
+        task t;
+
+        curExecutor = this;
+        curWorker = idx;
+
+        for (;;)
+        {
+                if (try_pop(idx, &t))
+                {
+                        t();
+                        t = nullptr;
+                        continue;
+                }
+
+                sleeping.fetch_add(1);
+
+                std::unique_lock<std::mutex> l(sleepLock);
+
+                sleepCond.wait(l, [this]() { return stop || queued.load(); });
+                sleeping.fetch_sub(1);
+
+                if (stop && !queued.load())
+                        break;
+        }
+}
+
+bool Trinity::Executor::run_one()
+{
+        task t;
+
+        if (!try_pop(curExecutor == this ? curWorker : -1, &t))
+                return false;
+
+        t();
+        return true;
+}
+
+void Trinity::task_group::dispatch(std::function<void()> &&fn)
+{
+        executor->schedule([this, fn = std::move(fn)]() {
+                try
+                {
+                        fn();
+                }
+                catch (...)
+                {
+                        std::lock_guard<std::mutex> g(lock);
+
+                        if (!exception)
+                                exception = std::current_exception();
+                }
+
+                completed();
+        });
+}
+
+void Trinity::task_group::completed()
+{
+        std::lock_guard<std::mutex> g(lock);
+
+        if (!deferred.empty())
+        {
+                // the slot of the task that just completed is handed to the next deferred task
+                dispatch(std::move(deferred.front()));
+                deferred.pop_front();
+        }
+        else if (running)
+                --running;
+
+        // the waiter will acquire lock before it returns, so it's safe to touch the group until we release it
+        if (pending.fetch_sub(1) == 1)
+                cond.notify_all();
+}
+
+void Trinity::task_group::run(std::function<void()> &&fn)
+{
+        pending.fetch_add(1);
+
+        if (!executor)
+        {
+                futures.emplace_back(std::async(std::launch::async, [this, fn = std::move(fn)]() {
+                        try
+                        {
+                                fn();
+                        }
+                        catch (...)
+                        {
+                                std::lock_guard<std::mutex> g(lock);
+
+                                if (!exception)
+                                        exception = std::current_exception();
+                        }
+
+                        std::lock_guard<std::mutex> g(lock);
+
+                        pending.fetch_sub(1);
+                }));
+                return;
+        }
+
+        if (maxConcurrency)
+        {
+                std::lock_guard<std::mutex> g(lock);
+
+                if (running >= maxConcurrency)
+                {
+                        deferred.push_back(std::move(fn));
+                        return;
+                }
+
+                ++running;
+        }
+
+        dispatch(std::move(fn));
+}
+
+void Trinity::task_group::wait()
+{
+        if (!executor)
+        {
+                for (auto &f : futures)
+                        f.get();
+                futures.clear();
+        }
+        else
+        {
+                while (pending.load())
+                {
+                        if (executor->run_one())
+                                continue;
+
+                        std::unique_lock<std::mutex> l(lock);
+
+                        cond.wait_for(l, std::chrono::milliseconds(1), [this]() { return !pending.load(); });
+                }
+        }
+
+        std::exception_ptr e;
+
+        {
+                // also waits for whoever completed the last task to release the lock
+                std::lock_guard<std::mutex> g(lock);
+
+                std::swap(e, exception);
+        }
+
+        if (e)
+                std::rethrow_exception(e);
+}
@@ -0,0 +1,155 @@
+// A persistent, work-stealing executor
+// exec_query_par(), exec_query_partitioned() and SegmentIndexSession::commit() used to std::async() every task, which means creating and tearing
+// down threads for every query, and, when many queries are executed concurrently, as many threads as there are (query, index source) pairs.
+//
+// Each worker owns a deque of tasks; tasks scheduled from a worker are pushed to its own deque(LIFO, cache-friendly), tasks scheduled from
+// other threads are pushed into a shared injection queue, and idle workers steal from the other workers' deques.
+// Tasks are scheduled via a task_group (e.g one for each query), which can be waited on, and which can bound how many of its tasks may run concurrently.
+//
+// If no executor is provided(see Executor::set_default()), task groups fall back to std::async(), as before.
+#pragma once
+#include "common.h"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+
+namespace Trinity
+{
+        class task_group;
+
+        class Executor final
+        {
+                friend class task_group;
+
+              private:
+                using task = std::function<void()>;
+
+                struct worker_queue final
+                {
+                        std::mutex lock;
+                        std::deque<task> tasks;
+                };
+
+              private:
+                const uint32_t workersCnt;
+                std::unique_ptr<worker_queue[]> queues;
+                std::vector<std::thread> threads;
+                worker_queue injected;
+                std::mutex sleepLock;
+                std::condition_variable sleepCond;
+                std::atomic<size_t> queued{0};
+                std::atomic<uint32_t> sleeping{0};
+                bool stop{false};
+
+              private:
+                void schedule(task &&t);
+
+                bool try_pop(const int32_t self, task *out);
+
+                void worker(const uint32_t idx);
+
+              public:
+                // If threads is 0, std::thread::hardware_concurrency() threads are used
+                Executor(const uint32_t threads = 0);
+
+                ~Executor();
+
+                inline uint32_t concurrency() const noexcept
+                {
+                        return workersCnt;
+                }
+
+                // Runs a single queued task, if any, on the calling thread
+                // Returns false if there was nothing to run
+                bool run_one();
+
+                // The executor used by exec_query_par(), exec_query_partitioned(), SegmentIndexSession::commit() and, unless another is provided, MergeCandidatesCollection::merge()
+                // nullptr(the default) means std::async() will be used instead.
+                // groupConcurrency is the concurrency limit of task groups created by those, i.e how many tasks of a single query or commit may be running at any time (0 for no limit)
+                static void set_default(Executor *e, const uint32_t groupConcurrency = 0) noexcept;
+
+                static Executor *default_executor() noexcept;
+
+                static uint32_t default_group_concurrency() noexcept;
+        };
+
+        // Tracks a set of related tasks(e.g all tasks of a query)
+        // If maxConcurrency != 0, no more than maxConcurrency of the group's tasks will be running at any time; the rest are deferred until running tasks complete.
+        //
+        // wait() runs queued tasks on the calling thread while the group's tasks are pending, so that it is safe to wait from within a task
+        // of the same executor(e.g exec_query_par() on a worker, which in turn uses exec_query_partitioned()).
+        class task_group final
+        {
+                friend class Executor;
+
+              private:
+                Executor *const executor;
+                const uint32_t maxConcurrency;
+                std::mutex lock;
+                std::condition_variable cond;
+                std::deque<std::function<void()>> deferred;
+                std::vector<std::future<void>> futures; // when there is no executor
+                uint32_t running{0};
+                std::atomic<uint32_t> pending{0};
+                std::exception_ptr exception;
+
+              private:
+                void completed();
+
+                void dispatch(std::function<void()> &&fn);
+
+              public:
+                task_group(Executor *const e = Executor::default_executor(), const uint32_t concurrencyLimit = Executor::default_group_concurrency())
+                    : executor{e}, maxConcurrency{concurrencyLimit}
+                {
+                }
+
+                ~task_group()
+                {
+                        // even if nothing's pending, whoever completed the last task may still be holding lock
+                        try
+                        {
+                                wait();
+                        }
+                        catch (...)
+                        {
+                        }
+                }
+
+                void run(std::function<void()> &&fn);
+
+                // Like run(), except that the returned future will provide the result(or the exception) of f()
+                // Use get() instead of future::get(), or wait() first; if you are on a worker thread, you may otherwise block a worker waiting for a task
+                // that won't run because all workers are waiting.
+                template <typename F>
+                auto submit(F &&f)
+                {
+                        using R = decltype(f());
+                        auto t = std::make_shared<std::packaged_task<R()>>(std::forward<F>(f));
+                        auto res = t->get_future();
+
+                        run([t]() { (*t)(); });
+                        return res;
+                }
+
+                // Runs queued tasks on the calling thread until f is ready, and returns its result
+                template <typename R>
+                R get(std::future<R> &f)
+                {
+                        while (f.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+                        {
+                                if (!executor || !executor->run_one())
+                                        f.wait_for(std::chrono::microseconds(200));
+                        }
+
+                        return f.get();
+                }
+
+                // Waits for all tasks of the group, and rethrows the first exception thrown by any of them(for tasks scheduled by run())
+                void wait();
+        };
+}
@@ -203,6 +203,18 @@ range32_t Trinity::Codecs::Google::IndexSession::append_index_chunk(const Trinit
         return {uint32_t(o), srcTCTX.indexChunk.size()};
 }
 
+void Trinity::Codecs::Google::IndexSession::append_private_session(Trinity::Codecs::IndexSession *const src, term_index_ctx *const tctxs, const size_t n)
+{
+        // terms chunks are position independent; we just need to rebase them
+        const auto o = indexOut.size() + indexOutFlushed;
+
+        indexOut.serialize(src->indexOut.data(), src->indexOut.size());
+        for (size_t i{0}; i != n; ++i)
+                tctxs[i].indexChunk.offset += o;
+
+        src->indexOut.clear();
+}
+
 void Trinity::Codecs::Google::IndexSession::merge(IndexSession::merge_participant *participants, const uint16_t participantsCnt, Trinity::Codecs::Encoder *encoder_)
 {
         static constexpr bool trace{false};
@@ -496,6 +508,7 @@ Trinity::Codecs::PostingsListIterator *Trinity::Codecs::Google::Decoder::new_ite
         if (indexTermCtx.indexChunk.size())
         {
                 it->blockDocIdx = 0;
+                it->blockDocsCnt = 1;
                 it->documents[0] = 0;
                 it->blockLastDocID = 0;
                 it->freqs[0] = 0;
@@ -668,7 +681,6 @@ void Trinity::Codecs::Google::Decoder::unpack_block(PostingsListIterator *const
 {
         static constexpr bool trace{false};
         const auto k{n - 1};
-        auto id{it->blockLastDocID};
         auto p{it->p};
         auto &documents{it->documents};
         auto &freqs{it->freqs};
@@ -681,15 +693,19 @@ void Trinity::Codecs::Google::Decoder::unpack_block(PostingsListIterator *const
                 uint32_t delta;
 
                 varbyte_get32(p, delta);
-                id += delta;
-
-                if (trace)
-                        SLog("<< doc = ", id, "\n");
+                documents[i] = delta;
+        }
 
-                documents[i] = id;
+        // deltas to absolute document IDs, for the whole block
+        prefix_sum_docids(documents, k, it->blockLastDocID);
 
-                if (trace)
-                        expect(id < thisBlockLastDocID);
+        if (trace)
+        {
+                for (uint8_t i{0}; i != k; ++i)
+                {
+                        SLog("<< doc = ", documents[i], "\n");
+                        expect(documents[i] < thisBlockLastDocID);
+                }
         }
 
         for (uint32_t i{0}; i != n; ++i)
@@ -705,6 +721,8 @@ void Trinity::Codecs::Google::Decoder::unpack_block(PostingsListIterator *const
 
         it->p = p;
         it->blockLastDocID = thisBlockLastDocID;
+        it->blockDocsCnt = n;
+        it->decodedDocs += n;
         documents[k] = thisBlockLastDocID;
 
         // We don't need to track current block documents cnt, because
@@ -745,6 +763,7 @@ void Trinity::Codecs::Google::Decoder::seek_block(PostingsListIterator *const it
                                 SLog("Target(", target, ") past this block (thisBlockLastDocID = ", thisBlockLastDocID, ")\n");
 
                         p += blockSize;
+                        ++(it->skippedBlocks);
 
                         if (p == chunkEnd)
                         {
@@ -912,6 +931,36 @@ void Trinity::Codecs::Google::Decoder::next(PostingsListIterator *const it)
                 SLog("at curDocument.id = ", it->curDocument.id, ", freq = ", it->freq, ", blockDocIdx = ", it->blockDocIdx, "\n");
 }
 
+uint32_t Trinity::Codecs::Google::Decoder::next_block(PostingsListIterator *const it, isrc_docid_t *const out, tokenpos_t *const freqs, const uint32_t max, const isrc_docid_t upto)
+{
+        // hits are interleaved with the documents, so we still need to skip_block_doc() for
+        // every document, but we don't need to go through next() and the vtable for them
+        auto &documents{it->documents};
+        uint32_t n{0};
+
+        for (auto id = it->curDocument.id; id < upto && n != max; id = it->curDocument.id)
+        {
+                out[n] = id;
+                if (freqs)
+                        freqs[n] = it->freq;
+                ++n;
+
+                if (id == it->blockLastDocID)
+                {
+                        // last document in the block; next() will unpack the next block or finalize
+                        next(it);
+                        break;
+                }
+
+                skip_block_doc(it);
+                ++(it->blockDocIdx);
+                it->curDocument.id = documents[it->blockDocIdx];
+                it->freq = it->freqs[it->blockDocIdx];
+        }
+
+        return n;
+}
+
 void Trinity::Codecs::Google::Decoder::advance(PostingsListIterator *const it, const isrc_docid_t target)
 {
         static constexpr bool trace{false};
@@ -978,6 +1027,8 @@ void Trinity::Codecs::Google::Decoder::advance(PostingsListIterator *const it, c
                                 if (target > savedBlockLastDocID)
                                 {
                                         // skip _past_ if (target > previous blockLastDocID)
+                                        // skiplist entries are SKIPLIST_STEP blocks apart, so that's about how many blocks we skipped
+                                        it->skippedBlocks += (idx + 1 - it->skipListIdx) * SKIPLIST_STEP;
                                         it->skipListIdx = idx + 1;
                                 }
                         }
@@ -1000,46 +1051,19 @@ void Trinity::Codecs::Google::Decoder::advance(PostingsListIterator *const it, c
         auto &documents{it->documents};
         auto &freqs{it->freqs};
         auto blockDocIdx{it->blockDocIdx};
+        // documents[] holds absolute document IDs, so we can search for the target instead of stepping through the block.
+        // The last document in the block is blockLastDocID, so unless we exhausted the block (and we don't have this document), we 'll find it here
+        const auto idx = std::min<uint32_t>(first_docid_geq(documents, blockDocIdx, it->blockDocsCnt, target), it->blockDocsCnt - 1);
 
-        for (;;)
-        {
-                const auto docID = documents[blockDocIdx];
-
-                if (trace)
-                        SLog("Scannning current block blockDocIdx = ", it->blockDocIdx, ", docID = ", docID, "\n");
-
-                if (docID > target)
-                {
-                        if (trace)
-                                SLog("Not in this block or maybe any block\n");
-                        break;
-                }
-                else if (docID == target)
-                {
-                        // got it
-                        if (trace)
-                                SLog(ansifmt::bold, "Got target", ansifmt::reset, "\n");
-
-                        break;
-                }
-                else if (docID == it->blockLastDocID)
-                {
-                        // exhausted block documents and still not here
-                        // we determined we don't have this document
-                        if (trace)
-                                SLog(ansifmt::bold, "Exhausted block", ansifmt::reset, "\n");
-
-                        break;
-                }
-                else
-                {
-                        if (trace)
-                                SLog("Skipping block document\n");
+        if (trace)
+                SLog("Target ", target, " at block index ", idx, " (from ", blockDocIdx, "), docID = ", documents[idx], "\n");
 
-                        it->blockDocIdx = blockDocIdx;
-                        skip_block_doc(it);
-                        ++blockDocIdx;
-                }
+        // we still need to skip the hits of all documents we skipped past
+        while (blockDocIdx != idx)
+        {
+                it->blockDocIdx = blockDocIdx;
+                skip_block_doc(it);
+                ++blockDocIdx;
         }
 
         it->curDocument.id = documents[blockDocIdx];
@@ -3,6 +3,7 @@
 // See https://github.com/powturbo/TurboPFor for Elias Fano encoding (for other Elias encoding, Rice, gamma etc, the impl. is trivial)
 #pragma once
 #include "codecs.h"
+#include "codecs_simd.h"
 
 #define TRINITY_CODECS_GOOGLE_AVAILABLE 1
 
@@ -29,7 +30,7 @@ namespace Trinity
                                 Trinity::Codecs::Encoder *new_encoder() override final;
 
                                 IndexSession(const char *bp)
-                                    : Trinity::Codecs::IndexSession{bp, unsigned(Capabilities::AppendIndexChunk) | unsigned(Capabilities::Merge)}
+                                    : Trinity::Codecs::IndexSession{bp, unsigned(Capabilities::AppendIndexChunk) | unsigned(Capabilities::Merge) | unsigned(Capabilities::ParallelEncoding)}
                                 {
                                 }
 
@@ -41,6 +42,13 @@ namespace Trinity
                                 range32_t append_index_chunk(const Trinity::Codecs::AccessProxy *, const term_index_ctx srcTCTX) override final;
 
                                 void merge(merge_participant *, const uint16_t, Trinity::Codecs::Encoder *) override final;
+
+                                Trinity::Codecs::IndexSession *new_private_session() override final
+                                {
+                                        return new IndexSession(basePath);
+                                }
+
+                                void append_private_session(Trinity::Codecs::IndexSession *, term_index_ctx *, const size_t) override final;
                         };
 
                         class Encoder final
@@ -110,7 +118,7 @@ namespace Trinity
                                 friend class Decoder;
 
 				private:
-                                uint8_t blockDocIdx;
+                                uint8_t blockDocIdx, blockDocsCnt;
                                 isrc_docid_t documents[N];
                                 isrc_docid_t blockLastDocID{0};
                                 uint32_t freqs[N];
@@ -124,6 +132,8 @@ namespace Trinity
 
                                 inline void materialize_hits(DocWordsSpace *dwspace, term_hit *out) override final;
 
+                                inline uint32_t next_block(isrc_docid_t *, tokenpos_t *, const uint32_t, const isrc_docid_t) override final;
+
                                 PostingsListIterator(Decoder *const d)
                                     : Trinity::Codecs::PostingsListIterator{reinterpret_cast<Trinity::Codecs::Decoder *>(d)}
                                 {
@@ -156,6 +166,8 @@ namespace Trinity
 
                                 void advance(PostingsListIterator *, const isrc_docid_t);
 
+                                uint32_t next_block(PostingsListIterator *, isrc_docid_t *, tokenpos_t *, const uint32_t, const isrc_docid_t);
+
                                 void materialize_hits(PostingsListIterator *, DocWordsSpace *, term_hit *);
 
                               private:
@@ -172,6 +184,7 @@ namespace Trinity
                                 void finalize(PostingsListIterator *const it)
                                 {
                                         it->blockDocIdx = 0;
+                                        it->blockDocsCnt = 1;
                                         it->blockLastDocID = DocIDsEND; // magic value; signifies end of documents
                                         it->documents[0] = DocIDsEND;
                                         it->p = chunkEnd;
@@ -203,6 +216,11 @@ namespace Trinity
                         {
                                 static_cast<Codecs::Google::Decoder *>(dec)->materialize_hits(this, dwspace, out);
                         }
+
+                        uint32_t PostingsListIterator::next_block(isrc_docid_t *const out, tokenpos_t *const freqs, const uint32_t max, const isrc_docid_t upto)
+                        {
+                                return static_cast<Codecs::Google::Decoder *>(dec)->next_block(this, out, freqs, max, upto);
+                        }
                 }
         }
 }
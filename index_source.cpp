@@ -1,5 +1,38 @@
 #include "index_source.h"
 
+uint64_t Trinity::IndexSource::next_instance_id() noexcept
+{
+        static std::atomic<uint64_t> next{1};
+
+        return next.fetch_add(1, std::memory_order_relaxed);
+}
+
+// Expects cacheLock to be held
+void Trinity::IndexSource::cache_term_ctx(const str8_t term, const term_index_ctx tctx)
+{
+        const auto s = sealed.load(std::memory_order_relaxed);
+        const size_t sealedSize = s ? s->map.size() : 0;
+
+        if (cacheLimit && sealedSize + cache.size() >= cacheLimit)
+                return;
+
+        cache.insert({{keysAllocator.CopyOf(term.data(), term.size()), term.size()}, tctx});
+
+        if (cache.size() >= std::max<size_t>(sealedSize, 64))
+        {
+                auto n = std::make_unique<sealed_terms_map>();
+
+                n->map.reserve(sealedSize + cache.size());
+                if (s)
+                        n->map.insert(s->map.begin(), s->map.end());
+                n->map.insert(cache.begin(), cache.end());
+                n->prev = s;
+
+                sealed.store(n.release(), std::memory_order_release);
+                cache.clear();
+        }
+}
+
 void Trinity::IndexSourcesCollection::commit()
 {
         std::sort(sources.begin(), sources.end(), [](const auto a, const auto b) noexcept {
@@ -8,14 +41,20 @@ void Trinity::IndexSourcesCollection::commit()
 
         map.clear();
         all.clear();
+        allGenerations.clear();
         for (auto s : sources)
         {
                 auto ud = s->masked_documents();
 
                 map.push_back({s, all.size()});
                 if (ud)
+                {
                         all.push_back(ud);
+                        allGenerations.push_back(s->generation());
+                }
         }
+
+        merged.build(all.data(), all.size());
 }
 
 Trinity::IndexSourcesCollection::~IndexSourcesCollection()
@@ -31,5 +70,15 @@ std::unique_ptr<Trinity::masked_documents_registry> Trinity::IndexSourcesCollect
 {
 	const auto n = map[idx].second;
 
-	return masked_documents_registry::make(all.data(), n);
+	return merged.registry_for(all.data(), n);
+}
+
+uint64_t Trinity::IndexSourcesCollection::masking_state_for(const uint16_t idx) const noexcept
+{
+        const auto n = map[idx].second;
+        uint64_t h{n};
+
+        for (uint32_t i{0}; i != n; ++i)
+                h = (h ^ allGenerations[i]) * 0x100000001b3ull;
+        return h;
 }
@@ -1,5 +1,7 @@
 #pragma once
 #include "codecs.h"
+#include "norms.h"
+#include <atomic>
 #include <ext/flat_hash_map.h>
 #include <mutex>
 #include <switch.h>
@@ -21,11 +23,35 @@ namespace Trinity
             : public RefCounted<IndexSource>
         {
               protected:
+                // term_ctx() cache
+                // Readers never block: they look up terms in the sealed map, which is immutable once published, and
+                // recently resolved terms are tracked in cache, which is only accessed by whoever manages to try_lock() cacheLock.
+                // Once cache grows as large as the sealed map, we build a new sealed map from both and publish it. Because the
+                // sealed map's size at least doubles every time, the cost of copying is amortized O(1) per term, and we can retain
+                // all previous sealed maps(readers may still be accessing them) until the source is destroyed, for at most as much memory again.
+                struct sealed_terms_map final
+                {
+                        ska::flat_hash_map<str8_t, term_index_ctx> map;
+                        const sealed_terms_map *prev;
+                };
+
                 std::mutex cacheLock;
                 simple_allocator keysAllocator{512};
                 ska::flat_hash_map<str8_t, term_index_ctx> cache;
+                std::atomic<const sealed_terms_map *> sealed{nullptr};
+                // 0 for no limit
+                size_t cacheLimit{0};
                 uint64_t gen{0}; // See IndexSourcesCollection
 
+              private:
+                // Process-wide unique, unlike generations(a merged segment assumes the generation of the most recent segment it replaced)
+                const uint64_t instance{next_instance_id()};
+
+              private:
+                static uint64_t next_instance_id() noexcept;
+
+                void cache_term_ctx(const str8_t term, const term_index_ctx tctx);
+
               public:
                 // We currently don't support multiple fields
                 // so we only track one(default) "field"'s worth of stats.
@@ -62,20 +88,44 @@ namespace Trinity
                         return gen;
                 }
 
+                // Identifies this source instance; see QueryResultsCache
+                inline auto instance_id() const noexcept
+                {
+                        return instance;
+                }
+
                 term_index_ctx term_ctx(const str8_t term)
                 {
-                        [[maybe_unused]] static constexpr bool trace{false};
-                        std::lock_guard<std::mutex> g(cacheLock);
+                        if (const auto s = sealed.load(std::memory_order_acquire))
+                        {
+                                if (const auto it = s->map.find(term); it != s->map.end())
+                                        return it->second;
+                        }
 
-                        auto p = cache.insert({term, {}});
+                        std::unique_lock<std::mutex> g(cacheLock, std::try_to_lock);
 
-                        if (p.second)
+                        if (!g.owns_lock())
                         {
-                                p.first->first.Set(keysAllocator.CopyOf(term.data(), term.size()), term.size());
-                                p.first->second = resolve_term_ctx(term);
+                                // Another thread is updating the cache; don't wait for it
+                                return resolve_term_ctx(term);
                         }
 
-                        return p.first->second;
+                        if (const auto it = cache.find(term); it != cache.end())
+                                return it->second;
+
+                        const auto tctx = resolve_term_ctx(term);
+
+                        cache_term_ctx(term, tctx);
+                        return tctx;
+                }
+
+                // Bounds the number of terms cached by term_ctx() (0 for no limit)
+                // Once the limit is reached, terms not already cached will be resolved on every term_ctx() call.
+                void set_term_ctx_cache_limit(const size_t n)
+                {
+                        std::lock_guard<std::mutex> g(cacheLock);
+
+                        cacheLimit = n;
                 }
 
 #if 0 // This would probably be a good idea, but we don't need this, and it would make some optimisations in updated_documents_scanner::test() possible because
@@ -152,6 +202,29 @@ namespace Trinity
 			return {};
 		}
 
+                // Per-document length norms(see norms.h), used by e.g BM25 for document length normalization
+                // Scorers should obtain the view once(e.g in their constructor) and access it directly, instead of using doc_norm() for every document
+                virtual norms_view doc_norms()
+                {
+                        return {};
+                }
+
+                // 0 if the norm for the document is not known
+                virtual uint8_t doc_norm(const isrc_docid_t id)
+                {
+                        return doc_norms()[id];
+                }
+
+                // [first, last] document IDs indexed in this source, or {0, 0} if unknown
+                // exec_query_partitioned() uses it to split the source into document ID ranges
+                virtual std::pair<isrc_docid_t, isrc_docid_t> docids_bounds()
+                {
+                        if (const auto norms = doc_norms())
+                                return {norms.base, norms.base + norms.size - 1};
+                        else
+                                return {0, 0};
+                }
+
                 // After we merge, we may, depending on which indices we decided to merge, be left with
                 // 1+ indices that may have masked documents, but no index data(i.e they exist simply
                 // to hold the masked documents.
@@ -165,6 +238,13 @@ namespace Trinity
 
                 virtual ~IndexSource()
                 {
+                        for (auto s = sealed.load(std::memory_order_relaxed); s;)
+                        {
+                                const auto prev = s->prev;
+
+                                delete s;
+                                s = prev;
+                        }
                 }
         };
 
@@ -223,8 +303,8 @@ namespace Trinity
         // in another source that will be considered in this search session).
         //
         // IndexSourcesCollection facilitates that arrangement.
-        // It represents a `search session` collection of index sources, and for each such source, it creates a masked_documents_registry that contains scanners
-        // for all more recent sources.
+        // It represents a `search session` collection of index sources, and for each such source, it creates a masked_documents_registry that masks documents
+        // updated in any of the more recent sources. commit() merges their updated_documents, so that's a single scanner, however many sources there are.
         //
         // It also retains all sources.
         // See Trinity::exec_query(const query&, IndexSourcesCollection *) for how to do this in sequence, but you can and should do
@@ -238,9 +318,13 @@ namespace Trinity
         {
               private:
                 std::vector<updated_documents> all;
+                // generations of the sources of all[]
+                std::vector<uint64_t> allGenerations;
                 // for each source, we track how many of the first update_documents in all[]
                 // we should consider for masking documents
                 std::vector<std::pair<IndexSource *, uint16_t>> map;
+                // so that scanner_registry_for() returns a single scanner, regardless of how many sources mask a source
+                merged_updated_documents merged;
 
               public:
                 std::vector<IndexSource *> sources;
@@ -257,5 +341,9 @@ namespace Trinity
                 void commit();
 
                 std::unique_ptr<Trinity::masked_documents_registry> scanner_registry_for(const uint16_t idx);
+
+                // Identifies the set of sources whose updated_documents mask documents of sources[idx], i.e what scanner_registry_for(idx) would consider
+                // If neither the source nor its masking state changed, executing a query on the source will match the same documents; see QueryResultsCache
+                uint64_t masking_state_for(const uint16_t idx) const noexcept;
         };
 }
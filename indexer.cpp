@@ -1,5 +1,6 @@
 #include "indexer.h"
 #include "docidupdates.h"
+#include "executor.h"
 #include "terms.h"
 #include "utils.h"
 #include <fcntl.h>
@@ -8,6 +9,7 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <text.h>
+#include <thread>
 
 using namespace Trinity;
 
@@ -36,7 +38,7 @@ void SegmentIndexSession::document_proxy::insert(const uint32_t termID, const to
 
 void SegmentIndexSession::commit_document_impl(const document_proxy &proxy, const bool replace)
 {
-        uint32_t terms{0};
+        uint32_t terms{0}, docHits{0};
         const auto all_hits = reinterpret_cast<const uint8_t *>(hitsBuf.data());
 	field_doc_stats fs;
 
@@ -117,6 +119,7 @@ void SegmentIndexSession::commit_document_impl(const document_proxy &proxy, cons
 
                         require(termHits <= UINT16_MAX);
                         *(uint16_t *)(b.data() + o) = termHits; // total hits for (document, term): TODO use varint?
+                        docHits += termHits;
 
                         ++terms;
                 }
@@ -144,11 +147,11 @@ void SegmentIndexSession::commit_document_impl(const document_proxy &proxy, cons
 	// I wonder how that's decoded and if this is about pages of whatever
 
 
+	// We discount overlaps, like Lucene's BM25Similarity does by default. If no hits have positions, all hits count.
 	if (fs.positionHitsCnt)
-	{
-
-	}
-
+                docNorms.push_back({proxy.did, Norms::encode_length(fs.positionHitsCnt - fs.overlapsCnt)});
+        else
+                docNorms.push_back({proxy.did, Norms::encode_length(docHits)});
 
 
         if (intermediateStateFlushFreq && unlikely(b.size() > intermediateStateFlushFreq))
@@ -337,7 +340,9 @@ void Trinity::persist_segment(const Trinity::IndexSource::field_statistics &fs,
 We clearly need to optimize the encoding process, the remaining time can be reduced but won't make a difference if manage to do it anyway
 Need to consider means to optimize the encoder impl.
 */
-void SegmentIndexSession::commit(Trinity::Codecs::IndexSession *const sess)
+// Encodes all indexed documents into sess->indexOut, and tracks the term_index_ctx of each term in map
+// If indexFd != -1, sess->indexOut will be periodically flushed to it(see set_flush_freq())
+void SegmentIndexSession::build_index(Trinity::Codecs::IndexSession *const sess, const int indexFd, ska::flat_hash_map<uint32_t, term_index_ctx> &map)
 {
         struct segment_data
         {
@@ -349,25 +354,11 @@ void SegmentIndexSession::commit(Trinity::Codecs::IndexSession *const sess)
         };
 
         static constexpr bool trace{false};
-        std::vector<uint32_t> allOffsets;
-        ska::flat_hash_map<uint32_t, term_index_ctx> map;
-        std::unique_ptr<Trinity::Codecs::Encoder> enc_(sess->new_encoder());
-        auto path = Buffer{}.append(sess->basePath, "/index.t");
-        int indexFd = open(path.c_str(), O_WRONLY | O_CREAT | O_LARGEFILE | O_TRUNC, 0775);
 
-        if (indexFd == -1)
-                throw Switch::system_error("Failed to persist index: ", path.AsS32());
-
-        Defer({
-                if (indexFd != -1)
-                        close(indexFd);
-        });
-
-        const auto scan = [ &defaultFieldStats = this->defaultFieldStats, flushFreq = this->flushFreq, indexFd, enc = enc_.get(), &map, sess ](const auto &ranges)
+        const auto scan = [ &defaultFieldStats = this->defaultFieldStats, flushFreq = this->flushFreq, indexFd, &map, sess ](const auto &ranges)
         {
                 uint8_t payloadSize;
                 std::vector<segment_data> all[32];
-                term_index_ctx tctx;
                 const auto R = ranges.data();
                 uint64_t before;
 
@@ -432,47 +423,36 @@ void SegmentIndexSession::commit(Trinity::Codecs::IndexSession *const sess)
                         // can sort those in parallel
                         // can't rely on std::execution::par, not available yet
                         // down to 2s from 10s, just by partitioning them and sorting them in parallel
-                        std::vector<std::future<void>> futures;
+                        task_group group;
 
                         before = Timings::Microseconds::Tick();
                         for (auto &v : all)
                         {
-                                futures.push_back(
-                                    std::async(std::launch::async, [](auto v) {
-                                            std::sort(v->begin(), v->end(), [](const auto &a, const auto &b) noexcept {
-                                                    return a.termID < b.termID || (a.termID == b.termID && a.documentID < b.documentID);
-                                            });
-
-                                    },
-                                               &v));
+                                group.run([v = &v]() {
+                                        std::sort(v->begin(), v->end(), [](const auto &a, const auto &b) noexcept {
+                                                return a.termID < b.termID || (a.termID == b.termID && a.documentID < b.documentID);
+                                        });
+                                });
                         }
 
-                        while (futures.size())
-                        {
-                                futures.back().get();
-                                futures.pop_back();
-                        }
+                        group.wait();
 
                         if (trace)
                                 SLog(duration_repr(Timings::Microseconds::Since(before)), " to sort them\n");
                 }
 
-                before = Timings::Microseconds::Tick();
-                for (auto &v : all)
-                {
+                // Encodes all terms of a partition using enc, and tracks their IDs and term_index_ctx in termIDs and tctxs
+                // If flushFd != -1, enc->sess->indexOut will be flushed to it whenever it exceeds flushFreq
+                const auto encode = [R, flushFreq](Trinity::Codecs::Encoder *const enc, const std::vector<segment_data> &v, std::vector<uint32_t> *const termIDs, std::vector<term_index_ctx> *const tctxs, IndexSource::field_statistics *const fs, const int flushFd) {
+                        term_index_ctx tctx;
+                        uint8_t payloadSize;
+
                         for (const auto *it = v.data(), *const e = it + v.size(); likely(it != e);)
                         {
                                 const auto term = it->termID;
                                 isrc_docid_t prevDID{0};
                                 uint32_t _t;
 
-				// TODO:
-				// Maybe we need a new API which would allow us to encode terms individually, i.e use begin_term() to get
-				// hold of some identifier and buffer, and then begin_document() and new_hit() on that buffer, end then use end_term() with that buffer
-				// on the encoder to flush that term into the encoder. By doing so, and by serializing access to the encoding on end_term(), we would have been able
-				// to process/encode terms indepedently and take advantage of multiple cores.
-				// This is important because most the time's spent in encoding PFOR arrays
-
                                 enc->begin_term();
 
                                 do
@@ -484,7 +464,7 @@ void SegmentIndexSession::commit(Trinity::Codecs::IndexSession *const sess)
 
                                         require(documentID > prevDID);
 
-					defaultFieldStats.sumTermHits +=  hitsCnt;
+					fs->sumTermHits +=  hitsCnt;
 
                                         enc->begin_document(documentID);
                                         for (uint32_t i{0}; i != hitsCnt; ++i)
@@ -506,20 +486,99 @@ void SegmentIndexSession::commit(Trinity::Codecs::IndexSession *const sess)
                                         }
                                         enc->end_document();
 
-					++defaultFieldStats.sumTermsDocs;
+					++fs->sumTermsDocs;
 
                                         prevDID = documentID;
                                 } while (likely(++it != e) && it->termID == term);
 
                                 enc->end_term(&tctx);
-                                map.insert({term, tctx});
+                                termIDs->push_back(term);
+                                tctxs->push_back(tctx);
+
+				++fs->totalTerms;
+
+                                if (flushFreq && flushFd != -1 && unlikely(enc->sess->indexOut.size() > flushFreq))
+                                        enc->sess->flush_index(flushFd);
+                        }
+                };
+
+                const auto track = [&map, &defaultFieldStats](const std::vector<uint32_t> &termIDs, const std::vector<term_index_ctx> &tctxs, const IndexSource::field_statistics &fs) {
+                        for (size_t i{0}; i != termIDs.size(); ++i)
+                                map.insert({termIDs[i], tctxs[i]});
 
-				++defaultFieldStats.totalTerms;
+                        defaultFieldStats.sumTermHits += fs.sumTermHits;
+                        defaultFieldStats.sumTermsDocs += fs.sumTermsDocs;
+                        defaultFieldStats.totalTerms += fs.totalTerms;
+                };
 
-                                if (flushFreq && unlikely(sess->indexOut.size() > flushFreq))
+                before = Timings::Microseconds::Tick();
+                if (sess->caps & unsigned(Trinity::Codecs::IndexSession::Capabilities::ParallelEncoding))
+                {
+                        // Most of the time is spent encoding(e.g PFOR) postings lists, and terms are independent of each other, so
+                        // we encode each partition into a private session on another thread, and only append_private_session() is serialized.
+                        // We append partitions in order, and only keep up to maxInFlight partitions in-flight, so that we won't hold the whole
+                        // index in memory twice.
+                        struct encoded_partition final
+                        {
+                                std::unique_ptr<Trinity::Codecs::IndexSession> sess;
+                                std::vector<uint32_t> termIDs;
+                                std::vector<term_index_ctx> tctxs;
+                                IndexSource::field_statistics fs;
+                        };
+
+                        const size_t maxInFlight = std::max<size_t>(2, Executor::default_executor() ? Executor::default_executor()->concurrency() : std::thread::hardware_concurrency());
+                        std::future<std::unique_ptr<encoded_partition>> futures[sizeof_array(all)];
+                        task_group group;
+                        size_t scheduled{0};
+                        const auto schedule = [&]() {
+                                futures[scheduled] = group.submit([&encode, sess, v = all + scheduled]() {
+                                        std::unique_ptr<encoded_partition> res(new encoded_partition());
+
+                                        res->sess.reset(sess->new_private_session());
+
+                                        std::unique_ptr<Trinity::Codecs::Encoder> enc(res->sess->new_encoder());
+
+                                        res->termIDs.reserve(v->size() / 4);
+                                        res->tctxs.reserve(v->size() / 4);
+                                        encode(enc.get(), *v, &res->termIDs, &res->tctxs, &res->fs, -1);
+                                        return res;
+                                });
+                                ++scheduled;
+                        };
+
+                        while (scheduled != sizeof_array(all) && scheduled != maxInFlight)
+                                schedule();
+
+                        for (size_t i{0}; i != sizeof_array(all); ++i)
+                        {
+                                auto res = group.get(futures[i]);
+
+                                if (scheduled != sizeof_array(all))
+                                        schedule();
+
+                                sess->append_private_session(res->sess.get(), res->tctxs.data(), res->tctxs.size());
+                                track(res->termIDs, res->tctxs, res->fs);
+
+                                if (flushFreq && indexFd != -1 && unlikely(sess->indexOut.size() > flushFreq))
                                         sess->flush_index(indexFd);
                         }
                 }
+                else
+                {
+                        std::unique_ptr<Trinity::Codecs::Encoder> enc(sess->new_encoder());
+                        std::vector<uint32_t> termIDs;
+                        std::vector<term_index_ctx> tctxs;
+
+                        for (const auto &v : all)
+                        {
+                                IndexSource::field_statistics fs;
+
+                                termIDs.clear();
+                                tctxs.clear();
+                                encode(enc.get(), v, &termIDs, &tctxs, &fs, indexFd);
+                                track(termIDs, tctxs, fs);
+                        }
+                }
                 if (trace)
                         SLog(duration_repr(Timings::Microseconds::Since(before)), " to encode\n");
         };
@@ -559,7 +618,44 @@ void SegmentIndexSession::commit(Trinity::Codecs::IndexSession *const sess)
         }
         else if (ranges.size())
                 scan(ranges);
+}
+
+void SegmentIndexSession::commit_in_memory(Trinity::Codecs::IndexSession *const sess, simple_allocator *const allocator, std::vector<std::pair<str8_t, term_index_ctx>> *const terms, std::vector<isrc_docid_t> *const updatedDocuments, IndexSource::field_statistics *const fs, std::vector<std::pair<isrc_docid_t, uint8_t>> *const norms)
+{
+        ska::flat_hash_map<uint32_t, term_index_ctx> map;
+
+        build_index(sess, -1, map);
+
+        terms->reserve(terms->size() + map.size());
+        for (const auto &it : map)
+        {
+                const auto term = invDict[it.first];
+
+                terms->push_back({{allocator->CopyOf(term.data(), term.size()), term.size()}, it.second});
+        }
+
+        updatedDocuments->insert(updatedDocuments->end(), updatedDocumentIDs.begin(), updatedDocumentIDs.end());
+        norms->insert(norms->end(), docNorms.begin(), docNorms.end());
+        *fs = defaultFieldStats;
+        sess->end();
+}
+
+void SegmentIndexSession::commit(Trinity::Codecs::IndexSession *const sess)
+{
+        static constexpr bool trace{false};
+        ska::flat_hash_map<uint32_t, term_index_ctx> map;
+        auto path = Buffer{}.append(sess->basePath, "/index.t");
+        int indexFd = open(path.c_str(), O_WRONLY | O_CREAT | O_LARGEFILE | O_TRUNC, 0775);
+
+        if (indexFd == -1)
+                throw Switch::system_error("Failed to persist index: ", path.AsS32());
+
+        Defer({
+                if (indexFd != -1)
+                        close(indexFd);
+        });
 
+        build_index(sess, indexFd, map);
 
         // Persist terms dictionary
         std::vector<std::pair<str8_t, term_index_ctx>> v;
@@ -584,6 +680,7 @@ void SegmentIndexSession::commit(Trinity::Codecs::IndexSession *const sess)
         before = Timings::Microseconds::Tick();
 
         sess->persist_terms(v);
+        persist_norms(sess->basePath, docNorms);
         persist_segment(defaultFieldStats, sess, updatedDocumentIDs, indexFd);
 
         if (trace)
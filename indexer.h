@@ -74,6 +74,9 @@ namespace Trinity
 
 		IndexSource::field_statistics defaultFieldStats;
 
+                // (document, norm) for all indexed documents; see norms.h
+                std::vector<std::pair<isrc_docid_t, uint8_t>> docNorms;
+
               private:
                 IOBuffer b;
                 IOBuffer hitsBuf;
@@ -157,6 +160,8 @@ namespace Trinity
 
                 bool track(const isrc_docid_t);
 
+                void build_index(Trinity::Codecs::IndexSession *const sess, const int indexFd, ska::flat_hash_map<uint32_t, term_index_ctx> &map);
+
               public:
                 uint32_t term_id(const str8_t term);
 
@@ -165,6 +170,7 @@ namespace Trinity
                 void clear()
                 {
                         b.clear();
+                        docNorms.clear();
                         while (banks.size())
                         {
                                 delete banks.back();
@@ -217,6 +223,12 @@ namespace Trinity
                 // See also SegmentIndexSource::SegmentIndexSource()
                 void commit(Trinity::Codecs::IndexSession *const s);
 
+                // Like commit(), except that nothing is persisted. The index is built in s->indexOut (flush frequency is ignored), and
+                // the terms (allocated from allocator), the updated documents, the field statistics and the documents norms are provided to the caller.
+                // It will s->end() for you.
+                // See InMemoryIndex::refresh()
+                void commit_in_memory(Trinity::Codecs::IndexSession *const s, simple_allocator *allocator, std::vector<std::pair<str8_t, term_index_ctx>> *terms, std::vector<isrc_docid_t> *updatedDocuments, IndexSource::field_statistics *fs, std::vector<std::pair<isrc_docid_t, uint8_t>> *norms);
+
                 auto any_indexed() const noexcept
                 {
                         return backingFileFD != -1 || hitsBuf.size() || b.size() || updatedDocumentIDs.size();
@@ -2,14 +2,17 @@
 #include "utils.h"
 #include <ansifmt.h>
 #include <switch_bitops.h>
-#ifdef LUCENE_USE_STREAMVBYTE
+#ifdef LUCENE_HAVE_STREAMVBYTE
 #include <ext/streamvbyte/include/streamvbyte.h>
 #include <ext/streamvbyte/include/streamvbytedelta.h>
-#elif defined(LUCENE_USE_MASKEDVBYTE)
+#endif
+#ifdef LUCENE_HAVE_MASKEDVBYTE
 #include <ext/MaskedVByte/include/varintdecode.h>
 #include <ext/MaskedVByte/include/varintencode.h>
 #endif
 
+using IntsEncoding = Trinity::Codecs::Lucene::IntsEncoding;
+
 static constexpr bool trace{false};
 
 
@@ -25,11 +28,74 @@ static bool all_equal(const uint32_t *const __restrict__ values, const size_t n)
         return true;
 }
 
-#ifdef LUCENE_USE_FASTPFOR
-static void ints_encode(FastPForLib::FastPFor<4> &forUtil, const uint32_t *values, const size_t n, IOBuffer &out)
-#else
-static void ints_encode(const uint32_t *values, const size_t n, IOBuffer &out)
+// Block kernels, one instance for each encoding scheme
+// See ints_encode() and ints_decode() for the runtime dispatch
+template <IntsEncoding E>
+static void ints_encode_block(FastPForLib::FastPFor<4> &forUtil, const uint32_t *values, const size_t n, IOBuffer &out)
+{
+        if constexpr (E == IntsEncoding::StreamVByte)
+        {
+#ifdef LUCENE_HAVE_STREAMVBYTE
+                out.reserve(n * 8 + 256);
+                out.pack(uint8_t(1));
+
+                const auto len = streamvbyte_encode(const_cast<uint32_t *>(values), n, reinterpret_cast<uint8_t *>(out.end()));
+
+                out.advance_size(len);
+#endif
+        }
+        else if constexpr (E == IntsEncoding::MaskedVByte)
+        {
+#ifdef LUCENE_HAVE_MASKEDVBYTE
+                out.reserve(n * 8);
+                out.pack(uint8_t(1));
+
+                const auto len = vbyte_encode(const_cast<uint32_t *>(values), n, (uint8_t *)out.end());
+
+                out.advance_size(len);
+#endif
+        }
+        else
+        {
+                const auto offset = out.size();
+
+                out.RoomFor(sizeof(uint8_t));
+                out.reserve((n + n) * sizeof(uint32_t));
+                auto l = out.capacity() / sizeof(uint32_t);
+                forUtil.encodeArray(values, n, (uint32_t *)out.end(), l);
+                out.advance_size(l * sizeof(uint32_t));
+                *(out.data() + offset) = l; // this is great, means we can skip ahead n * sizeof(uint32_t) bytes to get to the next block
+        }
+}
+
+template <IntsEncoding E>
+static const uint8_t *ints_decode_block(FastPForLib::FastPFor<4> &forUtil, const uint8_t *__restrict p, const uint8_t blockSize, uint32_t *const __restrict values)
+{
+        if constexpr (E == IntsEncoding::StreamVByte)
+        {
+#ifdef LUCENE_HAVE_STREAMVBYTE
+                p += streamvbyte_decode(p, values, Trinity::Codecs::Lucene::BLOCK_SIZE);
 #endif
+        }
+        else if constexpr (E == IntsEncoding::MaskedVByte)
+        {
+#ifdef LUCENE_HAVE_MASKEDVBYTE
+                p += masked_vbyte_decode(p, values, Trinity::Codecs::Lucene::BLOCK_SIZE);
+#endif
+        }
+        else
+        {
+                size_t n{Trinity::Codecs::Lucene::BLOCK_SIZE};
+                const auto *ptr = reinterpret_cast<const uint32_t *>(p);
+
+                ptr = forUtil.decodeArray(ptr, blockSize, values, n);
+                p = reinterpret_cast<const uint8_t *>(ptr);
+        }
+
+        return p;
+}
+
+static void ints_encode(const IntsEncoding encoding, FastPForLib::FastPFor<4> &forUtil, const uint32_t *values, const size_t n, IOBuffer &out)
 {
         if (all_equal(values, n))
         {
@@ -41,38 +107,24 @@ static void ints_encode(const uint32_t *values, const size_t n, IOBuffer &out)
                 return;
         }
 
-#ifdef LUCENE_USE_STREAMVBYTE
-        out.reserve(n * 8 + 256);
-        out.pack(uint8_t(1));
-
-        const auto len = streamvbyte_encode(const_cast<uint32_t *>(values), n, reinterpret_cast<uint8_t *>(out.end()));
-
-        out.advance_size(len);
-
-#elif defined(LUCENE_USE_MASKEDVBYTE)
-        out.reserve(n * 8);
-        out.pack(uint8_t(1));
+        // dispatched once per block; this is not going to be measurable
+        switch (encoding)
+        {
+                case IntsEncoding::StreamVByte:
+                        ints_encode_block<IntsEncoding::StreamVByte>(forUtil, values, n, out);
+                        break;
 
-        const auto len = vbyte_encode(const_cast<uint32_t *>(values), n, (uint8_t *)out.end());
+                case IntsEncoding::MaskedVByte:
+                        ints_encode_block<IntsEncoding::MaskedVByte>(forUtil, values, n, out);
+                        break;
 
-        out.advance_size(len);
-#else
-        const auto offset = out.size();
-
-        out.RoomFor(sizeof(uint8_t));
-        out.reserve((n + n) * sizeof(uint32_t));
-        auto l = out.capacity() / sizeof(uint32_t);
-        forUtil.encodeArray(values, n, (uint32_t *)out.end(), l);
-        out.advance_size(l * sizeof(uint32_t));
-        *(out.data() + offset) = l; // this is great, means we can skip ahead n * sizeof(uint32_t) bytes to get to the next block
-#endif
+                default:
+                        ints_encode_block<IntsEncoding::FastPFor>(forUtil, values, n, out);
+                        break;
+        }
 }
 
-#ifdef LUCENE_USE_FASTPFOR
-static const uint8_t *ints_decode(FastPForLib::FastPFor<4> &forUtil, const uint8_t *__restrict p, uint32_t *const __restrict values)
-#else
-static const uint8_t *ints_decode(const uint8_t *__restrict p, uint32_t *const __restrict values)
-#endif
+static const uint8_t *ints_decode(const IntsEncoding encoding, FastPForLib::FastPFor<4> &forUtil, const uint8_t *__restrict p, uint32_t *const __restrict values)
 {
         if (const auto blockSize = *p++; blockSize == 0)
         {
@@ -89,17 +141,20 @@ static const uint8_t *ints_decode(const uint8_t *__restrict p, uint32_t *const _
         }
         else
         {
-#ifdef LUCENE_USE_STREAMVBYTE
-                p += streamvbyte_decode(p, values, Trinity::Codecs::Lucene::BLOCK_SIZE);
-#elif defined(LUCENE_USE_MASKEDVBYTE)
-                p += masked_vbyte_decode(p, values, Trinity::Codecs::Lucene::BLOCK_SIZE);
-#else
-                size_t n{Trinity::Codecs::Lucene::BLOCK_SIZE};
-                const auto *ptr = reinterpret_cast<const uint32_t *>(p);
+                switch (encoding)
+                {
+                        case IntsEncoding::StreamVByte:
+                                p = ints_decode_block<IntsEncoding::StreamVByte>(forUtil, p, blockSize, values);
+                                break;
 
-                ptr = forUtil.decodeArray(ptr, blockSize, values, n);
-                p = reinterpret_cast<const uint8_t *>(ptr);
-#endif
+                        case IntsEncoding::MaskedVByte:
+                                p = ints_decode_block<IntsEncoding::MaskedVByte>(forUtil, p, blockSize, values);
+                                break;
+
+                        default:
+                                p = ints_decode_block<IntsEncoding::FastPFor>(forUtil, p, blockSize, values);
+                                break;
+                }
         }
 
         return p;
@@ -173,6 +228,33 @@ range32_t Trinity::Codecs::Lucene::IndexSession::append_index_chunk(const Trinit
         return {uint32_t(o), srcTCTX.indexChunk.size()};
 }
 
+void Trinity::Codecs::Lucene::IndexSession::append_private_session(Trinity::Codecs::IndexSession *const src_, term_index_ctx *const tctxs, const size_t n)
+{
+        auto src = static_cast<Trinity::Codecs::Lucene::IndexSession *>(src_);
+        const auto o = indexOut.size() + indexOutFlushed;
+        const auto base = indexOut.size();
+        const uint32_t hitsBase = positionsOut.size() + positionsOutFlushed;
+
+        positionsOut.serialize(src->positionsOut.data(), src->positionsOut.size());
+        indexOut.serialize(src->indexOut.data(), src->indexOut.size());
+
+        // Each term chunk begins with the offset of its hits in hits.data, and that's the
+        // only thing that's not relative to the term chunk
+        for (size_t i{0}; i != n; ++i)
+        {
+                auto &tctx = tctxs[i];
+
+                *reinterpret_cast<uint32_t *>(indexOut.data() + base + tctx.indexChunk.offset) += hitsBase;
+                tctx.indexChunk.offset += o;
+        }
+
+        src->indexOut.clear();
+        src->positionsOut.clear();
+
+        if (flushFreq && unlikely(positionsOut.size() > flushFreq))
+                flush_positions_data();
+}
+
 void Trinity::Codecs::Lucene::Encoder::begin_term()
 {
         const auto s = static_cast<Trinity::Codecs::Lucene::IndexSession *>(sess);
@@ -187,9 +269,11 @@ void Trinity::Codecs::Lucene::Encoder::begin_term()
         lastHitsBlockOffset = 0;
         lastHitsBlockTotalHits = 0;
         skiplistCountdown = SKIPLIST_STEP;
+        termMaxFreq = 0;
         skiplist.clear();
 
-        sess->indexOut.pack(uint32_t(termPositionsOffset), uint32_t(0), uint32_t(0), uint16_t(0)); // will fill in later. Will also track positions chunk size for efficient merge
+        // will fill in later. Will also track positions chunk size for efficient merge
+        sess->indexOut.pack(uint32_t(termPositionsOffset), uint32_t(0), uint32_t(0), uint16_t(0), uint16_t(0));
 }
 
 void Trinity::Codecs::Lucene::Encoder::output_block()
@@ -204,6 +288,16 @@ void Trinity::Codecs::Lucene::Encoder::output_block()
                 if (likely(skiplist.size() < UINT16_MAX))
                 {
                         // keep it sane
+                        // block-max metadata; lastDocID is the last document in this block
+                        // because we haven't accepted the next document yet (see begin_document())
+                        uint32_t maxFreq{0};
+
+                        for (uint32_t i{0}; i != buffered; ++i)
+                                maxFreq = std::max(maxFreq, docFreqs[i]);
+
+                        cur_block.blockLastDocID = lastDocID;
+                        // saturated, so that it remains an upper bound
+                        cur_block.blockMaxFreq = std::min<uint32_t>(maxFreq, std::numeric_limits<tokenpos_t>::max());
                         skiplist.push_back(cur_block);
                 }
                 skiplistCountdown = SKIPLIST_STEP;
@@ -211,13 +305,8 @@ void Trinity::Codecs::Lucene::Encoder::output_block()
 
         auto indexOut = &sess->indexOut;
 
-#ifdef LUCENE_USE_FASTPFOR
-        ints_encode(forUtil, docDeltas, buffered, *indexOut);
-        ints_encode(forUtil, docFreqs, buffered, *indexOut);
-#else
-        ints_encode(docDeltas, buffered, *indexOut);
-        ints_encode(docFreqs, buffered, *indexOut);
-#endif
+        ints_encode(encoding, forUtil, docDeltas, buffered, *indexOut);
+        ints_encode(encoding, forUtil, docFreqs, buffered, *indexOut);
         buffered = 0;
 
         if (trace)
@@ -293,13 +382,8 @@ void Trinity::Codecs::Lucene::Encoder::new_hit(const uint32_t pos, const range_b
 
                 sumHits += totalHits;
 
-#ifdef LUCENE_USE_FASTPFOR
-                ints_encode(forUtil, hitPosDeltas, totalHits, *positionsOut);
-                ints_encode(forUtil, hitPayloadSizes, totalHits, *positionsOut);
-#else
-                ints_encode(hitPosDeltas, totalHits, *positionsOut);
-                ints_encode(hitPayloadSizes, totalHits, *positionsOut);
-#endif
+                ints_encode(encoding, forUtil, hitPosDeltas, totalHits, *positionsOut);
+                ints_encode(encoding, forUtil, hitPayloadSizes, totalHits, *positionsOut);
 
                 {
                         size_t s{0};
@@ -326,6 +410,7 @@ void Trinity::Codecs::Lucene::Encoder::new_hit(const uint32_t pos, const range_b
 
 void Trinity::Codecs::Lucene::Encoder::end_document()
 {
+        termMaxFreq = std::max(termMaxFreq, docFreqs[buffered]);
         ++buffered;
 }
 
@@ -399,6 +484,8 @@ void Trinity::Codecs::Lucene::Encoder::end_term(term_index_ctx *out)
 
         *(uint32_t *)(sess->indexOut.data() + (termIndexOffset - sess->indexOutFlushed) + sizeof(uint32_t) + sizeof(uint32_t)) = (s->positionsOut.size() + s->positionsOutFlushed) - termPositionsOffset;
         *(uint16_t *)(sess->indexOut.data() + (termIndexOffset - sess->indexOutFlushed) + sizeof(uint32_t) + sizeof(uint32_t) + sizeof(uint32_t)) = skiplistSize;
+        // saturated, so that it remains an upper bound
+        *(uint16_t *)(sess->indexOut.data() + (termIndexOffset - sess->indexOutFlushed) + sizeof(uint32_t) * 3 + sizeof(uint16_t)) = std::min<uint32_t>(termMaxFreq, std::numeric_limits<tokenpos_t>::max());
 
         if (skiplistSize)
         {
@@ -406,7 +493,7 @@ void Trinity::Codecs::Lucene::Encoder::end_term(term_index_ctx *out)
                 auto *const __restrict__ b = &sess->indexOut;
 
                 for (const auto &it : skiplist)
-                        b->pack(it.indexOffset, it.lastDocID, it.lastHitsBlockOffset, it.totalDocumentsSoFar, it.lastHitsBlockTotalHits, it.curHitsBlockHits);
+                        b->pack(it.indexOffset, it.lastDocID, it.lastHitsBlockOffset, it.totalDocumentsSoFar, it.lastHitsBlockTotalHits, it.curHitsBlockHits, it.blockLastDocID, uint16_t(it.blockMaxFreq));
 
                 skiplist.clear();
         }
@@ -437,13 +524,8 @@ void Trinity::Codecs::Lucene::Decoder::refill_hits(PostingsListIterator *it)
 
         if (it->hitsLeft >= BLOCK_SIZE)
         {
-#ifdef LUCENE_USE_FASTPFOR
-                it->hdp = ints_decode(forUtil, it->hdp, it->hitsPositionDeltas);
-                it->hdp = ints_decode(forUtil, it->hdp, it->hitsPayloadLengths);
-#else
-                it->hdp = ints_decode(it->hdp, it->hitsPositionDeltas);
-                it->hdp = ints_decode(it->hdp, it->hitsPayloadLengths);
-#endif
+                it->hdp = ints_decode(encoding, forUtil, it->hdp, it->hitsPositionDeltas);
+                it->hdp = ints_decode(encoding, forUtil, it->hdp, it->hitsPayloadLengths);
 
                 varbyte_get32(it->hdp, payloadsChunkLength);
 
@@ -563,13 +645,8 @@ void Trinity::Codecs::Lucene::Decoder::refill_documents(Trinity::Codecs::Lucene:
 {
         if (it->docsLeft >= BLOCK_SIZE)
         {
-#ifdef LUCENE_USE_FASTPFOR
-                it->p = ints_decode(forUtil, it->p, it->docDeltas);
-                it->p = ints_decode(forUtil, it->p, it->docFreqs);
-#else
-                it->p = ints_decode(it->p, it->docDeltas);
-                it->p = ints_decode(it->p, it->docFreqs);
-#endif
+                it->p = ints_decode(encoding, forUtil, it->p, it->docIDs);
+                it->p = ints_decode(encoding, forUtil, it->p, it->docFreqs);
 
                 it->bufferedDocs = BLOCK_SIZE;
                 it->docsLeft -= BLOCK_SIZE;
@@ -579,7 +656,7 @@ void Trinity::Codecs::Lucene::Decoder::refill_documents(Trinity::Codecs::Lucene:
                 uint32_t v;
                 auto p{it->p};
                 auto &docFreqs{it->docFreqs};
-                auto &docDeltas{it->docDeltas};
+                auto &docDeltas{it->docIDs};
                 const auto docsLeft{it->docsLeft};
 
                 for (uint32_t i{0}; i != docsLeft; ++i)
@@ -606,6 +683,12 @@ void Trinity::Codecs::Lucene::Decoder::refill_documents(Trinity::Codecs::Lucene:
                 it->docsLeft = 0;
         }
 
+        // deltas to absolute document IDs, for the whole block, so that
+        // next() is just a load, and advance() can search the block
+        prefix_sum_docids(it->docIDs, it->bufferedDocs, it->lastDocID);
+        it->lastDocID = it->docIDs[it->bufferedDocs - 1];
+        it->decodedDocs += it->bufferedDocs;
+
         it->docsIndex = 0;
         update_curdoc(it);
 }
@@ -622,11 +705,10 @@ void Trinity::Codecs::Lucene::Decoder::decode_next_block(Trinity::Codecs::Lucene
 [[gnu::hot]] void Trinity::Codecs::Lucene::Decoder::next(Trinity::Codecs::Lucene::PostingsListIterator *const __restrict__ it)
 {
         auto &docFreqs{it->docFreqs};
-        auto &docDeltas{it->docDeltas};
+        auto &docIDs{it->docIDs};
         auto idx{it->docsIndex};
 
-        it->skippedHits += docFreqs[idx];
-        it->lastDocID += docDeltas[idx++];
+        it->skippedHits += docFreqs[idx++];
 
         if (unlikely(idx >= it->bufferedDocs))
         {
@@ -647,9 +729,64 @@ void Trinity::Codecs::Lucene::Decoder::decode_next_block(Trinity::Codecs::Lucene
                 }
         }
 
-        it->curDocument.id = it->lastDocID + docDeltas[idx];
+        it->curDocument.id = docIDs[idx];
+        it->freq = docFreqs[idx];
+        it->docsIndex = idx;
+}
+
+// Same as invoking next() for every document handed out, except we only touch
+// the iterator state once, for the whole run
+[[gnu::hot]] uint32_t Trinity::Codecs::Lucene::Decoder::next_block(Trinity::Codecs::Lucene::PostingsListIterator *const __restrict__ it, isrc_docid_t *const __restrict__ out, tokenpos_t *const __restrict__ freqs, const uint32_t max, const isrc_docid_t upto)
+{
+        if (it->curDocument.id >= upto)
+                return 0;
+
+        const auto &docFreqs{it->docFreqs};
+        const auto &docIDs{it->docIDs};
+        const auto end{it->bufferedDocs};
+        auto idx{it->docsIndex};
+        auto skippedHits{it->skippedHits};
+        uint32_t n{0};
+
+        for (; idx < end && n != max; ++idx, ++n)
+        {
+                const auto id = docIDs[idx];
+
+                if (id >= upto)
+                        break;
+
+                out[n] = id;
+                if (freqs)
+                        freqs[n] = docFreqs[idx];
+
+                skippedHits += docFreqs[idx];
+        }
+
+        it->skippedHits = skippedHits;
+
+        if (idx >= end)
+        {
+                if (likely(it->p != chunkEnd))
+                {
+                        it->docsIndex = idx;
+
+                        decode_next_block(it);
+
+                        idx = it->docsIndex;
+                }
+                else
+                {
+                        finalize(it);
+
+                        it->docsIndex = idx;
+                        return n;
+                }
+        }
+
+        it->curDocument.id = docIDs[idx];
         it->freq = docFreqs[idx];
         it->docsIndex = idx;
+        return n;
 }
 
 uint32_t Trinity::Codecs::Lucene::Decoder::skiplist_search(PostingsListIterator *it, const isrc_docid_t target) const noexcept
@@ -715,6 +852,55 @@ uint32_t Trinity::Codecs::Lucene::Decoder::skiplist_search(PostingsListIterator
 #endif
 }
 
+// Positions the iterator's shallow cursor to the block that may contain target, without decoding anything
+// If we can't tell (no skiplist, no block-max metadata, or target is past the last block tracked in the skiplist), we 'll
+// be conservative and treat the rest of the postings list as a single block with no upper bound
+void Trinity::Codecs::Lucene::Decoder::advance_shallow(PostingsListIterator *const it, const isrc_docid_t target)
+{
+#ifdef LUCENE_LAZY_SKIPLIST_INIT
+        if (unlikely(skiplistSize))
+        {
+                init_skiplist(skiplistSize);
+                skiplistSize = 0;
+        }
+#endif
+
+        auto &shallow{it->shallow};
+
+        if (skiplistBlockMax)
+        {
+                const auto size{skiplist.size};
+                auto idx{shallow.idx};
+
+                // targets are expected to be monotonically increasing, so a linear scan from
+                // the last block is preferrable to a binary search here
+                while (idx != size && skiplist.data[idx].blockLastDocID < target)
+                        ++idx;
+
+                shallow.idx = idx;
+                if (idx != size)
+                {
+                        const auto &e = skiplist.data[idx];
+
+                        if (target > e.lastDocID)
+                        {
+                                shallow.blockLastDocID = e.blockLastDocID;
+                                shallow.blockMaxFreq = e.blockMaxFreq;
+                        }
+                        else
+                        {
+                                // in-between blocks tracked in the skiplist (SKIPLIST_STEP > 1)
+                                shallow.blockLastDocID = e.lastDocID;
+                                shallow.blockMaxFreq = std::numeric_limits<tokenpos_t>::max();
+                        }
+                        return;
+                }
+        }
+
+        shallow.blockLastDocID = DocIDsEND;
+        shallow.blockMaxFreq = std::numeric_limits<tokenpos_t>::max();
+}
+
 [[gnu::hot]] void Trinity::Codecs::Lucene::Decoder::advance(Trinity::Codecs::Lucene::PostingsListIterator *it, const isrc_docid_t target)
 {
         auto localBufferedDocs{it->bufferedDocs}; // the compiler may be able to better deal with aliasing here
@@ -729,7 +915,7 @@ uint32_t Trinity::Codecs::Lucene::Decoder::skiplist_search(PostingsListIterator
 
         auto &curDocument{it->curDocument};
         auto &docFreqs{it->docFreqs};
-        auto &docDeltas{it->docDeltas};
+        auto &docIDs{it->docIDs};
         auto docsIndex{it->docsIndex};
 
 #ifdef LUCENE_SKIPLIST_SEEK_EARLY
@@ -776,6 +962,8 @@ uint32_t Trinity::Codecs::Lucene::Decoder::skiplist_search(PostingsListIterator
                                                 it->p = blockPtr;
                                                 it->hdp = hitsBlockPtr;
 
+                                                // all blocks but the last are BLOCK_SIZE documents long
+                                                it->skippedBlocks += (it->docsLeft - (totalDocuments - r.totalDocumentsSoFar)) / BLOCK_SIZE;
                                                 it->lastDocID = r.lastDocID;
                                                 it->docsLeft = totalDocuments - r.totalDocumentsSoFar;
                                                 it->hitsLeft = totalHits - r.totalHitsSoFar;
@@ -785,7 +973,6 @@ uint32_t Trinity::Codecs::Lucene::Decoder::skiplist_search(PostingsListIterator
 
                                                 refill_documents(it);
                                                 refill_hits(it);
-                                                update_curdoc(it);
 
                                                 it->skippedHits = r.curHitsBlockHits;
                                                 if (const auto n = it->skippedHits)
@@ -810,32 +997,35 @@ uint32_t Trinity::Codecs::Lucene::Decoder::skiplist_search(PostingsListIterator
                 else
                 {
                 l10:
-                        if (curDocument.id == target)
+                        if (curDocument.id >= target)
                         {
                                 if (trace)
-                                        SLog("Found it\n");
-
-                                it->docsIndex = docsIndex;
-                                return;
-                        }
-                        else if (curDocument.id > target)
-                        {
-                                if (trace)
-                                        SLog("Not Here, now past target\n");
+                                        SLog(curDocument.id == target ? "Found it\n" : "Not Here, now past target\n");
 
                                 it->docsIndex = docsIndex;
                                 return;
                         }
                         else
                         {
-                                it->skippedHits += docFreqs[docsIndex];
-                                it->lastDocID += docDeltas[docsIndex];
+                                // the block is decoded into absolute document IDs, so we can search it
+                                // instead of stepping through it; it->lastDocID is the last document ID in this block
+                                const auto upto = target <= it->lastDocID
+                                                      ? first_docid_geq(docIDs, docsIndex + 1, localBufferedDocs, target)
+                                                      : localBufferedDocs;
+                                uint32_t skipped{0};
+
+                                for (auto i{docsIndex}; i != upto; ++i)
+                                        skipped += docFreqs[i];
 
-                                ++docsIndex;
+                                it->skippedHits += skipped;
+                                docsIndex = upto;
 
-                                // see: update_curdoc();
-                                curDocument.id = it->lastDocID + docDeltas[docsIndex];
-                                it->freq = docFreqs[docsIndex];
+                                if (docsIndex != localBufferedDocs)
+                                {
+                                        // see: update_curdoc();
+                                        curDocument.id = docIDs[docsIndex];
+                                        it->freq = docFreqs[docsIndex];
+                                }
                         }
                 }
         }
@@ -944,33 +1134,123 @@ Trinity::Codecs::PostingsListIterator *Trinity::Codecs::Lucene::Decoder::new_ite
         it->bufferedDocs = it->bufferedHits = 0;
         it->skippedHits = 0;
         it->docFreqs[0] = 0;
-        it->docDeltas[0] = 0;
+        it->docIDs[0] = 0;
         it->skipListIdx = 0;
         it->hdp = hitsBase;
-        it->p = postingListBase + sizeof(uint32_t) + sizeof(uint32_t) + sizeof(uint32_t) + sizeof(uint16_t);
+        it->p = postingListBase + chunk_header_size(skiplistBlockMax);
 
         return it.release();
 }
 
+void Trinity::Codecs::Lucene::skiplists_cache::set_capacity(const size_t capacity)
+{
+        shardCapacity.store(capacity / SHARDS, std::memory_order_relaxed);
+
+        for (auto &s : shards)
+        {
+                std::lock_guard<std::mutex> g(s.lock);
+
+                while (s.entries > capacity / SHARDS)
+                {
+                        auto it = s.map.begin();
+
+                        s.entries -= it->second.second;
+                        s.map.erase(it);
+                }
+        }
+}
+
+Trinity::Codecs::Lucene::skiplists_cache::skiplist_ref Trinity::Codecs::Lucene::skiplists_cache::get(const uint32_t key)
+{
+        auto &s = shards[key % SHARDS];
+        std::lock_guard<std::mutex> g(s.lock);
+
+        if (const auto it = s.map.find(key); it != s.map.end())
+        {
+                hits.fetch_add(1, std::memory_order_relaxed);
+                return it->second.first;
+        }
+
+        misses.fetch_add(1, std::memory_order_relaxed);
+        return {};
+}
+
+Trinity::Codecs::Lucene::skiplists_cache::skiplist_ref Trinity::Codecs::Lucene::skiplists_cache::insert(const uint32_t key, skiplist_ref ref, const uint16_t size)
+{
+        const auto capacity = shardCapacity.load(std::memory_order_relaxed);
+
+        if (size > capacity)
+                return ref;
+
+        auto &s = shards[key % SHARDS];
+        std::lock_guard<std::mutex> g(s.lock);
+        auto res = s.map.insert({key, {ref, size}});
+
+        if (!res.second)
+        {
+                // another decoder beat us to it
+                return res.first->second.first;
+        }
+
+        for (s.entries += size; s.entries > capacity;)
+        {
+                // evict an arbitrary skiplist, other than the one we just inserted
+                auto it = s.map.begin();
+
+                if (it->first == key)
+                        ++it;
+
+                s.entries -= it->second.second;
+                s.map.erase(it);
+        }
+
+        return ref;
+}
+
 void Trinity::Codecs::Lucene::Decoder::init_skiplist(const uint16_t size)
 {
-        static constexpr size_t skiplistEntrySize{sizeof(uint32_t) * 5 + sizeof(uint16_t)};
+        const auto key = indexTermCtx.indexChunk.offset;
+
+        if (auto ref = skiplistsCache->get(key))
+        {
+                skiplist.owner = std::move(ref);
+                skiplist.data = skiplist.owner.get();
+                skiplist.size = size;
+                return;
+        }
+
+        const auto skiplistEntrySize = skiplist_entry_size(skiplistBlockMax);
         const auto *sit = chunkEnd;
+        skiplists_cache::skiplist_ref ref(new skiplist_entry[size]);
 
-        skiplist.size = size;
-        skiplist.data = (skiplist_entry *)malloc(sizeof(skiplist_entry) * size);
         for (uint32_t i{0}; i != size; ++i, sit += skiplistEntrySize)
         {
                 const auto it = reinterpret_cast<const uint32_t *>(sit);
-                auto &e = skiplist.data[i];
+                auto &e = ref[i];
 
                 e.indexOffset = it[0];
                 e.lastDocID = it[1];
                 e.lastHitsBlockOffset = it[2];
                 e.totalDocumentsSoFar = it[3];
                 e.totalHitsSoFar = it[4];
-                e.curHitsBlockHits = *(uint16_t *)(sit + skiplistEntrySize - sizeof(uint16_t));
+                e.curHitsBlockHits = *(uint16_t *)(sit + sizeof(uint32_t) * 5);
+
+                if (skiplistBlockMax)
+                {
+                        e.blockLastDocID = *(uint32_t *)(sit + sizeof(uint32_t) * 5 + sizeof(uint16_t));
+                        e.blockMaxFreq = *(uint16_t *)(sit + sizeof(uint32_t) * 6 + sizeof(uint16_t));
+                }
+                else
+                {
+                        // no block-max metadata; see advance_shallow()
+                        e.blockLastDocID = 0;
+                        e.blockMaxFreq = std::numeric_limits<tokenpos_t>::max();
+                }
         }
+
+        skiplist.owner = skiplistsCache->insert(key, std::move(ref), size);
+        skiplist.data = skiplist.owner.get();
+        skiplist.size = size;
 }
 
 void Trinity::Codecs::Lucene::Decoder::init(const term_index_ctx &tctx, Trinity::Codecs::AccessProxy *access)
@@ -982,6 +1262,8 @@ void Trinity::Codecs::Lucene::Decoder::init(const term_index_ctx &tctx, Trinity:
         auto p = ptr;
 
         indexTermCtx = tctx;
+        encoding = ap->encoding;
+        skiplistsCache = &ap->skiplists;
         postingListBase = ptr;
         chunkEnd = ptr + chunkSize;
         totalDocuments = tctx.documents;
@@ -991,17 +1273,29 @@ void Trinity::Codecs::Lucene::Decoder::init(const term_index_ctx &tctx, Trinity:
         totalHits = *(uint32_t *)p;
         p += sizeof(uint32_t);
         p += sizeof(uint32_t); // positions chunk size
+        skiplistBlockMax = ap->blockMax;
 #ifdef LUCENE_LAZY_SKIPLIST_INIT
         skiplistSize = *(uint16_t *)p;
 #else
-        const auto skiplistSize = *(uint16_t *)p;
+        const uint16_t skiplistSize = *(uint16_t *)p;
 #endif
         p += sizeof(uint16_t);
 
+        if (skiplistBlockMax)
+        {
+                maxFreq = *(uint16_t *)p;
+                p += sizeof(uint16_t);
+        }
+        else
+        {
+                // no upper bound for legacy layout chunks
+                maxFreq = std::numeric_limits<tokenpos_t>::max();
+        }
+
         if (skiplistSize)
         {
                 // deserialize the skiplist and maybe use it
-                static constexpr size_t skiplistEntrySize{sizeof(uint32_t) * 5 + sizeof(uint16_t)};
+                const auto skiplistEntrySize = skiplist_entry_size(skiplistBlockMax);
 
                 chunkEnd = (ptr + chunkSize) - (skiplistSize * skiplistEntrySize);
 
@@ -1022,9 +1316,17 @@ Trinity::Codecs::Lucene::AccessProxy::~AccessProxy()
 	}
 }
 
-Trinity::Codecs::Lucene::AccessProxy::AccessProxy(const char *bp, const uint8_t *p, const uint8_t *hd)
-    : Trinity::Codecs::AccessProxy{bp, p}, hitsDataPtr{hd}
+Trinity::Codecs::Lucene::AccessProxy::AccessProxy(const char *bp, const uint8_t *p, const uint8_t *hd, const IntsEncoding e, const bool bm)
+    : Trinity::Codecs::AccessProxy{bp, p}, hitsDataPtr{hd}, encoding{e}, blockMax{bm}
 {
+        if (!encoding_available(e))
+        {
+                if (!bm)
+                        throw Switch::data_error("Segment ", bp, " is a legacy Lucene segment, and LUCENE_LEGACY_ENCODING_SCHEME is not available in this build; add it to LUCENE_ENCODING_SCHEMES, or re-index the segment");
+
+                throw Switch::data_error("Segment ", bp, " uses a Lucene codec integers encoding not available in this build");
+        }
+
         if (hd == nullptr)
         {
                 int fd = open(Buffer{}.append(basePath, "/hits.data").c_str(), O_RDONLY | O_LARGEFILE);
@@ -1063,6 +1365,7 @@ void Trinity::Codecs::Lucene::IndexSession::merge(merge_participant *const __res
                 uint32_t hitsPayloadLengths[BLOCK_SIZE];
                 uint32_t hitsPositionDeltas[BLOCK_SIZE];
                 masked_documents_registry *maskedDocsReg;
+                IntsEncoding encoding;
 
                 uint32_t documentsLeft;
                 uint32_t hitsLeft;
@@ -1090,11 +1393,7 @@ void Trinity::Codecs::Lucene::IndexSession::merge(merge_participant *const __res
 
                 const uint8_t *payloadsIt, *payloadsEnd;
 
-#ifdef LUCENE_USE_FASTPFOR
                 void refill_hits(FastPForLib::FastPFor<4> &forUtil)
-#else
-                void refill_hits()
-#endif
                 {
                         uint32_t payloadsChunkLength;
                         auto hdp = positions_chunk.p;
@@ -1106,13 +1405,8 @@ void Trinity::Codecs::Lucene::IndexSession::merge(merge_participant *const __res
 
                         if (hitsLeft >= BLOCK_SIZE)
                         {
-#ifdef LUCENE_USE_FASTPFOR
-                                hdp = ints_decode(forUtil, hdp, hitsPositionDeltas);
-                                hdp = ints_decode(forUtil, hdp, hitsPayloadLengths);
-#else
-                                hdp = ints_decode(hdp, hitsPositionDeltas);
-                                hdp = ints_decode(hdp, hitsPayloadLengths);
-#endif
+                                hdp = ints_decode(encoding, forUtil, hdp, hitsPositionDeltas);
+                                hdp = ints_decode(encoding, forUtil, hdp, hitsPayloadLengths);
 
                                 varbyte_get32(hdp, payloadsChunkLength);
 
@@ -1153,24 +1447,15 @@ void Trinity::Codecs::Lucene::IndexSession::merge(merge_participant *const __res
                         hitsIndex = 0;
                 }
 
-#ifdef LUCENE_USE_FASTPFOR
                 void refill_documents(FastPForLib::FastPFor<4> &forUtil)
-#else
-                void refill_documents()
-#endif
                 {
                         if (trace)
                                 SLog("Refilling documents ", documentsLeft, "\n");
 
                         if (documentsLeft >= BLOCK_SIZE)
                         {
-#ifdef LUCENE_USE_FASTPFOR
-                                index_chunk.p = ints_decode(forUtil, index_chunk.p, docDeltas);
-                                index_chunk.p = ints_decode(forUtil, index_chunk.p, docFreqs);
-#else
-                                index_chunk.p = ints_decode(index_chunk.p, docDeltas);
-                                index_chunk.p = ints_decode(index_chunk.p, docFreqs);
-#endif
+                                index_chunk.p = ints_decode(encoding, forUtil, index_chunk.p, docDeltas);
+                                index_chunk.p = ints_decode(encoding, forUtil, index_chunk.p, docFreqs);
 
                                 cur_block.size = BLOCK_SIZE;
                                 documentsLeft -= BLOCK_SIZE;
@@ -1210,11 +1495,7 @@ void Trinity::Codecs::Lucene::IndexSession::merge(merge_participant *const __res
                                 SLog(cur_block.i, " ", cur_block.size, "\n");
                 }
 
-#ifdef LUCENE_USE_FASTPFOR
                 void skip_ommitted_hits(FastPForLib::FastPFor<4> &forUtil)
-#else
-                void skip_ommitted_hits()
-#endif
                 {
                         if (trace)
                                 SLog("Skipping omitted hits ", skippedHits, ", bufferedHits = ", bufferedHits, "\n");
@@ -1237,11 +1518,7 @@ void Trinity::Codecs::Lucene::IndexSession::merge(merge_participant *const __res
                                 {
                                         if (hitsIndex == bufferedHits)
                                         {
-#ifdef LUCENE_USE_FASTPFOR
                                                 refill_hits(forUtil);
-#else
-                                                refill_hits();
-#endif
                                         }
 
                                         const auto step = std::min<uint32_t>(skippedHits, bufferedHits - hitsIndex);
@@ -1258,11 +1535,7 @@ void Trinity::Codecs::Lucene::IndexSession::merge(merge_participant *const __res
                         }
                 }
 
-#ifdef LUCENE_USE_FASTPFOR
                 void output_hits(FastPForLib::FastPFor<4> &forUtil, Trinity::Codecs::Lucene::Encoder *__restrict__ enc)
-#else
-                void output_hits(Trinity::Codecs::Lucene::Encoder *__restrict__ enc)
-#endif
                 {
                         auto freq = docFreqs[cur_block.i];
                         uint64_t payload;
@@ -1271,11 +1544,7 @@ void Trinity::Codecs::Lucene::IndexSession::merge(merge_participant *const __res
                         if (trace)
                                 SLog("Will output hits for ", cur_block.i, " ", freq, ", skippedHits = ", skippedHits, "\n");
 
-#ifdef LUCENE_USE_FASTPFOR
                         skip_ommitted_hits(forUtil);
-#else
-                        skip_ommitted_hits();
-#endif
 
                         if (const auto upto = hitsIndex + freq; upto <= bufferedHits)
                         {
@@ -1338,11 +1607,7 @@ void Trinity::Codecs::Lucene::IndexSession::merge(merge_participant *const __res
                                                 if (trace)
                                                         SLog("Will refill hits (Freq now = ", freq, ")\n");
 
-#ifdef LUCENE_USE_FASTPFOR
                                                 refill_hits(forUtil);
-#else
-                                                refill_hits();
-#endif
                                         }
                                         else
                                                 break;
@@ -1352,11 +1617,7 @@ void Trinity::Codecs::Lucene::IndexSession::merge(merge_participant *const __res
                         docFreqs[cur_block.i] = 0; // simplifies processing logic (See next().)
                 }
 
-#ifdef LUCENE_USE_FASTPFOR
                 bool next(FastPForLib::FastPFor<4> &forUtil)
-#else
-                bool next()
-#endif
                 {
                         skippedHits += docFreqs[cur_block.i];
                         lastDocID += docDeltas[cur_block.i++];
@@ -1371,17 +1632,9 @@ void Trinity::Codecs::Lucene::IndexSession::merge(merge_participant *const __res
 
 // this is important, because refill_documents()
 // will update cur_block
-#ifdef LUCENE_USE_FASTPFOR
                                 skip_ommitted_hits(forUtil);
-#else
-                                skip_ommitted_hits();
-#endif
 
-#ifdef LUCENE_USE_FASTPFOR
                                 refill_documents(forUtil);
-#else
-                                refill_documents();
-#endif
                         }
                         else
                         {
@@ -1416,6 +1669,7 @@ void Trinity::Codecs::Lucene::IndexSession::merge(merge_participant *const __res
 
                 c->index_chunk.e = p + participants[i].tctx.indexChunk.size();
                 c->maskedDocsReg = participants[i].maskedDocsReg;
+                c->encoding = ap->encoding; // same codec identifier as ours, see MergeCandidatesCollection::merge()
                 c->documentsLeft = participants[i].tctx.documents;
                 c->lastDocID = 0;
                 c->skippedHits = 0;
@@ -1429,8 +1683,11 @@ void Trinity::Codecs::Lucene::IndexSession::merge(merge_participant *const __res
                 p += sizeof(uint32_t);
                 const auto posChunkSize = *(uint32_t *)p;
                 p += sizeof(uint32_t);
-                [[maybe_unused]] const auto skiplistSize = *(uint16_t *)p;
+                const auto skiplistBlockMax = ap->blockMax;
+                const uint16_t skiplistSize = *(uint16_t *)p;
                 p += sizeof(uint16_t);
+                if (skiplistBlockMax)
+                        p += sizeof(uint16_t); // maxFreq
 
                 c->index_chunk.p = p;
                 c->positions_chunk.p = ap->hitsDataPtr + hitsDataOffset;
@@ -1443,16 +1700,10 @@ void Trinity::Codecs::Lucene::IndexSession::merge(merge_participant *const __res
                 // Skip past skiplist
                 if (skiplistSize)
                 {
-                        static constexpr size_t skiplistEntrySize{sizeof(uint32_t) * 5 + sizeof(uint16_t)};
-
-                        c->index_chunk.e -= skiplistSize * skiplistEntrySize;
+                        c->index_chunk.e -= skiplistSize * skiplist_entry_size(skiplistBlockMax);
                 }
 
-#ifdef LUCENE_USE_FASTPFOR
                 c->refill_documents(forUtil);
-#else
-                c->refill_documents();
-#endif
         }
 
         for (isrc_docid_t prev{0};;)
@@ -1483,11 +1734,7 @@ void Trinity::Codecs::Lucene::IndexSession::merge(merge_participant *const __res
                         [[maybe_unused]] const auto freq = c->current_freq();
 
                         encoder->begin_document(did);
-#ifdef LUCENE_USE_FASTPFOR
                         c->output_hits(forUtil, encoder);
-#else
-                        c->output_hits(encoder);
-#endif
                         encoder->end_document();
                 }
 
@@ -1496,11 +1743,7 @@ void Trinity::Codecs::Lucene::IndexSession::merge(merge_participant *const __res
                         const auto idx = toAdvance[--toAdvanceCnt];
                         auto c = candidates + idx;
 
-#ifdef LUCENE_USE_FASTPFOR
                         if (!c->next(forUtil))
-#else
-                        if (!c->next())
-#endif
                         {
                                 if (!--rem)
                                         goto l1;
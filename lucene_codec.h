@@ -1,29 +1,21 @@
 #pragma once
 #include "codecs.h"
+#include "codecs_simd.h"
 
 static_assert(sizeof(Trinity::isrc_docid_t) <= sizeof(uint32_t));
 
-// You should edit Makefile accordingly. That is, Makefile's LUCENE_ENCODING_SCHEME should set in accordance with the LUCENE_USE_X macro set here
-// You should probably use streaming vbyte, by defining LUCENE_USE_STREAMVBYTE and setting LUCENE_ENCODING_SCHEME to streamvbyte
-// It's not the default here because you may have Lucene indices created alread using Lucene codec and PFOR encoding scheme.
-
-#if 0
-// Faster than both PFOR and masked vbyte
-// https://github.com/lemire/streamvbyte and https://lemire.me/blog/2017/09/27/stream-vbyte-breaking-new-speed-records-for-integer-compression/
-// Results in larger indices compared to pfor though
-#define LUCENE_USE_STREAMVBYTE 1
-#elif 0
-// Slower than both PFOR and streaming vbyte
-// http://maskedvbyte.org
-#define LUCENE_USE_MASKEDVBYTE 1
-#else
-// Smaller indices in terms of size, but slower than stream vbyte
-// https://github.com/lemire/FastPFor
+// The integers encoding scheme is selected at runtime, per IndexSession(see IntsEncoding), and recorded in the segment's codec identifier
+// so that the AccessProxy knows how to decode it. FastPFor is always available. Streaming vbyte and masked vbyte are available if
+// LUCENE_HAVE_STREAMVBYTE and LUCENE_HAVE_MASKEDVBYTE are defined respectively (see Makefile's LUCENE_ENCODING_SCHEMES)
+//
+// FastPFor: smaller indices in terms of size, but slower than stream vbyte (https://github.com/lemire/FastPFor)
+// StreamVByte: faster than both PFOR and masked vbyte, but results in larger indices compared to pfor
+// 	https://github.com/lemire/streamvbyte and https://lemire.me/blog/2017/09/27/stream-vbyte-breaking-new-speed-records-for-integer-compression/
+// MaskedVByte: slower than both PFOR and streaming vbyte (http://maskedvbyte.org)
+#include <atomic>
 #include <ext/FastPFor/headers/fastpfor.h>
-#define LUCENE_USE_FASTPFOR 1
-#endif
-
-
+#include <ext/flat_hash_map.h>
+#include <mutex>
 
 namespace Trinity
 {
@@ -41,19 +33,113 @@ namespace Trinity
 //#define LUCENE_ENCODE_FREQ1_DOCDELTA 1
 
 
-#ifdef LUCENE_USE_MASKEDVBYTE
-                        static constexpr size_t BLOCK_SIZE{64};
-#else
                         static constexpr size_t BLOCK_SIZE{128};
-#endif
                         static constexpr size_t SKIPLIST_STEP{1}; // every (SKIPLIST_STEP * BLOCK_SIZE) documents
 
+                        // Skiplist entries also carry block-max metadata (blockLastDocID, blockMaxFreq), except in segments encoded before that was
+                        // supported(legacy layout). The layout is recorded in the segment's codec identifier(see codec_identifier_for()), so that all chunks of
+                        // a segment share it. We can still access legacy segments; we just can't provide block-max upper bounds for them.
+                        static constexpr size_t skiplist_entry_size(const bool blockMax) noexcept
+                        {
+                                return blockMax
+                                           ? sizeof(uint32_t) * 6 + sizeof(uint16_t) * 2
+                                           : sizeof(uint32_t) * 5 + sizeof(uint16_t);
+                        }
+
+                        // Term chunk header: u32 hitsDataOffset, u32 sumHits, u32 positionsChunkSize, u16 skiplistSize, followed by, unless it's a
+                        // legacy layout chunk, u16 maxFreq: the highest freq of any document in the chunk(saturated; see Decoder::max_freq())
+                        static constexpr size_t chunk_header_size(const bool blockMax) noexcept
+                        {
+                                return sizeof(uint32_t) * 3 + sizeof(uint16_t) + (blockMax ? sizeof(uint16_t) : 0);
+                        }
+
+                        enum class IntsEncoding : uint8_t
+                        {
+                                FastPFor = 0,
+                                StreamVByte,
+                                MaskedVByte
+                        };
+
+                        // Legacy layout segments were all identified as "LUCENE", whichever encoding they were built with(it was selected at
+                        // compile time), so we can't tell from the segment; see Makefile's LUCENE_LEGACY_ENCODING_SCHEME
+#if defined(LUCENE_LEGACY_STREAMVBYTE)
+                        static constexpr IntsEncoding LEGACY_ENCODING{IntsEncoding::StreamVByte};
+#elif defined(LUCENE_LEGACY_MASKEDVBYTE)
+                        static constexpr IntsEncoding LEGACY_ENCODING{IntsEncoding::MaskedVByte};
+#else
+                        static constexpr IntsEncoding LEGACY_ENCODING{IntsEncoding::FastPFor};
+#endif
+
+                        inline strwlen8_t codec_identifier_for(const IntsEncoding e, const bool blockMax = true) noexcept
+                        {
+                                if (!blockMax)
+                                        return "LUCENE"_s8;
+
+                                switch (e)
+                                {
+                                        case IntsEncoding::StreamVByte:
+                                                return "LUCENE2_STREAMVBYTE"_s8;
+
+                                        case IntsEncoding::MaskedVByte:
+                                                return "LUCENE2_MASKEDVBYTE"_s8;
+
+                                        default:
+                                                return "LUCENE2"_s8;
+                                }
+                        }
+
+                        // Returns false if `id` is not a Lucene codec identifier
+                        inline bool encoding_for_codec_identifier(const strwlen8_t id, IntsEncoding *const e, bool *const blockMax) noexcept
+                        {
+                                *blockMax = true;
+                                if (id.Eq(_S("LUCENE2")))
+                                        *e = IntsEncoding::FastPFor;
+                                else if (id.Eq(_S("LUCENE2_STREAMVBYTE")))
+                                        *e = IntsEncoding::StreamVByte;
+                                else if (id.Eq(_S("LUCENE2_MASKEDVBYTE")))
+                                        *e = IntsEncoding::MaskedVByte;
+                                else if (id.Eq(_S("LUCENE")))
+                                {
+                                        *e = LEGACY_ENCODING;
+                                        *blockMax = false;
+                                }
+                                else
+                                        return false;
+
+                                return true;
+                        }
+
+                        constexpr bool encoding_available(const IntsEncoding e) noexcept
+                        {
+                                switch (e)
+                                {
+                                        case IntsEncoding::FastPFor:
+                                                return true;
+
+                                        case IntsEncoding::StreamVByte:
+#ifdef LUCENE_HAVE_STREAMVBYTE
+                                                return true;
+#else
+                                                return false;
+#endif
+
+                                        case IntsEncoding::MaskedVByte:
+#ifdef LUCENE_HAVE_MASKEDVBYTE
+                                                return true;
+#else
+                                                return false;
+#endif
+
+                                        default:
+                                                return false;
+                                }
+                        }
+
                         struct IndexSession final
                             : public Trinity::Codecs::IndexSession
                         {
-#ifdef LUCENE_USE_FASTPFOR
                                 FastPForLib::FastPFor<4> forUtil; // handy for merge()
-#endif
+                                const IntsEncoding encoding;
 
 
                                 // TODO: support for periodic flushing
@@ -66,9 +152,11 @@ namespace Trinity
                                 // private
                                 void flush_positions_data();
 
-                                IndexSession(const char *bp)
-                                    : Trinity::Codecs::IndexSession{bp, unsigned(Capabilities::AppendIndexChunk) | unsigned(Capabilities::Merge)}, positionsOutFlushed{0}, positionsOutFd{-1}, flushFreq{0}
+                                IndexSession(const char *bp, const IntsEncoding e = IntsEncoding::FastPFor)
+                                    : Trinity::Codecs::IndexSession{bp, unsigned(Capabilities::AppendIndexChunk) | unsigned(Capabilities::Merge) | unsigned(Capabilities::ParallelEncoding)}, encoding{e}, positionsOutFlushed{0}, positionsOutFd{-1}, flushFreq{0}
                                 {
+                                        if (!encoding_available(e))
+                                                throw Switch::data_error("Lucene codec integers encoding not available in this build");
                                 }
 
                                 ~IndexSession()
@@ -90,12 +178,19 @@ namespace Trinity
 
                                 strwlen8_t codec_identifier() override final
                                 {
-                                        return "LUCENE"_s8;
+                                        return codec_identifier_for(encoding);
                                 }
 
                                 range32_t append_index_chunk(const Trinity::Codecs::AccessProxy *, const term_index_ctx srcTCTX) override final;
 
                                 void merge(merge_participant *, const uint16_t, Trinity::Codecs::Encoder *) override final;
+
+                                Trinity::Codecs::IndexSession *new_private_session() override final
+                                {
+                                        return new IndexSession(basePath, encoding);
+                                }
+
+                                void append_private_session(Trinity::Codecs::IndexSession *, term_index_ctx *, const size_t) override final;
                         };
 
                         class Encoder final
@@ -114,6 +209,10 @@ namespace Trinity
                                         uint32_t totalDocumentsSoFar;
                                         uint32_t lastHitsBlockTotalHits;
                                         uint16_t curHitsBlockHits;
+                                        // block-max metadata
+                                        // last document ID in this block, and max. freq of all documents in the block
+                                        isrc_docid_t blockLastDocID;
+                                        tokenpos_t blockMaxFreq;
                                 };
 
                               private:
@@ -121,12 +220,11 @@ namespace Trinity
                                 isrc_docid_t lastDocID;
                                 uint32_t docDeltas[BLOCK_SIZE], docFreqs[BLOCK_SIZE], hitPayloadSizes[BLOCK_SIZE], hitPosDeltas[BLOCK_SIZE];
                                 uint32_t buffered, totalHits, sumHits;
-                                uint32_t termDocuments;
+                                uint32_t termDocuments, termMaxFreq;
                                 tokenpos_t lastPosition;
                                 uint32_t termIndexOffset, termPositionsOffset;
-#ifdef LUCENE_USE_FASTPFOR
                                 FastPForLib::FastPFor<4> forUtil;
-#endif
+                                const IntsEncoding encoding;
                                 IOBuffer payloadsBuf;
                                 uint32_t skiplistCountdown, lastHitsBlockOffset, lastHitsBlockTotalHits;
                                 skiplist_entry cur_block;
@@ -136,7 +234,7 @@ namespace Trinity
 
                               public:
                                 Encoder(Trinity::Codecs::IndexSession *s)
-                                    : Trinity::Codecs::Encoder{s}
+                                    : Trinity::Codecs::Encoder{s}, encoding{static_cast<Trinity::Codecs::Lucene::IndexSession *>(s)->encoding}
                                 {
                                 }
 
@@ -156,22 +254,87 @@ namespace Trinity
                                 void end_term(term_index_ctx *tctx) override final;
                         };
 
+                        // A decoded skiplist entry. See Decoder::init_skiplist()
+                        struct decoded_skiplist_entry final
+                        {
+                                uint32_t indexOffset;
+                                isrc_docid_t lastDocID;
+                                uint32_t lastHitsBlockOffset;
+                                uint32_t totalDocumentsSoFar;
+                                uint32_t totalHitsSoFar;
+                                uint16_t curHitsBlockHits;
+                                isrc_docid_t blockLastDocID;
+                                tokenpos_t blockMaxFreq;
+                        };
+
+                        // Decoding a term's skiplist requires an allocation and a pass over all its entries, and
+                        // we 'd otherwise pay for that for every decoder of that term, i.e for every query that involves it.
+                        // This is a bounded, thread-safe cache of decoded skiplists, keyed by the term's index chunk offset, shared by all decoders
+                        // created by an AccessProxy. It is partitioned into shards, each with its own lock, to keep contention low.
+                        // When a shard is full, arbitrary entries are evicted; hot terms' skiplists will be cached again soon enough.
+                        class skiplists_cache final
+                        {
+                              public:
+                                using skiplist_ref = std::shared_ptr<decoded_skiplist_entry[]>;
+
+                              private:
+                                static constexpr size_t SHARDS{16};
+
+                                struct shard final
+                                {
+                                        std::mutex lock;
+                                        ska::flat_hash_map<uint32_t, std::pair<skiplist_ref, uint16_t>> map;
+                                        size_t entries{0};
+                                } shards[SHARDS];
+
+                                // in skiplist entries
+                                std::atomic<size_t> shardCapacity;
+
+                              public:
+                                std::atomic<uint64_t> hits{0}, misses{0};
+
+                              public:
+                                skiplists_cache(const size_t capacity)
+                                    : shardCapacity{capacity / SHARDS}
+                                {
+                                }
+
+                                // capacity is in skiplist entries (sizeof(decoded_skiplist_entry) each); 0 disables the cache
+                                void set_capacity(const size_t capacity);
+
+                                // Returns nullptr if not cached
+                                skiplist_ref get(const uint32_t key);
+
+                                // Returns the cached skiplist for key, which may be another skiplist inserted by another thread since we get()
+                                skiplist_ref insert(const uint32_t key, skiplist_ref s, const uint16_t size);
+                        };
+
                         struct AccessProxy final
                             : public Trinity::Codecs::AccessProxy
                         {
                                 const uint8_t *hitsDataPtr;
 				uint64_t hitsDataSize{0};
+                                const IntsEncoding encoding;
+                                // false for legacy layout segments; see skiplist_entry_size()
+                                const bool blockMax;
+                                // ~16MBs worth of decoded skiplists by default
+                                skiplists_cache skiplists{512 * 1024};
 
-                                AccessProxy(const char *bp, const uint8_t *p, const uint8_t *hd = nullptr);
+                                AccessProxy(const char *bp, const uint8_t *p, const uint8_t *hd = nullptr, const IntsEncoding e = IntsEncoding::FastPFor, const bool bm = true);
 
 				~AccessProxy();
 
                                 strwlen8_t codec_identifier() override final
                                 {
-                                        return "LUCENE"_s8;
+                                        return codec_identifier_for(encoding, blockMax);
                                 }
 
                                 Trinity::Codecs::Decoder *new_decoder(const term_index_ctx &tctx) override final;
+
+                                cache_stats decoders_cache_stats() const override final
+                                {
+                                        return {skiplists.hits.load(std::memory_order_relaxed), skiplists.misses.load(std::memory_order_relaxed)};
+                                }
                         };
 
                         class Decoder;
@@ -185,16 +348,27 @@ namespace Trinity
                                 const uint8_t *p;
                                 const uint8_t *hdp;
                                 const uint8_t *payloadsIt, *payloadsEnd;
+                                // last document ID of the currently decoded block; the base for the next block
                                 isrc_docid_t lastDocID;
                                 uint32_t lastPosition{0};
                                 uint32_t docsLeft, hitsLeft;
                                 uint16_t docsIndex, hitsIndex;
                                 uint16_t bufferedDocs, bufferedHits;
                                 uint32_t skippedHits;
-                                uint32_t docDeltas[BLOCK_SIZE], docFreqs[BLOCK_SIZE], hitsPositionDeltas[BLOCK_SIZE], hitsPayloadLengths[BLOCK_SIZE];
+                                // absolute document IDs; see refill_documents()
+                                isrc_docid_t docIDs[BLOCK_SIZE];
+                                uint32_t docFreqs[BLOCK_SIZE], hitsPositionDeltas[BLOCK_SIZE], hitsPayloadLengths[BLOCK_SIZE];
                                 uint32_t skipListIdx;
                                 isrc_docid_t curSkipListLastDocID{DocIDsEND};
 
+                                // see advance_shallow()
+                                struct
+                                {
+                                        uint32_t idx{0};
+                                        isrc_docid_t blockLastDocID{0};
+                                        tokenpos_t blockMaxFreq{std::numeric_limits<tokenpos_t>::max()};
+                                } shallow;
+
                               public:
                                 inline isrc_docid_t next() override final;
 
@@ -202,6 +376,15 @@ namespace Trinity
 
                                 inline void materialize_hits(DocWordsSpace *dwspace, term_hit *out) override final;
 
+                                inline isrc_docid_t advance_shallow(const isrc_docid_t) override final;
+
+                                inline uint32_t next_block(isrc_docid_t *, tokenpos_t *, const uint32_t, const isrc_docid_t) override final;
+
+                                tokenpos_t block_max_freq() override final
+                                {
+                                        return shallow.blockMaxFreq;
+                                }
+
                                 PostingsListIterator(Decoder *const d)
                                     : Trinity::Codecs::PostingsListIterator{reinterpret_cast<Trinity::Codecs::Decoder *>(d)}
                                 {
@@ -215,22 +398,18 @@ namespace Trinity
 
                               private:
                                 // Pretty much the only shared state among iterators created by
-                                // this decoder is the skiplist, which may be initialized once and owned by the Decoder.
-                                struct skiplist_entry final
-                                {
-                                        uint32_t indexOffset;
-                                        isrc_docid_t lastDocID;
-                                        uint32_t lastHitsBlockOffset;
-                                        uint32_t totalDocumentsSoFar;
-                                        uint32_t totalHitsSoFar;
-                                        uint16_t curHitsBlockHits;
-                                };
+                                // this decoder is the skiplist, which may be initialized once and shared with other decoders(see skiplists_cache)
+                                using skiplist_entry = decoded_skiplist_entry;
 
                               protected:
                                 void next(PostingsListIterator *);
 
                                 void advance(PostingsListIterator *, const isrc_docid_t);
 
+                                void advance_shallow(PostingsListIterator *, const isrc_docid_t);
+
+                                uint32_t next_block(PostingsListIterator *, isrc_docid_t *, tokenpos_t *, const uint32_t, const isrc_docid_t);
+
                                 void materialize_hits(PostingsListIterator *, DocWordsSpace *, term_hit *);
 
                               private:
@@ -238,23 +417,19 @@ namespace Trinity
 #ifdef LUCENE_LAZY_SKIPLIST_INIT
                                 uint16_t skiplistSize;
 #endif
+                                bool skiplistBlockMax;
+                                tokenpos_t maxFreq;
+                                IntsEncoding encoding;
 
-#ifdef LUCENE_USE_FASTPFOR
                                 FastPForLib::FastPFor<4> forUtil;
-#endif
 
                                 struct skiplist_struct
                                 {
-                                        skiplist_entry *data;
+                                        const skiplist_entry *data;
                                         uint16_t size{0};
-
-                                        ~skiplist_struct()
-                                        {
-                                                if (size)
-                                                        std::free(data);
-                                        }
-
+                                        skiplists_cache::skiplist_ref owner;
                                 } skiplist;
+                                skiplists_cache *skiplistsCache;
                                 const uint8_t *postingListBase, *hitsBase;
                                 uint32_t totalDocuments, totalHits;
 
@@ -272,7 +447,7 @@ namespace Trinity
                                         const auto docsIndex{it->docsIndex};
                                         auto &curDocument{it->curDocument};
 
-                                        curDocument.id = it->lastDocID + it->docDeltas[docsIndex];
+                                        curDocument.id = it->docIDs[docsIndex];
                                         it->freq = it->docFreqs[docsIndex];
                                 }
 
@@ -289,6 +464,11 @@ namespace Trinity
                                 void init(const term_index_ctx &tctx, Trinity::Codecs::AccessProxy *access) override final;
 
                                 Trinity::Codecs::PostingsListIterator *new_iterator() override final;
+
+                                tokenpos_t max_freq() const noexcept override final
+                                {
+                                        return maxFreq;
+                                }
                         };
 
                         isrc_docid_t PostingsListIterator::next()
@@ -297,6 +477,11 @@ namespace Trinity
                                 return curDocument.id;
                         }
 
+                        uint32_t PostingsListIterator::next_block(isrc_docid_t *const out, tokenpos_t *const freqs, const uint32_t max, const isrc_docid_t upto)
+                        {
+                                return static_cast<Codecs::Lucene::Decoder *>(dec)->next_block(this, out, freqs, max, upto);
+                        }
+
                         isrc_docid_t PostingsListIterator::advance(const isrc_docid_t target)
                         {
                                 static_cast<Codecs::Lucene::Decoder *>(dec)->advance(this, target);
@@ -307,6 +492,13 @@ namespace Trinity
                         {
                                 static_cast<Codecs::Lucene::Decoder *>(dec)->materialize_hits(this, dwspace, out);
                         }
+
+                        isrc_docid_t PostingsListIterator::advance_shallow(const isrc_docid_t target)
+                        {
+                                if (target > shallow.blockLastDocID)
+                                        static_cast<Codecs::Lucene::Decoder *>(dec)->advance_shallow(this, target);
+                                return shallow.blockLastDocID;
+                        }
                 }
         }
 }
@@ -0,0 +1,199 @@
+#include "memory_index_source.h"
+#include "merge.h"
+
+Trinity::InMemoryIndexSource::InMemoryIndexSource(const uint64_t generation, SegmentIndexSession *const s)
+    : sess{""}
+{
+        std::vector<std::pair<isrc_docid_t, uint8_t>> docNorms;
+
+        gen = generation;
+        s->commit_in_memory(&sess, &termsAllocator, &terms, &updatedDocumentIDs, &defaultFieldStats, &docNorms);
+        norms = build_norms(docNorms, &normsValues);
+
+        // sorted, so that we can binary search and merge runs
+        std::sort(terms.begin(), terms.end(), [](const auto &a, const auto &b) noexcept {
+                return terms_cmp(a.first.data(), a.first.size(), b.first.data(), b.first.size()) < 0;
+        });
+
+        accessProxy.reset(new Trinity::Codecs::Google::AccessProxy(sess.basePath, reinterpret_cast<const uint8_t *>(sess.indexOut.data())));
+
+        if (updatedDocumentIDs.size())
+        {
+                // pack_updates() sorts and dedups the IDs; keep our own copy intact for flush()
+                std::vector<docid_t> v(updatedDocumentIDs.begin(), updatedDocumentIDs.end());
+
+                pack_updates(v, &maskedDocumentsBuf);
+                new (&maskedDocuments) updated_documents(unpack_updates({reinterpret_cast<const uint8_t *>(maskedDocumentsBuf.data()), maskedDocumentsBuf.size()}));
+        }
+}
+
+Trinity::term_index_ctx Trinity::InMemoryIndexSource::resolve_term_ctx(const str8_t term)
+{
+        const auto it = std::lower_bound(terms.begin(), terms.end(), term, [](const auto &a, const str8_t t) noexcept {
+                return terms_cmp(a.first.data(), a.first.size(), t.data(), t.size()) < 0;
+        });
+
+        if (it != terms.end() && it->first.Eq(term.data(), term.size()))
+                return it->second;
+        else
+                return {};
+}
+
+Trinity::InMemoryIndex::~InMemoryIndex()
+{
+        for (auto it : runs)
+                it->Release();
+        for (auto it : flushed)
+                it->Release();
+}
+
+uint64_t Trinity::InMemoryIndex::next_generation()
+{
+        std::lock_guard<std::mutex> g(lock);
+
+        lastGen = std::max<uint64_t>(Timings::Microseconds::SysTime(), lastGen + 1);
+        return lastGen;
+}
+
+bool Trinity::InMemoryIndex::refresh()
+{
+        static constexpr bool trace{false};
+
+        if (!pending->any_indexed())
+                return false;
+
+        const auto before = Timings::Microseconds::Tick();
+        std::unique_ptr<SegmentIndexSession> s(pending.release());
+
+        pending.reset(new SegmentIndexSession());
+
+        auto run = new InMemoryIndexSource(next_generation(), s.get());
+
+        if (trace)
+                SLog(duration_repr(Timings::Microseconds::Since(before)), " to refresh, run ", run->generation(), " ", dotnotation_repr(run->footprint()), " bytes\n");
+
+        std::lock_guard<std::mutex> g(lock);
+
+        runs.push_back(run);
+        return true;
+}
+
+void Trinity::InMemoryIndex::snapshot(IndexSourcesCollection *const c)
+{
+        std::lock_guard<std::mutex> g(lock);
+
+        for (auto it : flushed)
+                c->insert(it);
+        for (auto it : runs)
+                c->insert(it);
+}
+
+Trinity::SegmentIndexSource *Trinity::InMemoryIndex::flush(Trinity::Codecs::IndexSession *const sess)
+{
+        static constexpr bool trace{false};
+        std::vector<InMemoryIndexSource *> all;
+        strwlen32_t bp(sess->basePath);
+
+        bp.StripTrailingCharacter('/');
+        if (auto p = bp.SearchR('/'))
+                bp = bp.SuffixFrom(p + 1);
+
+        if (!bp.IsDigits())
+                throw Switch::data_error("Expected segment name to be a generation(digits)");
+
+        const auto segmentGen = bp.AsUint64();
+
+        {
+                std::lock_guard<std::mutex> g(lock);
+
+                for (auto it : runs)
+                {
+                        if (it->generation() >= segmentGen)
+                                throw Switch::data_error("Segment generation must be higher than that of all runs");
+
+                        it->Retain();
+                        all.push_back(it);
+                }
+        }
+
+        if (all.empty())
+                return nullptr;
+
+        Defer({
+                for (auto it : all)
+                        it->Release();
+        });
+
+        const auto before = Timings::Microseconds::Tick();
+        MergeCandidatesCollection collection;
+        std::vector<std::unique_ptr<IndexSourceTermsView>> views;
+        std::vector<isrc_docid_t> updatedDocumentIDs;
+        std::vector<std::pair<str8_t, term_index_ctx>> terms;
+        std::vector<std::pair<isrc_docid_t, uint8_t>> norms;
+        simple_allocator allocator;
+        IndexSource::field_statistics fs;
+
+        for (auto it : all)
+        {
+                views.emplace_back(new InMemoryIndexSource::terms_view(it->terms));
+                collection.insert({it->generation(), views.back().get(), it->accessProxy.get(), it->maskedDocuments, it->norms});
+                updatedDocumentIDs.insert(updatedDocumentIDs.end(), it->updatedDocumentIDs.begin(), it->updatedDocumentIDs.end());
+        }
+
+        collection.commit();
+        sess->begin();
+        // Chunks copied as is(append_index_chunk()) or merged by the codec are not accounted for in fs, so we disable that; see MergeCandidatesCollection::merge()
+        collection.merge(sess, &allocator, &terms, &fs, 0, true);
+        fs.docsCnt = collection.merge_norms(&norms);
+
+        // Documents updated in any run need to be masked in all older sources
+        std::sort(updatedDocumentIDs.begin(), updatedDocumentIDs.end());
+        updatedDocumentIDs.erase(std::unique(updatedDocumentIDs.begin(), updatedDocumentIDs.end()), updatedDocumentIDs.end());
+
+        sess->persist_terms(terms);
+        persist_norms(sess->basePath, norms);
+        persist_segment(fs, sess, updatedDocumentIDs);
+
+        auto segment = new SegmentIndexSource(sess->basePath);
+
+        if (trace)
+                SLog(duration_repr(Timings::Microseconds::Since(before)), " to flush ", all.size(), " runs to ", sess->basePath, "\n");
+
+        std::lock_guard<std::mutex> g(lock);
+
+        // runs created after we began flushing are retained
+        runs.erase(std::remove_if(runs.begin(), runs.end(), [&all](auto it) {
+                           if (std::find(all.begin(), all.end(), it) == all.end())
+                                   return false;
+
+                           it->Release();
+                           return true;
+                   }),
+                   runs.end());
+
+        segment->Retain();
+        flushed.push_back(segment);
+        lastGen = std::max(lastGen, segmentGen);
+        return segment;
+}
+
+void Trinity::InMemoryIndex::forget(IndexSource *const segment)
+{
+        std::lock_guard<std::mutex> g(lock);
+
+        if (auto it = std::find(flushed.begin(), flushed.end(), segment); it != flushed.end())
+        {
+                (*it)->Release();
+                flushed.erase(it);
+        }
+}
+
+size_t Trinity::InMemoryIndex::footprint()
+{
+        std::lock_guard<std::mutex> g(lock);
+        size_t sum{0};
+
+        for (auto it : runs)
+                sum += it->footprint();
+        return sum;
+}
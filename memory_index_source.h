@@ -0,0 +1,172 @@
+// Memory resident index sources, for near real-time search
+//
+// IndexSource caches term_index_ctx for the lifetime of the source (see IndexSource::term_ctx()), and
+// IndexSourcesCollection::commit() snapshots each source's masked documents, so sources must be immutable.
+// Instead of mutating a source in-place, InMemoryIndex indexes documents into a pending SegmentIndexSession, and every refresh()
+// encodes them into a new, immutable InMemoryIndexSource (a `run`), with a higher generation than any other run.
+// Documents become searchable as soon as they are refresh()ed, without having to persist a segment to disk; you
+// should refresh() every few milliseconds or so, depending on how soon you need indexed documents to be visible.
+//
+// Once the runs consume too much memory, or you want them to be durable, flush() merges them into a new segment.
+#pragma once
+#include "google_codec.h"
+#include "indexer.h"
+#include "segment_index_source.h"
+
+namespace Trinity
+{
+        // An immutable, memory resident index source
+        // The index is encoded with the Google codec into an in-memory buffer, and terms are kept sorted in a vector.
+        class InMemoryIndexSource final
+            : public IndexSource
+        {
+                friend class InMemoryIndex;
+
+              private:
+                field_statistics defaultFieldStats;
+                Trinity::Codecs::Google::IndexSession sess;
+                std::unique_ptr<Trinity::Codecs::Google::AccessProxy> accessProxy;
+                simple_allocator termsAllocator{4096};
+                std::vector<std::pair<str8_t, term_index_ctx>> terms;
+                std::vector<isrc_docid_t> updatedDocumentIDs;
+                IOBuffer maskedDocumentsBuf;
+                updated_documents maskedDocuments{};
+                std::vector<uint8_t> normsValues;
+                norms_view norms;
+
+              public:
+                // Used for merging runs
+                struct terms_view final
+                    : public IndexSourceTermsView
+                {
+                      private:
+                        const std::pair<str8_t, term_index_ctx> *it;
+                        const std::pair<str8_t, term_index_ctx> *const end;
+
+                      public:
+                        terms_view(const std::vector<std::pair<str8_t, term_index_ctx>> &v)
+                            : it{v.data()}, end{v.data() + v.size()}
+                        {
+                        }
+
+                        std::pair<str8_t, term_index_ctx> cur() override final
+                        {
+                                return *it;
+                        }
+
+                        void next() override final
+                        {
+                                ++it;
+                        }
+
+                        bool done() override final
+                        {
+                                return it == end;
+                        }
+                };
+
+              public:
+                // Encodes all documents indexed in s
+                InMemoryIndexSource(const uint64_t generation, SegmentIndexSession *s);
+
+                bool index_empty() const noexcept override final
+                {
+                        return terms.empty();
+                }
+
+                field_statistics default_field_stats() override final
+                {
+                        return defaultFieldStats;
+                }
+
+                term_index_ctx resolve_term_ctx(const str8_t term) override final;
+
+                Trinity::Codecs::Decoder *new_postings_decoder(const str8_t, const term_index_ctx ctx) override final
+                {
+                        return accessProxy->new_decoder(ctx);
+                }
+
+                updated_documents masked_documents() override final
+                {
+                        return maskedDocuments;
+                }
+
+                norms_view doc_norms() override final
+                {
+                        return norms;
+                }
+
+                uint8_t doc_norm(const isrc_docid_t id) override final
+                {
+                        return norms[id];
+                }
+
+                auto access_proxy() noexcept
+                {
+                        return accessProxy.get();
+                }
+
+                // Approximate memory used by the index and the terms
+                size_t footprint() const noexcept
+                {
+                        return sess.indexOut.size() + terms.size() * (sizeof(terms[0]) + 16) + normsValues.size();
+                }
+        };
+
+        // Manages the runs(InMemoryIndexSource) of a near real-time index
+        //
+        // There should be only one writer thread, which is responsible for indexing(see pending_session()) and invoking refresh() and flush().
+        // Any number of reader threads may snapshot() concurrently with the writer.
+        class InMemoryIndex final
+        {
+              private:
+                std::mutex lock;
+                std::vector<InMemoryIndexSource *> runs;
+                // Segments runs were flushed to; tracked until the application forget()s them, so
+                // that there is no window where neither the runs nor the segment are visible to snapshot()
+                std::vector<SegmentIndexSource *> flushed;
+                std::unique_ptr<SegmentIndexSession> pending;
+                uint64_t lastGen{0};
+
+              public:
+                InMemoryIndex()
+                    : pending(new SegmentIndexSession())
+                {
+                }
+
+                ~InMemoryIndex();
+
+                // Use the returned session to insert(), replace() or erase() documents
+                // The session is replaced on every refresh() so don't hold on to it
+                SegmentIndexSession *pending_session() noexcept
+                {
+                        return pending.get();
+                }
+
+                // Returns a generation higher than that of all runs created so far, and any future runs will be assigned a higher generation
+                // You should use it to name the segment you will flush() to
+                uint64_t next_generation();
+
+                // Makes all documents indexed since the last refresh() searchable
+                // Returns false if there was nothing to refresh
+                bool refresh();
+
+                // Inserts all runs and flushed segments into c
+                // You are expected to c->commit() afterwards
+                void snapshot(IndexSourcesCollection *c);
+
+                // Merges all runs into a new segment in sess->basePath, and replaces them with the new segment, which is returned
+                // (retained; you should Release() it when you are done with it)
+                //
+                // You should refresh() first if you want pending documents to be included. The segment's generation(i.e the name of
+                // sess->basePath) must be higher than that of all runs; see next_generation()
+                // Returns nullptr if there are no runs.
+                SegmentIndexSource *flush(Trinity::Codecs::IndexSession *sess);
+
+                // Stop tracking a flushed segment, presumably because the application is now tracking it
+                void forget(IndexSource *segment);
+
+                // Memory used by all runs
+                size_t footprint();
+        };
+}
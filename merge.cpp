@@ -1,7 +1,11 @@
 #include "merge.h"
 #include "docwordspace.h"
-#include <unordered_set>
+#include "executor.h"
+#include <chrono>
+#include <deque>
 #include <text.h>
+#include <thread>
+#include <unordered_set>
 
 void Trinity::MergeCandidatesCollection::commit()
 {
@@ -20,22 +24,124 @@ void Trinity::MergeCandidatesCollection::commit()
                 if (ud)
                         all.push_back(ud);
         }
+
+        merged.build(all.data(), all.size());
 }
 
 std::unique_ptr<Trinity::masked_documents_registry> Trinity::MergeCandidatesCollection::scanner_registry_for(const uint16_t idx)
 {
         const auto n = map[idx].second;
 
-        return masked_documents_registry::make(all.data(), n);
+        return merged.registry_for(all.data(), n);
+}
+
+
+uint32_t Trinity::MergeCandidatesCollection::merge_norms(std::vector<std::pair<isrc_docid_t, uint8_t>> *const out)
+{
+        const auto base = out->size();
+
+        // candidates are sorted by generation, most recent first, and persist_norms() keeps
+        // the last norm for each document, so we go from the oldest to the most recent, so that a more recent norm of a document(if not masked) wins
+        for (uint16_t i = candidates.size(); i--;)
+        {
+                const auto &norms = candidates[i].norms;
+
+                if (!norms)
+                        continue;
+
+                auto maskedDocumentsRegistry = scanner_registry_for(i);
+
+                for (uint32_t k{0}; k != norms.size; ++k)
+                {
+                        const isrc_docid_t id = norms.base + k;
+
+                        if (const auto norm = norms.data[k]; norm && !maskedDocumentsRegistry->test(id))
+                                out->push_back({id, norm});
+                }
+        }
+
+        // the same document may be unmasked in more than one candidate, so we count distinct documents
+        std::vector<isrc_docid_t> ids;
+
+        ids.reserve(out->size() - base);
+        for (auto i = base; i != out->size(); ++i)
+                ids.push_back((*out)[i].first);
+        std::sort(ids.begin(), ids.end());
+
+        return std::unique(ids.begin(), ids.end()) - ids.begin();
+}
+
+void Trinity::merge_throttle::charge(const uint64_t n)
+{
+        uint64_t wait;
+
+        {
+                std::lock_guard<std::mutex> g(lock);
+
+                if (!bytesPerSecond)
+                        return;
+
+                const uint64_t now = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+
+                next = std::max(next, now > MaxBurst ? now - MaxBurst : 0) + n * 1'000'000 / bytesPerSecond;
+                wait = next > now ? next - now : 0;
+        }
+
+        if (wait)
+                std::this_thread::sleep_for(std::chrono::microseconds(wait));
 }
 
+namespace // static/local this module
+{
+        // A term to be merged, and the candidates it was found in
+        struct merge_term final
+        {
+                Trinity::str8_t term;
+                // in merge_partition::sources
+                uint32_t sourcesOffset;
+                uint16_t sourcesCnt;
+                // all sources' codec is the output session's codec
+                bool fastPath;
+        };
+
+        struct merge_source final
+        {
+                // candidate index; see MergeCandidatesCollection::scanner_registry_for()
+                uint16_t idx;
+                Trinity::Codecs::AccessProxy *ap;
+                Trinity::term_index_ctx tctx;
+        };
+
+        // A range of consecutive terms(in lexicographic order), which is merged independently of all other ranges
+        struct merge_partition final
+        {
+                std::vector<merge_term> terms;
+                std::vector<merge_source> sources;
+                // sum of the sources' index chunks sizes
+                uint64_t inputBytes{0};
+
+                // The private session the terms were encoded into, unless they were encoded directly into the output session
+                std::unique_ptr<Trinity::Codecs::IndexSession> sess;
+                // Terms that were not dropped(i.e with 1+ documents not masked), and their term_index_ctx
+                std::vector<Trinity::str8_t> outTerms;
+                std::vector<Trinity::term_index_ctx> tctxs;
+                Trinity::IndexSource::field_statistics fs;
+        };
+}
 
 // Make sure you have commited first
 // Unlike with e.g SegmentIndexSession where the order of postlists in the index is based on our translation(term=>integer id) and the ascending order of that id
 // here the order will match the order the terms are found in `tersm`, because we perform a merge-sort and so we process terms in lexicograpphic order
-void Trinity::MergeCandidatesCollection::merge(Trinity::Codecs::IndexSession *is, simple_allocator *allocator, std::vector<std::pair<str8_t, Trinity::term_index_ctx>> *const terms, IndexSource::field_statistics *const defaultFieldStats, const uint32_t flushFreq, const bool disableOptimizations)
+//
+// Terms are independent of each other, so we split the terms space into ranges(partitions) of consecutive terms, and if the output codec supports
+// it(Capabilities::ParallelEncoding), each partition is merged into a private session on another thread, and private sessions are appended
+// to the output session in order, just like SegmentIndexSession::build_index() does.
+void Trinity::MergeCandidatesCollection::merge(Trinity::Codecs::IndexSession *is, simple_allocator *allocator, std::vector<std::pair<str8_t, Trinity::term_index_ctx>> *const terms, IndexSource::field_statistics *const defaultFieldStats, const uint32_t flushFreq, const bool disableOptimizations, merge_throttle *const throttle, Executor *const executor)
 {
         static constexpr bool trace{false};
+        // A partition is complete once its sources' chunks sum to that many bytes, or it has that many terms, whichever comes first
+        static constexpr uint64_t PartitionInputBytes{8 * 1024 * 1024};
+        static constexpr uint32_t PartitionTerms{64 * 1024};
 
         struct tracked_candidate
         {
@@ -72,109 +178,62 @@ void Trinity::MergeCandidatesCollection::merge(Trinity::Codecs::IndexSession *is
         uint16_t rem = all_.size();
         uint16_t toAdvance[rem];
         const auto isCODEC = is->codec_identifier();
-        DocWordsSpace dws{Limits::MaxPosition}; // dummy, for materialize_hits()
-        size_t termHitsCapacity{0};
-        term_hit *termHitsStorage{nullptr};
-        std::vector<Trinity::Codecs::IndexSession::merge_participant> mergeParticipants;
-        std::vector<std::pair<
-		std::pair<Trinity::Codecs::Decoder *, Trinity::Codecs::PostingsListIterator *>,
-			masked_documents_registry *>> decodersV;
-        term_index_ctx tctx;
-        std::unique_ptr<Trinity::Codecs::Encoder> enc(is->new_encoder());
 	// Only if it's implemented by the codec's IndexSession
         const bool haveAppendIndexChunk = (false == disableOptimizations) && (is->caps & unsigned(Codecs::IndexSession::Capabilities::AppendIndexChunk));
 	const bool haveMerge = (false == disableOptimizations) && (is->caps & unsigned(Codecs::IndexSession::Capabilities::Merge));
-
-        Defer(
-            {
-                    if (termHitsStorage)
-                            std::free(termHitsStorage);
-            });
-
-        for (;;)
-        {
-                uint8_t toAdvanceCnt{1};
-                const auto pair = all[0].candidate.terms->cur();
-                auto selected{pair};
-                auto codec = all[0].candidate.ap->codec_identifier();
-                bool sameCODEC{true};
-
-                toAdvance[0] = 0;
-                for (uint16_t i{1}; i != rem; ++i)
+        const bool parallel = is->caps & unsigned(Codecs::IndexSession::Capabilities::ParallelEncoding);
+        // index bytes output, when we last charged the throttle
+        uint64_t charged = is->indexOutFlushed + is->indexOut.size();
+
+        // Encodes all terms of the partition using enc(an encoder of sess), and tracks the terms that were not dropped in p->outTerms and p->tctxs
+        // This may be invoked concurrently for different partitions, each with its own session
+        const auto encode = [this, haveAppendIndexChunk, haveMerge](Trinity::Codecs::IndexSession *const sess, Trinity::Codecs::Encoder *const enc, merge_partition *const p) {
+                DocWordsSpace dws{Limits::MaxPosition}; // dummy, for materialize_hits()
+                size_t termHitsCapacity{0};
+                term_hit *termHitsStorage{nullptr};
+                std::vector<Trinity::Codecs::IndexSession::merge_participant> mergeParticipants;
+                std::vector<std::pair<
+                    std::pair<Trinity::Codecs::Decoder *, Trinity::Codecs::PostingsListIterator *>,
+                    masked_documents_registry *>>
+                    decodersV;
+                term_index_ctx tctx;
+                auto *const defaultFieldStats = &p->fs;
+
+                Defer(
+                    {
+                            if (termHitsStorage)
+                                    std::free(termHitsStorage);
+                    });
+
+                const auto track = [p](const str8_t outTerm, const term_index_ctx tctx) {
+                        p->outTerms.push_back(outTerm);
+                        p->tctxs.push_back(tctx);
+                        ++(p->fs.totalTerms);
+                };
+
+                for (const auto &t : p->terms)
                 {
-                        const auto pair = all[i].candidate.terms->cur();
-                        const auto r = terms_cmp(pair.first.data(), pair.first.size(), selected.first.data(), selected.first.size());
+                        const auto sources = p->sources.data() + t.sourcesOffset;
+                        const auto outTerm = t.term;
 
-                        if (r < 0)
-                        {
-                                toAdvanceCnt = 1;
-                                toAdvance[0] = i;
-                                selected = pair;
-                                sameCODEC = true;
-                                codec = all[i].candidate.ap->codec_identifier();
-                        }
-                        else if (r == 0)
+                        if (t.sourcesCnt == 1)
                         {
-                                if (sameCODEC)
-                                {
-                                        auto c = all[i].candidate.ap->codec_identifier();
+                                const auto &c = sources[0];
+                                auto maskedDocsReg = scanner_registry_for(c.idx);
 
-                                        if (c != codec)
-                                                sameCODEC = false;
-                                }
-
-                                toAdvance[toAdvanceCnt++] = i;
-                        }
-                }
-
-                const str8_t outTerm(allocator->CopyOf(selected.first.data(), selected.first.size()), selected.first.size());
-              	[[maybe_unused]] const bool fastPath =  sameCODEC && codec == isCODEC;
-                static constexpr bool trace{false};
-                //const bool trace = selected.first.Eq(_S("ANNEX"));
-
-                if (trace)
-                        SLog("TERM [", selected.first, "], toAdvanceCnt = ", toAdvanceCnt, ", sameCODEC = ", sameCODEC, ", first = ", toAdvance[0], ", fastPath = ", fastPath, "\n");
-
-                if (toAdvanceCnt == 1)
-                {
-                        auto c = all[toAdvance[0]].candidate;
-                        auto maskedDocsReg = scanner_registry_for(all[toAdvance[0]].idx);
-
-                        if (fastPath && maskedDocsReg->empty() && haveAppendIndexChunk)
-                        {
-                                if (likely(selected.second.documents))
+                                if (t.fastPath && maskedDocsReg->empty() && haveAppendIndexChunk)
                                 {
                                         // See comments below for why this is possible
-                                        const auto chunk = is->append_index_chunk(c.ap, selected.second);
+                                        const auto chunk = sess->append_index_chunk(c.ap, c.tctx);
 
-                                        terms->push_back({outTerm, {selected.second.documents, chunk}});
-
-					++(defaultFieldStats->totalTerms);
-                                }
-                                else if (trace)
-                                        SLog("No documents\n");
-                        }
-                        else
-                        {
-                                if (unlikely(0 == selected.second.documents))
-                                {
-                                        // It's possible, however unlikely (check your implementation)
-                                        // that you have e.g indexed a term, but indexed no documents for that term
-                                        // in which case, it will be 0 documents.
-					//
-                                        // We will just skip this here altogether(doing the same for other branches)
-					//
-					// Note that SegmentIndexSession and this merge() method explicitly drop terms with no documents associated with them, so
-					// the only real way to get a term with no document is to use the various Trinity segment constructs directly.
-                                        if (trace)
-                                                Print("0 documents for TERM [", selected.first, "]\n");
+                                        track(outTerm, {c.tctx.documents, chunk});
                                 }
                                 else
                                 {
-                                        std::unique_ptr<Trinity::Codecs::Decoder> dec(c.ap->new_decoder(selected.second));
-					std::unique_ptr<Trinity::Codecs::PostingsListIterator> it(dec->new_iterator());
+                                        std::unique_ptr<Trinity::Codecs::Decoder> dec(c.ap->new_decoder(c.tctx));
+                                        std::unique_ptr<Trinity::Codecs::PostingsListIterator> it(dec->new_iterator());
 
-					it->next();
+                                        it->next();
                                         enc->begin_term();
 
                                         do
@@ -184,9 +243,6 @@ void Trinity::MergeCandidatesCollection::merge(Trinity::Codecs::IndexSession *is
 
                                                 require(docID != DocIDsEND); // sanity check
 
-						if (trace)
-							SLog("docID = ", docID, ", masked = ", maskedDocsReg->test(docID), "\n");
-
                                                 if (!maskedDocsReg->test(docID))
                                                 {
                                                         if (freq > termHitsCapacity)
@@ -225,176 +281,273 @@ void Trinity::MergeCandidatesCollection::merge(Trinity::Codecs::IndexSession *is
 						// in the index/other index session data files in between enc->begin_term() .. enc->end_term(), which could
 						// have been set even if no documents were indexed for this term.
 						// That's fine though -- will ignore them in a future merge op.
-                                                terms->push_back({outTerm, tctx});
-						++(defaultFieldStats->totalTerms);
+                                                track(outTerm, tctx);
 					}
-
-                                        if (trace)
-                                                SLog("Indexed Term\n");
                                 }
                         }
-                }
-                else
-                {
-                        if (fastPath && haveMerge)
+                        else if (t.fastPath && haveMerge)
                         {
                                 mergeParticipants.clear();
 
-                                for (uint16_t i{0}; i != toAdvanceCnt; ++i)
-                                {
-                                        const auto idx = toAdvance[i];
+                                for (uint16_t i{0}; i != t.sourcesCnt; ++i)
+                                        mergeParticipants.push_back({sources[i].ap, sources[i].tctx, scanner_registry_for(sources[i].idx).release()});
 
-                                        if (likely(all[idx].candidate.terms->cur().second.documents))
-                                        {
-                                                // See comments earliert for why this is possible
+                                enc->begin_term();
+                                sess->merge(mergeParticipants.data(), mergeParticipants.size(), enc);
+                                enc->end_term(&tctx);
 
-                                                mergeParticipants.push_back(
-                                                    {all[idx].candidate.ap,
-                                                     all[idx].candidate.terms->cur().second,
-                                                     scanner_registry_for(all[idx].idx).release()});
-                                        }
-                                        else if (trace)
-                                                SLog("No documents for candidate ", i, "\n");
-                                }
+                                if (tctx.documents)
+                                        track(outTerm, tctx);
 
-                                if (mergeParticipants.size())
-                                {
-                                        enc->begin_term();
-                                        is->merge(mergeParticipants.data(), mergeParticipants.size(), enc.get());
-                                        enc->end_term(&tctx);
-
-                                        if (tctx.documents)
-					{
-                                                terms->push_back({outTerm, tctx});
-						++(defaultFieldStats->totalTerms);
-					}
-
-                                        for (uint16_t i{0}; i != mergeParticipants.size(); ++i)
-                                                delete mergeParticipants[i].maskedDocsReg;
-                                }
+                                for (uint16_t i{0}; i != mergeParticipants.size(); ++i)
+                                        delete mergeParticipants[i].maskedDocsReg;
                         }
                         else
                         {
                                 // we got to merge-sort across different codecs and output to an encoder of a different, potentially, codec
-                                for (uint16_t i{0}; i != toAdvanceCnt; ++i)
+                                for (uint16_t i{0}; i != t.sourcesCnt; ++i)
                                 {
-                                        const auto idx = toAdvance[i];
+                                        auto dec = sources[i].ap->new_decoder(sources[i].tctx);
+                                        auto it = dec->new_iterator();
+                                        auto reg = scanner_registry_for(sources[i].idx).release();
 
-                                        if (likely(all[idx].candidate.terms->cur().second.documents))
-                                        {
-                                                // see earlier comments for why this is possible
-                                                auto ap = all[idx].candidate.ap;
-                                                auto dec = ap->new_decoder(all[idx].candidate.terms->cur().second);
-						auto it = dec->new_iterator();
-                                                auto reg = scanner_registry_for(all[idx].idx).release();
-
-                                                require(reg);
-						it->next();
-                                                decodersV.push_back({{dec, it}, reg});
-                                        }
-                                        else if (trace)
-                                                SLog("No documents for candidate ", i, "\n");
+                                        require(reg);
+                                        it->next();
+                                        decodersV.push_back({{dec, it}, reg});
                                 }
 
-                                if (uint16_t rem = decodersV.size())
+                                uint16_t rem = decodersV.size();
+                                auto decoders = decodersV.data();
+                                uint16_t toAdvance[128];
+
+                                require(sizeof_array(toAdvance) >= decodersV.size());
+
+                                // TODO: just use a Switch::priority_queue<>
+                                enc->begin_term();
+                                for (;;)
                                 {
-                                        auto decoders = decodersV.data();
-                                        uint16_t toAdvance[128];
+                                        uint16_t toAdvanceCnt{1};
+                                        auto lowestDID = decoders[0].first.second->curDocument.id;
 
-                                        require(sizeof_array(toAdvance) >= decodersV.size());
+                                        toAdvance[0] = 0;
+                                        for (uint16_t i{1}; i != rem; ++i)
+                                        {
+                                                const auto id = decoders[i].first.second->curDocument.id;
 
-					// TODO: just use a Switch::priority_queue<>
-                                        enc->begin_term();
-                                        for (;;)
+                                                if (id < lowestDID)
+                                                {
+                                                        lowestDID = id;
+                                                        toAdvanceCnt = 1;
+                                                        toAdvance[0] = i;
+                                                }
+                                                else if (id == lowestDID)
+                                                        toAdvance[toAdvanceCnt++] = i;
+                                        }
+
+                                        // always choose the first because they are always sorted by gen DESC
+                                        if (!decoders[toAdvance[0]].second->test(lowestDID))
                                         {
-                                                uint16_t toAdvanceCnt{1};
-                                                auto lowestDID = decoders[0].first.second->curDocument.id;
+                                                auto it = decoders[toAdvance[0]].first.second;
+                                                const auto freq = it->freq;
 
-                                                toAdvance[0] = 0;
-                                                for (uint16_t i{1}; i != rem; ++i)
+                                                if (freq > termHitsCapacity)
                                                 {
-                                                        const auto id = decoders[i].first.second->curDocument.id;
+                                                        if (termHitsStorage)
+                                                                std::free(termHitsStorage);
 
-                                                        if (id < lowestDID)
-                                                        {
-                                                                lowestDID = id;
-                                                                toAdvanceCnt = 1;
-                                                                toAdvance[0] = i;
-                                                        }
-                                                        else if (id == lowestDID)
-                                                                toAdvance[toAdvanceCnt++] = i;
+                                                        termHitsCapacity = freq + 128;
+                                                        termHitsStorage = (term_hit *)malloc(sizeof(term_hit) * termHitsCapacity);
                                                 }
 
-                                                // always choose the first because they are always sorted by gen DESC
-
-						if (trace)
-							SLog("Lowest = ", lowestDID, ", masked = ", decoders[toAdvance[0]].second->test(lowestDID), "\n");
+                                                enc->begin_document(lowestDID);
+                                                it->materialize_hits(&dws /* dummy */, termHitsStorage);
 
-                                                if (!decoders[toAdvance[0]].second->test(lowestDID))
+                                                for (uint32_t i{0}; i != freq; ++i)
                                                 {
-                                                        auto it = decoders[toAdvance[0]].first.second;
-                                                        const auto freq = it->freq;
+                                                        const auto &th = termHitsStorage[i];
+                                                        const auto bytes = (uint8_t *)&th.payload;
 
-                                                        if (freq > termHitsCapacity)
-                                                        {
-                                                                if (termHitsStorage)
-                                                                        std::free(termHitsStorage);
+                                                        enc->new_hit(th.pos, {bytes, th.payloadLen});
+                                                }
+                                                enc->end_document();
 
-                                                                termHitsCapacity = freq + 128;
-                                                                termHitsStorage = (term_hit *)malloc(sizeof(term_hit) * termHitsCapacity);
-                                                        }
+						++(defaultFieldStats->sumTermsDocs);
+						defaultFieldStats->sumTermHits +=  freq;
+                                        }
 
-                                                        enc->begin_document(lowestDID);
-                                                        it->materialize_hits(&dws /* dummy */, termHitsStorage);
+                                        do
+                                        {
+                                                const auto idx = toAdvance[--toAdvanceCnt];
+                                                auto it = decoders[idx].first.second;
 
-                                                        for (uint32_t i{0}; i != freq; ++i)
-                                                        {
-                                                                const auto &th = termHitsStorage[i];
-                                                                const auto bytes = (uint8_t *)&th.payload;
+                                                if (it->next() == DocIDsEND)
+                                                {
+							delete it;
+							delete decoders[idx].first.first;
+                                                        delete decoders[idx].second;
 
-                                                                enc->new_hit(th.pos, {bytes, th.payloadLen});
-                                                        }
-                                                        enc->end_document();
+                                                        if (!--rem)
+                                                                goto l10;
 
-							++(defaultFieldStats->sumTermsDocs);
-							defaultFieldStats->sumTermHits +=  freq;
+                                                        memmove(decoders + idx, decoders + idx + 1, (rem - idx) * sizeof(decoders[0]));
                                                 }
+                                        } while (toAdvanceCnt);
+                                }
 
-                                                do
-                                                {
-                                                        const auto idx = toAdvance[--toAdvanceCnt];
-                                                        auto it = decoders[idx].first.second;
+                        l10:
+                                decodersV.clear();
+                                enc->end_term(&tctx);
 
-                                                        if (it->next() == DocIDsEND)
-                                                        {
-								delete it;
-								delete decoders[idx].first.first;
-                                                                delete decoders[idx].second;
+                                if (tctx.documents)
+                                        track(outTerm, tctx);
+                        }
+                }
+        };
 
-                                                                if (!--rem)
-                                                                        goto l10;
+        // Tracks the terms of a partition that was merged, in order
+        const auto consume = [&](merge_partition *const p) {
+                if (p->sess)
+                        is->append_private_session(p->sess.get(), p->tctxs.data(), p->tctxs.size());
 
-                                                                memmove(decoders + idx, decoders + idx + 1, (rem - idx) * sizeof(decoders[0]));
-                                                        }
-                                                } while (toAdvanceCnt);
-                                        }
+                for (size_t i{0}; i != p->outTerms.size(); ++i)
+                        terms->push_back({p->outTerms[i], p->tctxs[i]});
 
-                                l10:
-                                        decodersV.clear();
-                                        enc->end_term(&tctx);
+                defaultFieldStats->sumTermHits += p->fs.sumTermHits;
+                defaultFieldStats->sumTermsDocs += p->fs.sumTermsDocs;
+                defaultFieldStats->totalTerms += p->fs.totalTerms;
 
-                                        if (tctx.documents)
-					{
-                                                terms->push_back({outTerm, tctx});
-						++(defaultFieldStats->totalTerms);
-					}
+                if (flushFreq && is->indexOut.size() > flushFreq)
+                {
+                        // TODO: support pending
+                }
+
+                // charge in large enough increments, so that we won't contend for the throttle's lock for every small partition
+                if (throttle)
+                {
+                        if (const uint64_t out = is->indexOutFlushed + is->indexOut.size(); out - charged >= 256 * 1024)
+                        {
+                                throttle->charge(out - charged);
+                                charged = out;
+                        }
+                }
+        };
+
+        // Partitions are appended in order, so a slow partition holds back those that follow it; bound how many of them may be pending
+        const size_t maxInFlight = std::max<size_t>(2, executor ? executor->concurrency() : std::thread::hardware_concurrency());
+        std::deque<std::pair<std::shared_ptr<merge_partition>, std::future<void>>> inFlight;
+        // maxInFlight already bounds its concurrency
+        task_group group(executor, 0);
+        std::unique_ptr<Trinity::Codecs::Encoder> enc;
+        auto partition = std::make_shared<merge_partition>();
+        const auto complete = [&](const bool last) {
+                if (partition->terms.empty())
+                        return;
+
+                if (!parallel || (last && inFlight.empty()))
+                {
+                        // encode directly into the output session; no need for a private session
+                        if (!enc)
+                                enc.reset(is->new_encoder());
+
+                        encode(is, enc.get(), partition.get());
+                        consume(partition.get());
+                }
+                else
+                {
+                        if (inFlight.size() == maxInFlight)
+                        {
+                                group.get(inFlight.front().second);
+                                consume(inFlight.front().first.get());
+                                inFlight.pop_front();
+                        }
+
+                        inFlight.push_back({partition, group.submit([&encode, is, p = partition]() {
+                                                    p->sess.reset(is->new_private_session());
+
+                                                    std::unique_ptr<Trinity::Codecs::Encoder> enc(p->sess->new_encoder());
+
+                                                    encode(p->sess.get(), enc.get(), p.get());
+                                            })});
+                }
+
+                partition = std::make_shared<merge_partition>();
+        };
+
+        for (;;)
+        {
+                uint8_t toAdvanceCnt{1};
+                const auto pair = all[0].candidate.terms->cur();
+                auto selected{pair};
+                auto codec = all[0].candidate.ap->codec_identifier();
+                bool sameCODEC{true};
+
+                toAdvance[0] = 0;
+                for (uint16_t i{1}; i != rem; ++i)
+                {
+                        const auto pair = all[i].candidate.terms->cur();
+                        const auto r = terms_cmp(pair.first.data(), pair.first.size(), selected.first.data(), selected.first.size());
+
+                        if (r < 0)
+                        {
+                                toAdvanceCnt = 1;
+                                toAdvance[0] = i;
+                                selected = pair;
+                                sameCODEC = true;
+                                codec = all[i].candidate.ap->codec_identifier();
+                        }
+                        else if (r == 0)
+                        {
+                                if (sameCODEC)
+                                {
+                                        auto c = all[i].candidate.ap->codec_identifier();
+
+                                        if (c != codec)
+                                                sameCODEC = false;
                                 }
+
+                                toAdvance[toAdvanceCnt++] = i;
                         }
                 }
 
-                if (flushFreq && is->indexOut.size() > flushFreq)
+                const bool fastPath = sameCODEC && codec == isCODEC;
+                merge_term t{{}, uint32_t(partition->sources.size()), 0, fastPath};
+
+                if (trace)
+                        SLog("TERM [", selected.first, "], toAdvanceCnt = ", toAdvanceCnt, ", sameCODEC = ", sameCODEC, ", first = ", toAdvance[0], ", fastPath = ", fastPath, "\n");
+
+                for (uint16_t i{0}; i != toAdvanceCnt; ++i)
                 {
-                        // TODO: support pending
+                        const auto idx = toAdvance[i];
+                        const auto tctx = all[idx].candidate.terms->cur().second;
+
+                        if (likely(tctx.documents))
+                        {
+                                partition->sources.push_back({all[idx].idx, all[idx].candidate.ap, tctx});
+                                partition->inputBytes += tctx.indexChunk.size();
+                                ++t.sourcesCnt;
+                        }
+                        else
+                        {
+                                // It's possible, however unlikely (check your implementation)
+                                // that you have e.g indexed a term, but indexed no documents for that term
+                                // in which case, it will be 0 documents.
+                                //
+                                // We will just skip this candidate here altogether, and the term if there are no candidates left
+                                //
+                                // Note that SegmentIndexSession and this merge() method explicitly drop terms with no documents associated with them, so
+                                // the only real way to get a term with no document is to use the various Trinity segment constructs directly.
+                                if (trace)
+                                        SLog("No documents for candidate ", i, "\n");
+                        }
+                }
+
+                if (t.sourcesCnt)
+                {
+                        t.term.Set(allocator->CopyOf(selected.first.data(), selected.first.size()), selected.first.size());
+                        partition->terms.push_back(t);
+
+                        if (partition->inputBytes >= PartitionInputBytes || partition->terms.size() >= PartitionTerms)
+                                complete(false);
                 }
 
                 do
@@ -412,7 +565,15 @@ void Trinity::MergeCandidatesCollection::merge(Trinity::Codecs::IndexSession *is
                         }
                 } while (toAdvanceCnt);
         }
-l1:;
+
+l1:
+        complete(true);
+
+        for (auto &it : inFlight)
+        {
+                group.get(it.second);
+                consume(it.first.get());
+        }
 }
 
 std::vector<std::pair<uint64_t, Trinity::MergeCandidatesCollection::IndexSourceRetention>>
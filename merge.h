@@ -1,5 +1,6 @@
 #pragma once
 #include "docidupdates.h"
+#include "executor.h"
 #include "terms.h"
 #include "index_source.h"
 
@@ -22,22 +23,59 @@ namespace Trinity
                 // see MergeCandidatesCollection::merge() impl.
                 updated_documents maskedDocuments;
 
+                // Documents norms of the index source (see IndexSource::doc_norms()), if any
+                // see MergeCandidatesCollection::merge_norms()
+                norms_view norms{};
+
                 merge_candidate &operator=(const merge_candidate &o)
                 {
                         gen = o.gen;
                         terms = o.terms;
                         ap = o.ap;
                         new (&maskedDocuments) updated_documents(o.maskedDocuments);
+                        norms = o.norms;
                         return *this;
                 }
         };
 
+        // Limits how fast merge() may output postings, so that background merges won't starve queries of I/O bandwidth
+        // A single instance may be shared by concurrent merges, in which case the limit applies to all of them.
+        class merge_throttle final
+        {
+              private:
+                // Allow for bursts of up to that many microseconds worth of bytes, i.e don't penalize merges that were idle for a while
+                static constexpr uint64_t MaxBurst{100'000};
+
+                std::mutex lock;
+                uint64_t bytesPerSecond;
+                // when we 'll be allowed to write again, in microseconds; see charge()
+                uint64_t next{0};
+
+              public:
+                // 0 for no limit
+                merge_throttle(const uint64_t bps = 0)
+                    : bytesPerSecond{bps}
+                {
+                }
+
+                void set_rate(const uint64_t bps)
+                {
+                        std::lock_guard<std::mutex> g(lock);
+
+                        bytesPerSecond = bps;
+                }
+
+                // Accounts for n more bytes written, and sleeps for as long as it takes to respect the limit
+                void charge(const uint64_t n);
+        };
+
         // See IndexSourcesCollection
         class MergeCandidatesCollection final
         {
               private:
                 std::vector<updated_documents> all;
                 std::vector<std::pair<merge_candidate, uint16_t>> map;
+                merged_updated_documents merged;
 
               public:
                 std::vector<merge_candidate> candidates;
@@ -71,7 +109,20 @@ namespace Trinity
 		// If you are going to use ExecFlags::AccumulatedScoreScheme, and your scorer depends on IndexSource::field_statistics, those are
 		// only computed, during merge, for terms that are not handled by append_index_chunk(), so you may want to disable it, so that
 		// statistics for those terms as well will be collected.
-                void merge(Codecs::IndexSession *outIndexSess, simple_allocator *, std::vector<std::pair<str8_t, term_index_ctx>> *const outTerms, IndexSource::field_statistics *fs, const uint32_t flushFreq = 0, const bool disableOptimizations = false);
+		//
+		// If throttle is provided, merge() will charge it for the postings it writes(see merge_throttle)
+		//
+		// If outIndexSess's codec supports Capabilities::ParallelEncoding, ranges of terms are merged concurrently into private sessions, using
+		// executor(see executor.h). You may want to use a dedicated executor for background merges, so that they won't compete with queries
+		// for the default Executor's workers(see MergeScheduler).
+                void merge(Codecs::IndexSession *outIndexSess, simple_allocator *, std::vector<std::pair<str8_t, term_index_ctx>> *const outTerms, IndexSource::field_statistics *fs, const uint32_t flushFreq = 0, const bool disableOptimizations = false, merge_throttle *throttle = nullptr, Executor *executor = Executor::default_executor());
+
+                // Collects the norms of all documents of all candidates that are not masked by more recent candidates.
+                // You should persist them in the merged segment with Trinity::persist_norms(), so that scorers that depend on them keep working.
+                // Make sure you have committed first.
+                //
+                // Returns how many distinct documents they are for; merge() doesn't track field_statistics::docsCnt, so you should set it to that.
+                uint32_t merge_norms(std::vector<std::pair<isrc_docid_t, uint8_t>> *const out);
 
 		enum class IndexSourceRetention : uint8_t
 		{
@@ -0,0 +1,737 @@
+#include "merge_scheduler.h"
+#include "indexer.h"
+#include "results_cache.h"
+#include "utils.h"
+#include <dirent.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#ifndef RENAME_EXCHANGE
+#define RENAME_EXCHANGE (1 << 1)
+#endif
+
+using namespace Trinity;
+
+namespace // static/local this module
+{
+        static constexpr bool trace{false};
+
+        // merges in progress are built in basePath/.merge.<generation>
+        static constexpr const char *MergePrefix{".merge."};
+        // see exchange()
+        static constexpr const char *RetiredPrefix{".retired."};
+
+        static bool exists(const char *const path)
+        {
+                struct stat64 st;
+
+                return stat64(path, &st) == 0;
+        }
+
+        static uint64_t file_size(const char *const path)
+        {
+                struct stat64 st;
+
+                return stat64(path, &st) == -1 ? 0 : st.st_size;
+        }
+
+        static bool is_generation(const char *p)
+        {
+                if (!*p)
+                        return false;
+
+                for (; *p; ++p)
+                {
+                        if (!isdigit(*p))
+                                return false;
+                }
+                return true;
+        }
+
+        static void remove_dir(const char *const path)
+        {
+                nftw(path, [](const char *p, const struct stat *, int, struct FTW *) { return remove(p); }, 16, FTW_DEPTH | FTW_PHYS);
+        }
+
+        // Generations of the segments a merged segment replaced(see MergeScheduler::merge())
+        static void merged_generations(const char *const segmentPath, std::vector<uint64_t> *const out)
+        {
+                char path[PATH_MAX];
+
+                snprintf(path, sizeof(path), "%s/merged", segmentPath);
+
+                int fd = open(path, O_RDONLY | O_LARGEFILE);
+
+                if (fd == -1)
+                {
+                        if (errno != ENOENT)
+                                throw Switch::system_error("Failed to access ", path);
+                        return;
+                }
+
+                Defer({
+                        close(fd);
+                });
+
+                const auto size = lseek64(fd, 0, SEEK_END);
+
+                if (size % sizeof(uint64_t))
+                        throw Switch::data_error("Unexpected contents of ", path);
+
+                const auto base = out->size();
+
+                out->resize(base + size / sizeof(uint64_t));
+                if (pread64(fd, out->data() + base, size, 0) != size)
+                        throw Switch::system_error("Failed to read ", path);
+        }
+
+        // Atomically exchanges the two directories, or, if that's not supported by the filesystem(or the kernel), renames b to
+        // basePath/.retired.<generation> and then a to b; if we are terminated in between, MergeScheduler::open() will move a into place.
+        // Returns the path of the previous b
+        static std::string exchange(const std::string &basePath, const std::string &a, const std::string &b, const uint64_t gen)
+        {
+#ifdef SYS_renameat2
+                if (syscall(SYS_renameat2, AT_FDCWD, a.c_str(), AT_FDCWD, b.c_str(), RENAME_EXCHANGE) == 0)
+                        return a;
+#endif
+                const auto retired = basePath + "/" + RetiredPrefix + std::to_string(gen);
+
+                if (rename(b.c_str(), retired.c_str()) == -1)
+                        throw Switch::system_error("Failed to rename ", b.c_str());
+                else if (rename(a.c_str(), b.c_str()) == -1)
+                {
+                        rename(retired.c_str(), b.c_str());
+                        throw Switch::system_error("Failed to rename ", a.c_str());
+                }
+
+                return retired;
+        }
+}
+
+Trinity::MergeScheduler::MergeScheduler(const char *const bp, session_factory f, const tiered_merge_policy p, const uint32_t mergeThreads, const uint64_t maxBytesPerSecond, const segment_load_policy lp, const uint32_t encodingThreads)
+    : basePath{bp}, newSession{std::move(f)}, policy{p}, loadPolicy{lp}, threadsCnt{mergeThreads}, throttle{maxBytesPerSecond}, executor{std::max<uint32_t>(1, encodingThreads ? encodingThreads : mergeThreads)}
+{
+        expect(policy.segmentsPerTier >= 2);
+        expect(policy.maxMergeAtOnce >= 2);
+
+        std::lock_guard<std::mutex> g(lock);
+
+        publish();
+}
+
+Trinity::MergeScheduler::~MergeScheduler()
+{
+        {
+                std::lock_guard<std::mutex> g(lock);
+
+                stop = true;
+        }
+
+        cond.notify_all();
+        for (auto &t : threads)
+                t.join();
+
+        std::atomic_store(&live, std::shared_ptr<IndexSourcesCollection>());
+        for (auto it : sources)
+                it->Release();
+}
+
+std::string Trinity::MergeScheduler::segment_path(const uint64_t gen) const
+{
+        return basePath + "/" + std::to_string(gen);
+}
+
+// Expects lock to be held
+void Trinity::MergeScheduler::publish()
+{
+        auto c = std::make_shared<IndexSourcesCollection>();
+
+        for (auto it : sources)
+                c->insert(it);
+        c->commit();
+
+        std::atomic_store(&live, std::move(c));
+        ++version;
+        cond.notify_all();
+}
+
+void Trinity::MergeScheduler::open()
+{
+        std::vector<uint64_t> gens, replaced;
+        std::vector<std::string> names;
+
+        {
+                auto dh = opendir(basePath.c_str());
+
+                if (!dh)
+                        throw Switch::system_error("Failed to access ", basePath.c_str());
+
+                Defer({
+                        closedir(dh);
+                });
+
+                // We may rename entries below, and whether readdir() returns an entry renamed after opendir() is unspecified
+                while (const auto de = readdir(dh))
+                        names.emplace_back(de->d_name);
+        }
+
+        const auto prefixLen = strlen(MergePrefix);
+
+        for (const auto &it : names)
+        {
+                const auto name = it.c_str();
+
+                if (is_generation(name))
+                        gens.push_back(strtoull(name, nullptr, 10));
+                else if (!strncmp(name, MergePrefix, prefixLen) && is_generation(name + prefixLen))
+                {
+                        const auto gen = strtoull(name + prefixLen, nullptr, 10);
+                        const auto path = basePath + "/" + name;
+
+                        // If the merged segment's index was persisted, we were terminated while replacing its most recent segment with it; see exchange()
+                        if (!exists(segment_path(gen).c_str()) && exists((path + "/index").c_str()))
+                        {
+                                if (rename(path.c_str(), segment_path(gen).c_str()) == -1)
+                                        throw Switch::system_error("Failed to rename ", path.c_str());
+
+                                gens.push_back(gen);
+                        }
+                        else
+                                remove_dir(path.c_str());
+                }
+                else if (!strncmp(name, RetiredPrefix, strlen(RetiredPrefix)))
+                        remove_dir((basePath + "/" + name).c_str());
+        }
+
+        for (const auto gen : gens)
+        {
+                std::vector<uint64_t> v;
+
+                merged_generations(segment_path(gen).c_str(), &v);
+                // a merged segment lists its own generation as well
+                for (const auto it : v)
+                {
+                        if (it != gen)
+                                replaced.push_back(it);
+                }
+        }
+
+        std::sort(gens.begin(), gens.end());
+        for (const auto gen : replaced)
+        {
+                if (const auto it = std::lower_bound(gens.begin(), gens.end(), gen); it != gens.end() && *it == gen)
+                {
+                        if (trace)
+                                SLog("Deleting replaced segment ", gen, "\n");
+
+                        remove_dir(segment_path(gen).c_str());
+                        gens.erase(it);
+                }
+        }
+
+        std::vector<SegmentIndexSource *> loaded;
+
+        try
+        {
+                for (const auto gen : gens)
+                        loaded.push_back(new SegmentIndexSource(segment_path(gen).c_str(), loadPolicy));
+        }
+        catch (...)
+        {
+                for (auto it : loaded)
+                        it->Release();
+                throw;
+        }
+
+        std::lock_guard<std::mutex> g(lock);
+
+        for (auto it : loaded)
+        {
+                sources.push_back(it);
+                segments.insert({it->generation(), {it, false, false, std::make_shared<masking_stats>()}});
+        }
+
+        publish();
+}
+
+void Trinity::MergeScheduler::start()
+{
+        for (uint32_t i{0}; i != threadsCnt; ++i)
+                threads.emplace_back([this]() { worker(); });
+}
+
+void Trinity::MergeScheduler::insert(SegmentIndexSource *const s)
+{
+        std::lock_guard<std::mutex> g(lock);
+
+        s->Retain();
+        sources.push_back(s);
+        segments.insert({s->generation(), {s, false, false, std::make_shared<masking_stats>()}});
+        publish();
+}
+
+void Trinity::MergeScheduler::insert(IndexSource *const s)
+{
+        std::lock_guard<std::mutex> g(lock);
+
+        s->Retain();
+        sources.push_back(s);
+        publish();
+}
+
+bool Trinity::MergeScheduler::erase(IndexSource *const s)
+{
+        std::lock_guard<std::mutex> g(lock);
+        const auto it = std::find(sources.begin(), sources.end(), s);
+
+        if (it == sources.end())
+                return false;
+
+        if (const auto sit = segments.find(s->generation()); sit != segments.end() && sit->second.src == s)
+        {
+                if (sit->second.merging)
+                        return false;
+
+                segments.erase(sit);
+        }
+
+        sources.erase(it);
+        s->Release();
+        publish();
+        return true;
+}
+
+// Ratio of the documents of the segment(sources[idx] of the collection) masked by more recent sources of the collection
+// This is tracked for each segment(see masking_stats), so that documents are only tested against the masking sources that were not
+// accounted for already(e.g recently inserted segments). We only need to rescan all of them if any of those sources is gone(e.g merged).
+double Trinity::MergeScheduler::masked_ratio(IndexSourcesCollection *const c, const uint16_t idx, SegmentIndexSource *const s, masking_stats *const ms)
+{
+        const auto norms = s->doc_norms();
+
+        if (!norms)
+                return 0;
+
+        std::vector<uint64_t> maskers;
+        std::vector<updated_documents> added;
+
+        for (uint16_t i{0}; i != idx; ++i)
+        {
+                if (c->sources[i]->masked_documents())
+                        maskers.push_back(c->sources[i]->instance_id());
+        }
+        std::sort(maskers.begin(), maskers.end());
+
+        std::lock_guard<std::mutex> g(ms->lock);
+
+        if (maskers != ms->maskers)
+        {
+                std::unique_ptr<masked_documents_registry> registry;
+
+                if (ms->maskedDocs.size() && std::includes(maskers.begin(), maskers.end(), ms->maskers.begin(), ms->maskers.end()))
+                {
+                        for (uint16_t i{0}; i != idx; ++i)
+                        {
+                                const auto it = c->sources[i];
+
+                                if (const auto ud = it->masked_documents(); ud && !std::binary_search(ms->maskers.begin(), ms->maskers.end(), it->instance_id()))
+                                        added.push_back(ud);
+                        }
+
+                        if (added.size() <= std::numeric_limits<uint8_t>::max())
+                                registry = masked_documents_registry::make(added.data(), added.size());
+                }
+
+                if (!registry)
+                {
+                        // from scratch
+                        ms->maskedDocs.assign((norms.size + 63) / 64, 0);
+                        ms->docs = 0;
+                        ms->masked = 0;
+                        for (uint32_t i{0}; i != norms.size; ++i)
+                                ms->docs += norms.data[i] != 0;
+                        registry = c->scanner_registry_for(idx);
+                }
+
+                auto *const bm = ms->maskedDocs.data();
+
+                if (trace)
+                        SLog("Accounting for ", added.size() ? added.size() : maskers.size(), " masking sources of ", s->generation(), "\n");
+
+                for (uint32_t i{0}; i != norms.size && !registry->empty(); ++i)
+                {
+                        if (norms.data[i] && !SwitchBitOps::Bitmap<uint64_t>::IsSet(bm, i) && registry->test(norms.base + i))
+                        {
+                                SwitchBitOps::Bitmap<uint64_t>::Set(bm, i);
+                                ++(ms->masked);
+                        }
+                }
+
+                ms->maskers = std::move(maskers);
+        }
+
+        return ms->docs ? double(ms->masked) / ms->docs : 0;
+}
+
+// Selects the segments to merge next, if any, and marks them as merging
+bool Trinity::MergeScheduler::select(merge_spec *const out)
+{
+        struct candidate final
+        {
+                SegmentIndexSource *src;
+                uint16_t idx;
+                bool eligible;
+                std::shared_ptr<masking_stats> masking;
+                double maskedRatio;
+                uint64_t size;
+                uint8_t tier;
+        };
+
+        std::vector<candidate> all;
+
+        for (;;)
+        {
+                std::unique_lock<std::mutex> g(lock);
+                auto c = live;
+
+                if (stop)
+                        return false;
+
+                // sources of the collection are ordered by generation, most recent first
+                all.clear();
+                for (uint16_t i{0}; i != c->sources.size(); ++i)
+                {
+                        const auto s = c->sources[i];
+                        const auto it = segments.find(s->generation());
+
+                        if (it == segments.end() || it->second.src != s)
+                                all.push_back({nullptr, i, false});
+                        else
+                                all.push_back({it->second.src, i, !it->second.merging && !it->second.failed, it->second.masking});
+                }
+                g.unlock();
+
+                // accounting for masked documents is expensive, so that's tracked for each segment; see masked_ratio()
+                for (auto &it : all)
+                {
+                        if (!it.eligible)
+                                continue;
+
+                        it.maskedRatio = masked_ratio(c.get(), it.idx, it.src, it.masking.get());
+
+                        const uint64_t bytes = it.src->backing_index().size();
+
+                        it.size = std::max<uint64_t>(policy.floorSegmentSize, bytes * (1 - it.maskedRatio));
+                        it.tier = 0;
+                        for (auto v = policy.floorSegmentSize * policy.segmentsPerTier; it.size >= v && it.tier != 64; v *= policy.segmentsPerTier)
+                                ++(it.tier);
+
+                        // too large to merge with others
+                        if (bytes > policy.maxMergedSegmentSize / 2)
+                                it.tier = UINT8_MAX;
+                }
+
+                // Look for runs of at least segmentsPerTier adjacent segments of the same tier, and prefer the lowest tier
+                // We merge the oldest maxMergeAtOnce segments of the run
+                uint32_t first{0}, last{0};
+                uint8_t bestTier{UINT8_MAX};
+
+                for (uint32_t i{0}; i < all.size();)
+                {
+                        if (!all[i].eligible || all[i].tier == UINT8_MAX)
+                        {
+                                ++i;
+                                continue;
+                        }
+
+                        const auto tier = all[i].tier;
+                        auto e = i + 1;
+
+                        while (e < all.size() && all[e].eligible && all[e].tier == tier)
+                                ++e;
+
+                        if (e - i >= policy.segmentsPerTier && tier < bestTier)
+                        {
+                                uint64_t sum{0};
+
+                                bestTier = tier;
+                                last = e;
+                                for (first = e; first > i && last - first < policy.maxMergeAtOnce && sum + all[first - 1].size <= policy.maxMergedSegmentSize; --first)
+                                        sum += all[first - 1].size;
+                        }
+
+                        i = e;
+                }
+
+                if (bestTier == UINT8_MAX || last - first < 2)
+                {
+                        // No full tier; merge the segment with the most masked documents by itself, if that's worth it
+                        double maxRatio{policy.maskedRatioThreshold};
+
+                        first = last = 0;
+                        for (uint32_t i{0}; i != all.size(); ++i)
+                        {
+                                if (all[i].eligible && all[i].maskedRatio >= maxRatio)
+                                {
+                                        maxRatio = all[i].maskedRatio;
+                                        first = i;
+                                        last = i + 1;
+                                }
+                        }
+                }
+
+                g.lock();
+
+                if (c != live)
+                {
+                        // sources changed in the meantime
+                        continue;
+                }
+                else if (first == last)
+                        return false;
+
+                out->inputs.clear();
+                for (auto i = first; i != last; ++i)
+                {
+                        auto &s = segments[all[i].src->generation()];
+
+                        if (s.merging)
+                                break;
+
+                        s.merging = true;
+                        out->inputs.push_back(s.src);
+                }
+
+                if (out->inputs.size() != last - first)
+                {
+                        // another thread selected some of them; try again
+                        for (auto it : out->inputs)
+                                segments[it->generation()].merging = false;
+                        continue;
+                }
+
+                out->snapshot = std::move(c);
+                ++running;
+                return true;
+        }
+}
+
+bool Trinity::MergeScheduler::merge(const merge_spec &spec)
+{
+        const auto &inputs = spec.inputs;
+        const auto gen = inputs.front()->generation();
+        const auto oldestGen = inputs.back()->generation();
+        const auto path = basePath + "/" + MergePrefix + std::to_string(gen);
+        const auto before = Timings::Microseconds::Tick();
+        MergeCandidatesCollection collection;
+        std::vector<std::unique_ptr<IndexSourceTermsView>> views;
+        std::vector<isrc_docid_t> updatedDocumentIDs;
+        std::vector<std::pair<str8_t, term_index_ctx>> terms;
+        std::vector<std::pair<isrc_docid_t, uint8_t>> norms;
+        simple_allocator allocator;
+        IndexSource::field_statistics fs;
+        uint64_t bytesIn{0};
+        IOBuffer merged;
+
+        remove_dir(path.c_str());
+        if (mkdir(path.c_str(), 0775) == -1)
+                throw Switch::system_error("Failed to create ", path.c_str());
+
+        std::unique_ptr<Codecs::IndexSession> sess(newSession(path.c_str()));
+
+        try
+        {
+                // Documents masked by more recent sources are dropped
+                for (auto it : spec.snapshot->sources)
+                {
+                        if (it->generation() > gen)
+                        {
+                                if (const auto ud = it->masked_documents())
+                                        collection.insert({it->generation(), nullptr, nullptr, ud, {}});
+                        }
+                }
+
+                for (auto it : inputs)
+                {
+                        const auto ud = it->masked_documents();
+
+                        views.emplace_back(it->segment_terms()->new_terms_view());
+                        collection.insert({it->generation(), views.back().get(), it->access_proxy(), ud, it->doc_norms()});
+
+                        // The merged segment needs to mask documents of older sources, same as the segments it replaces
+                        if (ud)
+                                collect_updates(ud, &updatedDocumentIDs);
+
+                        merged.pack(it->generation());
+                        bytesIn += it->backing_index().size();
+                }
+
+                collection.commit();
+                sess->begin();
+                // Chunks copied as is(append_index_chunk()) or merged by the codec are not accounted for in fs, and scorers depend on it; see MergeCandidatesCollection::merge()
+                collection.merge(sess.get(), &allocator, &terms, &fs, 0, true, &throttle, &executor);
+                fs.docsCnt = collection.merge_norms(&norms);
+
+                sess->persist_terms(terms);
+                persist_norms(sess->basePath, norms);
+
+                if (Utilities::to_file(merged.data(), merged.size(), (path + "/merged").c_str()) == -1)
+                        throw Switch::system_error("Failed to persist merged generations");
+
+                persist_segment(fs, sess.get(), updatedDocumentIDs);
+        }
+        catch (...)
+        {
+                remove_dir(path.c_str());
+                throw;
+        }
+
+        const auto bytesOut = file_size((path + "/index").c_str());
+        std::string previous;
+        std::unique_lock<std::mutex> g(lock);
+        // another source may have been inserted in the meantime, with a generation in the range of the merged segments(i.e not adjacent anymore)
+        const auto valid = std::none_of(sources.begin(), sources.end(), [&](const auto s) {
+                const auto sgen = s->generation();
+
+                return sgen >= oldestGen && sgen <= gen && std::find(inputs.begin(), inputs.end(), s) == inputs.end();
+        });
+
+        if (!valid)
+        {
+                // nothing wrong with them; they may be selected again, along with the new source
+                for (auto it : inputs)
+                {
+                        if (auto sit = segments.find(it->generation()); sit != segments.end() && sit->second.src == it)
+                                sit->second.merging = false;
+                }
+                g.unlock();
+
+                if (trace)
+                        SLog("Discarding merge of ", inputs.size(), " segments; no longer adjacent\n");
+
+                remove_dir(path.c_str());
+                return false;
+        }
+
+        previous = exchange(basePath, path, segment_path(gen), gen);
+
+        SegmentIndexSource *src;
+
+        try
+        {
+                src = new SegmentIndexSource(segment_path(gen).c_str(), loadPolicy);
+        }
+        catch (...)
+        {
+                // restore the most recent segment
+                exchange(basePath, previous, segment_path(gen), gen);
+                remove_dir(previous.c_str());
+                throw;
+        }
+
+        for (auto it : inputs)
+        {
+                segments.erase(it->generation());
+                sources.erase(std::find(sources.begin(), sources.end(), it));
+                it->Release();
+        }
+
+        sources.push_back(src);
+        segments.insert({gen, {src, false, false, std::make_shared<masking_stats>()}});
+
+        ++counters.merges;
+        counters.mergedSegments += inputs.size();
+        counters.bytesIn += bytesIn;
+        counters.bytesOut += bytesOut;
+        publish();
+        g.unlock();
+
+        if (trace)
+                SLog(duration_repr(Timings::Microseconds::Since(before)), " to merge ", inputs.size(), " segments(", dotnotation_repr(bytesIn), " bytes) to ", dotnotation_repr(bytesOut), " bytes\n");
+
+        // Results of queries on the merged segments are no longer valid
+        if (auto rc = QueryResultsCache::default_cache())
+        {
+                for (auto it : inputs)
+                        rc->invalidate(it->generation());
+        }
+
+        // Queries that may still be accessing the merged segments have them mapped, so it's safe to delete them now
+        remove_dir(previous.c_str());
+        for (uint32_t i{1}; i < inputs.size(); ++i)
+                remove_dir(segment_path(inputs[i]->generation()).c_str());
+
+        return true;
+}
+
+bool Trinity::MergeScheduler::merge_once()
+{
+        merge_spec spec;
+
+        if (!select(&spec))
+                return false;
+
+        try
+        {
+                merge(spec);
+        }
+        catch (const std::exception &e)
+        {
+                SLog("Failed to merge ", spec.inputs.size(), " segments:", e.what(), "\n");
+
+                std::lock_guard<std::mutex> g(lock);
+
+                for (auto it : spec.inputs)
+                {
+                        if (auto sit = segments.find(it->generation()); sit != segments.end() && sit->second.src == it)
+                        {
+                                sit->second.merging = false;
+                                sit->second.failed = true;
+                        }
+                }
+                ++counters.failed;
+        }
+
+        std::lock_guard<std::mutex> g(lock);
+
+        --running;
+        cond.notify_all();
+        return true;
+}
+
+void Trinity::MergeScheduler::worker()
+{
+        std::unique_lock<std::mutex> g(lock);
+
+        while (!stop)
+        {
+                const auto v = version;
+
+                g.unlock();
+
+                const auto merged = merge_once();
+
+                g.lock();
+                if (!merged && version == v)
+                {
+                        idleVersion = v;
+                        cond.notify_all();
+                        cond.wait(g, [&]() { return stop || version != v; });
+                }
+        }
+}
+
+void Trinity::MergeScheduler::wait_idle()
+{
+        std::unique_lock<std::mutex> g(lock);
+
+        cond.wait(g, [this]() { return stop || (running == 0 && idleVersion == version); });
+}
+
+Trinity::MergeScheduler::stats_struct Trinity::MergeScheduler::stats()
+{
+        std::lock_guard<std::mutex> g(lock);
+
+        return counters;
+}
@@ -0,0 +1,180 @@
+// Background, tiered segments merging
+//
+// Every persisted segment is another index source queries need to be executed on, and another set of updated documents that
+// documents of older sources need to be tested against. MergeCandidatesCollection can merge segments, but which segments to merge, when,
+// and how to replace them while queries are executing was left to the application.
+//
+// MergeScheduler tracks the segments of an index directory(each segment in a directory named after its generation), along with any
+// other sources you insert(), and publishes them as an IndexSourcesCollection. Queries should acquire the current collection via snapshot().
+//
+// - Segments are selected for merging with a size-tiered policy(see tiered_merge_policy), which accounts for how many of their documents are
+// masked by more recent sources. Only segments of adjacent generations are merged together, and the merged segment assumes the generation of
+// the most recent of them, so that it is ordered correctly in relation to all other sources.
+// - Documents masked by more recent sources are dropped, so that merging also reclaims space used by updated or deleted documents.
+// - Merges run on background threads, and how fast they may output postings is limited(see merge_throttle). Ranges of terms of a merge are
+// encoded in parallel on the scheduler's own Executor, so that merges won't compete with queries for the default Executor's workers.
+// - When a merge completes, a new collection where the merged segment replaces the merged segments is atomically published. Queries that
+// acquired the previous collection keep using it; the segments it retains are released once the last of them is done with it.
+//
+// A merged segment lists the generations of the segments it replaced in its `merged` file, so that if the process is terminated
+// before they are deleted, open() will delete them. It also cleans up after incomplete merges.
+#pragma once
+#include "merge.h"
+#include "segment_index_source.h"
+#include <condition_variable>
+#include <functional>
+#include <thread>
+
+namespace Trinity
+{
+        struct tiered_merge_policy final
+        {
+                // Segments smaller than that are considered to be that large, so that many tiny segments are merged together aggressively
+                uint64_t floorSegmentSize{2 * 1024 * 1024};
+
+                // We won't merge segments into a segment larger than that(approximately), and segments larger than half of
+                // that are only merged in order to reclaim their masked documents
+                uint64_t maxMergedSegmentSize{5ul * 1024 * 1024 * 1024};
+
+                // How many adjacent segments of the same tier(segments of the same size, within a factor of segmentsPerTier) we can tolerate before merging them
+                uint16_t segmentsPerTier{10};
+
+                // No more than that many segments are merged at once
+                uint16_t maxMergeAtOnce{10};
+
+                // A segment is sized by the documents that are not masked by more recent sources, and if masked documents account for at least
+                // that ratio of its documents, it will be merged(by itself) even if its tier is not full, in order to reclaim their space.
+                // Masked documents are only accounted for in segments with norms(see IndexSource::doc_norms())
+                double maskedRatioThreshold{0.3};
+        };
+
+        class MergeScheduler final
+        {
+              public:
+                // Returns a new session for the merged segment, which will be persisted in basePath
+                using session_factory = std::function<Codecs::IndexSession *(const char *basePath)>;
+
+                struct stats_struct final
+                {
+                        uint64_t merges;
+                        uint64_t mergedSegments;
+                        uint64_t failed;
+                        uint64_t bytesIn, bytesOut;
+                };
+
+              private:
+                struct merge_spec final
+                {
+                        // most recent first
+                        std::vector<SegmentIndexSource *> inputs;
+                        std::shared_ptr<IndexSourcesCollection> snapshot;
+                };
+
+                // see masked_ratio()
+                struct masking_stats final
+                {
+                        std::mutex lock;
+                        // instances(see IndexSource::instance_id()) of the sources accounted for in maskedDocs, sorted
+                        std::vector<uint64_t> maskers;
+                        // a bit for each document of the segment's norms; set if masked by any of them
+                        std::vector<uint64_t> maskedDocs;
+                        uint64_t docs{0}, masked{0};
+                };
+
+                struct segment_state final
+                {
+                        SegmentIndexSource *src;
+                        bool merging;
+                        bool failed; // a merge failed; we won't consider it again
+                        std::shared_ptr<masking_stats> masking;
+                };
+
+              private:
+                const std::string basePath;
+                const session_factory newSession;
+                const tiered_merge_policy policy;
+                const segment_load_policy loadPolicy;
+                const uint32_t threadsCnt;
+                merge_throttle throttle;
+                // see MergeCandidatesCollection::merge()
+                Executor executor;
+
+                std::mutex lock;
+                std::condition_variable cond;
+                // all sources; retained
+                std::vector<IndexSource *> sources;
+                // segments we may merge, by generation
+                ska::flat_hash_map<uint64_t, segment_state> segments;
+                std::shared_ptr<IndexSourcesCollection> live;
+                // bumped whenever sources change
+                uint64_t version{0};
+                // the version for which we last failed to find anything to merge
+                uint64_t idleVersion{UINT64_MAX};
+                uint32_t running{0};
+                bool stop{false};
+                std::vector<std::thread> threads;
+                stats_struct counters{};
+
+              private:
+                // Expects lock to be held
+                void publish();
+
+                std::string segment_path(const uint64_t gen) const;
+
+                double masked_ratio(IndexSourcesCollection *, const uint16_t idx, SegmentIndexSource *, masking_stats *);
+
+                bool select(merge_spec *);
+
+                // Returns false if the merged segments were no longer adjacent by the time the merge completed, and the merge was discarded
+                bool merge(const merge_spec &);
+
+                void worker();
+
+              public:
+                // encodingThreads is how many threads the scheduler's Executor spawns, shared by all merges; if 0, mergeThreads are used
+                MergeScheduler(const char *basePath, session_factory f, const tiered_merge_policy p = {}, const uint32_t mergeThreads = 1, const uint64_t maxBytesPerSecond = 0, const segment_load_policy lp = {}, const uint32_t encodingThreads = 0);
+
+                // Waits for running merges to complete
+                ~MergeScheduler();
+
+                // Loads all segments in basePath, after it has deleted segments replaced by merged segments, and incomplete merges
+                // You should open() before you start()
+                void open();
+
+                // Spawns the merge threads
+                void start();
+
+                // Tracks a segment(retained), which must be in basePath, so that it can be merged with other segments
+                void insert(SegmentIndexSource *);
+
+                // Tracks any other source(retained; e.g an InMemoryIndexSource). Those are never merged
+                void insert(IndexSource *);
+
+                // Stops tracking a source that was insert()ed
+                // It won't be erased if it's being merged; returns false if it wasn't erased
+                bool erase(IndexSource *);
+
+                // The current collection of all tracked sources
+                // Sources are retained by the collection, so they will remain valid for as long as you hold on to it
+                std::shared_ptr<IndexSourcesCollection> snapshot() const
+                {
+                        return std::atomic_load(&live);
+                }
+
+                // Selects and performs a single merge on the calling thread, if there is anything to merge
+                // This is what the merge threads do; you can use it if you 'd rather control when merges happen
+                bool merge_once();
+
+                // Blocks until there is nothing more to merge and no merges are running
+                // Only useful if you have start()ed
+                void wait_idle();
+
+                // 0 for no limit
+                void set_io_rate(const uint64_t bytesPerSecond)
+                {
+                        throttle.set_rate(bytesPerSecond);
+                }
+
+                stats_struct stats();
+        };
+}
@@ -0,0 +1,48 @@
+#include "norms.h"
+#include "utils.h"
+#include <buffer.h>
+
+Trinity::norms_view Trinity::build_norms(std::vector<std::pair<isrc_docid_t, uint8_t>> &norms, std::vector<uint8_t> *const out)
+{
+        out->clear();
+        if (norms.empty())
+                return {};
+
+        std::stable_sort(norms.begin(), norms.end(), [](const auto &a, const auto &b) noexcept {
+                return a.first < b.first;
+        });
+
+        const auto base = norms.front().first;
+        const auto span = uint64_t(norms.back().first - base) + 1;
+
+        if (span > std::numeric_limits<uint32_t>::max())
+                throw Switch::data_error("Unexpected norms span");
+
+        out->resize(span, 0);
+
+        auto data = out->data();
+
+        // the sort is stable, so the latest norm for a document is the one that sticks
+        for (const auto &it : norms)
+                data[it.first - base] = it.second;
+
+        return {base, uint32_t(span), data};
+}
+
+void Trinity::persist_norms(const char *const basePath, std::vector<std::pair<isrc_docid_t, uint8_t>> &norms)
+{
+        std::vector<uint8_t> values;
+        const auto v = build_norms(norms, &values);
+
+        if (!v)
+                return;
+
+        IOBuffer b;
+
+        b.reserve(sizeof(uint32_t) * 2 + v.size);
+        b.pack(uint32_t(v.base), uint32_t(v.size));
+        b.serialize(v.data, v.size);
+
+        if (Trinity::Utilities::to_file(b.data(), b.size(), Buffer{}.append(basePath, "/norms").c_str()) == -1)
+                throw Switch::system_error("Failed to persist norms");
+}
@@ -0,0 +1,81 @@
+// Per-document length norms
+// Similarity models(e.g BM25) normalize term frequencies by the document's length, so we need to know, for every
+// document of an index source, how long it is. A norm is a single byte; lengths are quantized using the same scheme as Lucene's SmallFloat::intToByte4():
+// exact for short documents(length < 24), and with a 4 bits mantissa for longer documents, which is more than accurate enough for scoring purposes.
+//
+// Segments persist their norms in the `norms` file: u32 base(lowest document ID), u32 count, followed by count bytes, one for each document ID in [base, base + count)
+// Documents that weren't indexed in the segment (and documents indexed in sources that don't track norms) have a 0 norm, which
+// scorers should interpret as `unknown`.
+#pragma once
+#include "common.h"
+#include <switch_bitops.h>
+
+namespace Trinity
+{
+        namespace Norms
+        {
+                // number of norm values that map 1:1 to lengths; see Lucene's SmallFloat::NUM_FREE_VALUES
+                static constexpr uint32_t FreeValues{24};
+
+                inline uint32_t int4_encode(const uint32_t i) noexcept
+                {
+                        if (i < 8)
+                                return i;
+
+                        const uint32_t numBits = 32 - SwitchBitOps::LeadingZeros(i);
+                        const auto shift = numBits - 4;
+
+                        return ((i >> shift) & 0x07) | ((shift + 1) << 3);
+                }
+
+                inline uint64_t int4_decode(const uint32_t i) noexcept
+                {
+                        const uint64_t bits = i & 0x07;
+                        const int32_t shift = int32_t(i >> 3) - 1;
+
+                        return shift == -1 ? bits : (bits | 0x08) << shift;
+                }
+
+                // Quantizes a document length to a norm
+                inline uint8_t encode_length(const uint32_t length) noexcept
+                {
+                        return length < FreeValues ? length : FreeValues + int4_encode(length - FreeValues);
+                }
+
+                // The (approximate) document length a norm was encoded from
+                inline uint32_t decode_length(const uint8_t norm) noexcept
+                {
+                        return norm < FreeValues ? norm : FreeValues + int4_decode(norm - FreeValues);
+                }
+        }
+
+        // Read-only access to the norms of an index source
+        // It is just a (base, size, data) triplet, so that accessing a norm is a bounds check and a single load
+        struct norms_view final
+        {
+                isrc_docid_t base{0};
+                uint32_t size{0};
+                const uint8_t *data{nullptr};
+
+                inline uint8_t operator[](const isrc_docid_t id) const noexcept
+                {
+                        // ids lower than base wrap around and fail the check
+                        const uint32_t i = id - base;
+
+                        return i < size ? data[i] : 0;
+                }
+
+                inline operator bool() const noexcept
+                {
+                        return size;
+                }
+        };
+
+        // Builds the dense representation of (document ID, norm) pairs into out, and returns a view into it
+        // If a document is included more than once, the last norm for it is used, i.e norms are processed in the order they were appended(last write wins)
+        norms_view build_norms(std::vector<std::pair<isrc_docid_t, uint8_t>> &norms, std::vector<uint8_t> *out);
+
+        // Persists the norms to basePath/norms
+        // Nothing is persisted if norms is empty
+        void persist_norms(const char *basePath, std::vector<std::pair<isrc_docid_t, uint8_t>> &norms);
+}
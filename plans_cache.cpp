@@ -0,0 +1,370 @@
+#include "plans_cache.h"
+
+using namespace Trinity;
+
+static std::atomic<QueryPlansCache *> defaultCache{nullptr};
+
+namespace // static/local this module
+{
+        static constexpr bool trace{false};
+
+        struct hasher final
+        {
+                uint64_t h{14695981039346656037ull};
+
+                inline void mix(const void *const p, const size_t n) noexcept
+                {
+                        for (const auto *it = static_cast<const uint8_t *>(p), *const e = it + n; it != e; ++it)
+                                h = (h ^ *it) * 1099511628211ull;
+                }
+
+                template <typename T>
+                inline void mix(const T v) noexcept
+                {
+                        static_assert(std::is_trivially_copyable<T>::value);
+                        mix(&v, sizeof(v));
+                }
+        };
+}
+
+static void hash_node(const ast_node *const n, hasher &h) noexcept
+{
+        h.mix(n->type);
+        switch (n->type)
+        {
+                case ast_node::Type::BinOp:
+                        h.mix(n->binop.op);
+                        hash_node(n->binop.lhs, h);
+                        hash_node(n->binop.rhs, h);
+                        break;
+
+                case ast_node::Type::UnaryOp:
+                        h.mix(n->unaryop.op);
+                        hash_node(n->unaryop.expr, h);
+                        break;
+
+                case ast_node::Type::ConstTrueExpr:
+                        hash_node(n->expr, h);
+                        break;
+
+                case ast_node::Type::MatchSome:
+                        h.mix(n->match_some.size);
+                        h.mix(n->match_some.min);
+                        for (uint32_t i{0}; i != n->match_some.size; ++i)
+                                hash_node(n->match_some.nodes[i], h);
+                        break;
+
+                case ast_node::Type::Token:
+                case ast_node::Type::Phrase:
+                {
+                        const auto p = n->p;
+
+                        h.mix(p->size);
+                        h.mix(p->rep);
+                        h.mix(p->index);
+                        h.mix(p->toNextSpan);
+                        h.mix(p->flags);
+                        h.mix(p->rewrite_ctx.range.offset);
+                        h.mix(p->rewrite_ctx.range.len);
+                        h.mix(p->rewrite_ctx.translationCoefficient);
+                        h.mix(p->rewrite_ctx.srcSeqSize);
+                        for (uint32_t i{0}; i != p->size; ++i)
+                        {
+                                const auto token = p->terms[i].token;
+
+                                h.mix(token.size());
+                                h.mix(token.data(), token.size());
+                        }
+                }
+                break;
+
+                default:
+                        break;
+        }
+}
+
+uint64_t query_plan::hash(const ast_node *const root) noexcept
+{
+        hasher h;
+
+        if (root)
+                hash_node(root, h);
+        return h.h;
+}
+
+bool query_plan::same(const ast_node *const a, const ast_node *const b) noexcept
+{
+        if (!a || !b)
+                return a == b;
+        else if (a->type != b->type)
+                return false;
+
+        switch (a->type)
+        {
+                case ast_node::Type::BinOp:
+                        return a->binop.op == b->binop.op && same(a->binop.lhs, b->binop.lhs) && same(a->binop.rhs, b->binop.rhs);
+
+                case ast_node::Type::UnaryOp:
+                        return a->unaryop.op == b->unaryop.op && same(a->unaryop.expr, b->unaryop.expr);
+
+                case ast_node::Type::ConstTrueExpr:
+                        return same(a->expr, b->expr);
+
+                case ast_node::Type::MatchSome:
+                        if (a->match_some.size != b->match_some.size || a->match_some.min != b->match_some.min)
+                                return false;
+                        for (uint32_t i{0}; i != a->match_some.size; ++i)
+                        {
+                                if (!same(a->match_some.nodes[i], b->match_some.nodes[i]))
+                                        return false;
+                        }
+                        return true;
+
+                case ast_node::Type::Token:
+                case ast_node::Type::Phrase:
+                {
+                        const auto p1 = a->p, p2 = b->p;
+
+                        // phrase::operator== only considers the tokens and the flags
+                        return *p1 == *p2 && p1->rep == p2->rep && p1->index == p2->index && p1->toNextSpan == p2->toNextSpan && p1->rewrite_ctx.range.offset == p2->rewrite_ctx.range.offset && p1->rewrite_ctx.range.len == p2->rewrite_ctx.range.len && p1->rewrite_ctx.translationCoefficient == p2->rewrite_ctx.translationCoefficient && p1->rewrite_ctx.srcSeqSize == p2->rewrite_ctx.srcSeqSize;
+                }
+
+                default:
+                        return true;
+        }
+}
+
+// We need to collect all term instances in the query
+// so that we the score function will be able to take that into account (See matched_document::queryTermInstances)
+// We only need to do this for specific AST branches and node types(i.e we ignore all RHS expressions of logical NOT nodes)
+//
+// This must be performed before any query optimizations, for otherwise because the optimiser will most definitely rearrange the query, doing it after
+// the optimization passes will not capture the original, input query tokens instances information.
+static void collect_instances(ast_node *const root, std::vector<query_plan::term_instance> *const out)
+{
+        std::vector<ast_node *> stack{root}; // use a stack because we don't care about the evaluation order
+        std::vector<phrase *> collected;
+
+        // collect phrases from the AST
+        do
+        {
+                auto n = stack.back();
+
+                stack.pop_back();
+                switch (n->type)
+                {
+                        case ast_node::Type::Token:
+                        case ast_node::Type::Phrase:
+                                collected.push_back(n->p);
+                                break;
+
+                        case ast_node::Type::MatchSome:
+                                stack.insert(stack.end(), n->match_some.nodes, n->match_some.nodes + n->match_some.size);
+                                break;
+
+                        case ast_node::Type::UnaryOp:
+                                if (n->unaryop.op != Operator::NOT)
+                                        stack.push_back(n->unaryop.expr);
+                                break;
+
+                        case ast_node::Type::ConstTrueExpr:
+                                stack.push_back(n->expr);
+                                break;
+
+                        case ast_node::Type::BinOp:
+                                if (n->binop.op == Operator::AND || n->binop.op == Operator::STRICT_AND || n->binop.op == Operator::OR)
+                                {
+                                        stack.push_back(n->binop.lhs);
+                                        stack.push_back(n->binop.rhs);
+                                }
+                                else if (n->binop.op == Operator::NOT)
+                                        stack.push_back(n->binop.lhs);
+                                break;
+
+                        default:
+                                break;
+                }
+        } while (stack.size());
+
+        for (const auto it : collected) // collected phrases
+        {
+                const uint8_t rep = it->size == 1 ? it->rep : 1;
+                const auto toNextSpan{it->toNextSpan};
+                const auto flags{it->flags};
+                const auto rewriteRange{it->rewrite_ctx.range};
+                const auto translationCoefficient{it->rewrite_ctx.translationCoefficient};
+                const auto srcSeqSize{it->rewrite_ctx.srcSeqSize};
+
+                // for each phrase token
+                for (uint16_t pos{it->index}, i{0}; i != it->size; ++i, ++pos)
+                {
+                        if (trace)
+                                SLog("Collected instance: [", it->terms[i].token, "] index:", pos, " rep:", rep, " toNextSpan:", i == (it->size - 1) ? toNextSpan : 1, "\n");
+
+                        out->push_back({{pos, flags, rep, uint8_t(i == (it->size - 1) ? toNextSpan : 1), {rewriteRange, translationCoefficient, srcSeqSize}}, it->terms[i].token}); // need to be careful to get this right for phrases
+                }
+        }
+
+        std::sort(out->begin(), out->end(), [](const auto &a, const auto &b) { return terms_cmp(a.token.data(), a.token.size(), b.token.data(), b.token.size()) < 0; });
+}
+
+std::unique_ptr<query_plan> query_plan::make(const query &in, const uint64_t key, const bool deepCopy, const bool collectInstances)
+{
+        std::unique_ptr<query_plan> plan(new query_plan(key));
+        auto &q = plan->normalized;
+
+        q.tokensParser = in.tokensParser;
+        q.root = in.root ? (deepCopy ? in.root->copy(&q.allocator) : in.root->shallow_copy(&q.allocator)) : nullptr;
+        if (q.root && deepCopy)
+                query::bind_tokens_to_allocator(q.root, &q.allocator);
+
+        // Normalize just in case
+        if (!q.normalize())
+        {
+                if (trace)
+                        SLog("No root node after normalization\n");
+
+                q.root = nullptr;
+                return plan;
+        }
+
+        if (collectInstances)
+                collect_instances(q.root, &plan->instances);
+
+        std::vector<ast_node *> nodes;
+
+        for (const auto n : query::nodes(q.root, &nodes))
+        {
+                if (n->type == ast_node::Type::Token || n->type == ast_node::Type::Phrase)
+                {
+                        for (uint32_t i{0}; i != n->p->size; ++i)
+                        {
+                                const auto token = n->p->terms[i].token;
+
+                                if (plan->tokensIndex.insert({token, plan->tokens.size()}).second)
+                                        plan->tokens.push_back(token);
+                        }
+                }
+        }
+
+        return plan;
+}
+
+uint16_t query_plan::compiled::resolve_query_term(const str8_t term)
+{
+        const auto res = dict.insert({term, 0});
+
+        if (res.second)
+        {
+                const auto it = plan->tokensIndex.find(term);
+
+                // compile_query() only resolves tokens of the AST
+                require(it != plan->tokensIndex.end());
+
+                // same IDs assignment as queryexec_ctx::resolve_term()
+                if (0 == (missing & (uint64_t(1) << it->second)))
+                        res.first->second = dict.size();
+
+                terms.push_back({it->second, res.first->second});
+        }
+
+        return res.first->second;
+}
+
+const query_plan::compiled *query_plan::compiled_for(IndexSource *const src, std::vector<term_index_ctx> *const tctxs)
+{
+        uint64_t missing{0};
+
+        expect(can_compile());
+        tctxs->clear();
+        for (uint32_t i{0}; i != tokens.size(); ++i)
+        {
+                const auto tctx = src->term_ctx(tokens[i]);
+
+                if (tctx.documents == 0)
+                        missing |= uint64_t(1) << i;
+                tctxs->push_back(tctx);
+        }
+
+        std::lock_guard<std::mutex> g(lock);
+        auto &v = variants[missing];
+
+        if (!v)
+        {
+                // compile_query() modifies the AST, so compile a shallow copy of it
+                query q(normalized, true);
+
+                v.reset(new compiled(this, missing));
+                v->root = compile_query(q.root, *v);
+
+                if (trace)
+                        SLog("Compiled plan for missing = ", missing, "\n");
+        }
+
+        return v.get();
+}
+
+std::shared_ptr<query_plan> QueryPlansCache::plan_for(const query &q)
+{
+        const auto key = query_plan::hash(q.root);
+
+        {
+                std::lock_guard<std::mutex> g(lock);
+
+                if (const auto it = map.find(key); it != map.end() && query_plan::same((*it->second)->original.root, q.root))
+                {
+                        lru.splice(lru.begin(), lru, it->second);
+                        ++hits;
+                        return lru.front();
+                }
+
+                ++misses;
+        }
+
+        // build it outside the lock; if another thread built the same plan in the meantime, we 'll just replace it
+        std::shared_ptr<query_plan> plan(query_plan::make(q, key, true, true));
+
+        plan->original = q;
+
+        std::lock_guard<std::mutex> g(lock);
+
+        if (const auto it = map.find(key); it != map.end())
+        {
+                lru.erase(it->second);
+                map.erase(it);
+        }
+        else if (lru.size() == capacity)
+        {
+                map.erase(lru.back()->key);
+                lru.pop_back();
+        }
+
+        lru.push_front(plan);
+        map.insert({key, lru.begin()});
+        return plan;
+}
+
+void QueryPlansCache::clear()
+{
+        std::lock_guard<std::mutex> g(lock);
+
+        map.clear();
+        lru.clear();
+}
+
+std::pair<uint64_t, uint64_t> QueryPlansCache::stats()
+{
+        std::lock_guard<std::mutex> g(lock);
+
+        return {hits, misses};
+}
+
+void QueryPlansCache::set_default(QueryPlansCache *const c) noexcept
+{
+        defaultCache.store(c, std::memory_order_release);
+}
+
+QueryPlansCache *QueryPlansCache::default_cache() noexcept
+{
+        return defaultCache.load(std::memory_order_acquire);
+}
@@ -0,0 +1,116 @@
+// Compiled query plans cache
+// exec_query() copies and normalizes the query, collects its term instances, and compiles it to an exec_node tree for every index source
+// it is executed on. For short queries, that's a measurable share of their execution time, and applications tend to see the
+// same queries again and again.
+//
+// A query_plan holds the source-independent state of a query: its normalized AST, the (sorted) query term instances, and the distinct tokens.
+// The exec_node tree itself depends on the source only in that tokens that are not indexed in a source are compiled away, so a plan
+// also keeps compiled trees, keyed by the set of missing tokens. Executing a cached plan on a source amounts to resolving the tokens, copying
+// the compiled tree and the cost-based reordering of prepare_tree().
+//
+// Plans are keyed by a hash of the query AST (as provided to exec_query(), i.e before normalization); on collisions the ASTs are compared.
+#pragma once
+#include "compilation_ctx.h"
+#include "index_source.h"
+#include "matches.h"
+#include <ext/flat_hash_map.h>
+#include <list>
+#include <memory>
+#include <mutex>
+
+namespace Trinity
+{
+        struct query_plan final
+        {
+                struct term_instance final
+                    : public query_term_ctx::instance_struct
+                {
+                        str8_t token;
+                };
+
+                // Compiled for a specific set of missing tokens
+                struct compiled final
+                    : public compilation_ctx
+                {
+                        const query_plan *const plan;
+                        const uint64_t missing;
+                        ska::flat_hash_map<str8_t, exec_term_id_t> dict;
+                        // (token index, exec_term_id_t) in the order they were resolved
+                        // exec_query() replays that to reconstruct the queryexec_ctx::termsDict compile_query() would have built
+                        std::vector<std::pair<uint16_t, exec_term_id_t>> terms;
+                        exec_node root;
+
+                        compiled(const query_plan *const p, const uint64_t m)
+                            : plan{p}, missing{m}
+                        {
+                        }
+
+                        uint16_t resolve_query_term(const str8_t term) override final;
+                };
+
+                // Plans with more distinct tokens than that are not compiled ahead of time
+                static constexpr size_t MaxCompiledTokens{64};
+
+                const uint64_t key;
+                query original; // for collisions; empty if this plan isn't cached
+                query normalized;
+                std::vector<term_instance> instances; // sorted by token; only collected if requested(see make())
+                std::vector<str8_t> tokens;
+                ska::flat_hash_map<str8_t, uint16_t> tokensIndex;
+
+                std::mutex lock;
+                ska::flat_hash_map<uint64_t, std::unique_ptr<compiled>> variants;
+
+                query_plan(const uint64_t k)
+                    : key{k}
+                {
+                }
+
+                inline bool can_compile() const noexcept
+                {
+                        return tokens.size() <= MaxCompiledTokens;
+                }
+
+                // Resolves all tokens in src, and returns the tree compiled for the tokens missing from it
+                // tctxs[i] is set to the term_index_ctx of tokens[i]
+                // Requires can_compile()
+                const compiled *compiled_for(IndexSource *src, std::vector<term_index_ctx> *tctxs);
+
+                // Normalizes a copy of q (a shallow copy unless deepCopy is set) and collects the query term instances if collectInstances is set
+                // If deepCopy is set, the plan doesn't reference q's memory; this is required for cached plans.
+                static std::unique_ptr<query_plan> make(const query &q, const uint64_t key, const bool deepCopy, const bool collectInstances);
+
+                static uint64_t hash(const ast_node *) noexcept;
+
+                static bool same(const ast_node *, const ast_node *) noexcept;
+        };
+
+        class QueryPlansCache final
+        {
+              private:
+                const size_t capacity;
+                std::mutex lock;
+                std::list<std::shared_ptr<query_plan>> lru; // most recently used first
+                ska::flat_hash_map<uint64_t, std::list<std::shared_ptr<query_plan>>::iterator> map;
+                uint64_t hits{0}, misses{0};
+
+              public:
+                QueryPlansCache(const size_t c = 4096)
+                    : capacity{std::max<size_t>(c, 1)}
+                {
+                }
+
+                // Returns the plan for q, building and caching it if needed
+                // The plan's normalized root is nullptr if there is nothing to execute
+                std::shared_ptr<query_plan> plan_for(const query &q);
+
+                void clear();
+
+                std::pair<uint64_t, uint64_t> stats();
+
+                // The cache exec_query() uses; nullptr(the default) disables caching
+                static void set_default(QueryPlansCache *c) noexcept;
+
+                static QueryPlansCache *default_cache() noexcept;
+        };
+}
@@ -79,6 +79,13 @@ namespace Trinity
 		}
 
 		virtual double iterator_score() = 0;
+
+		// Hands out the documents of the wrapped iterator that are < upto, no more than max of them, in ids[], and their scores in scores[], and
+		// advances the iterator past them, like Codecs::PostingsListIterator::next_block() does. Returns 0 if there are no such documents.
+		//
+		// The default impl. uses next() and iterator_score(). Wrappers of postings lists iterators override it, so that
+		// whole decoded blocks are scored with Similarity::IndexSourceTermsScorer::score_batch()
+		virtual uint32_t next_scored_block(isrc_docid_t *const ids, float *const scores, const uint32_t max, const isrc_docid_t upto);
 	};
 
         double relevant_document_provider::score()
@@ -0,0 +1,188 @@
+#include "results_cache.h"
+#include "plans_cache.h"
+
+using namespace Trinity;
+
+static std::atomic<QueryResultsCache *> defaultCache{nullptr};
+
+void cached_results::replay(MatchedIndexDocumentsFilter *const f) const
+{
+        if (scores.empty())
+        {
+                for (const auto id : ids)
+                        f->consider(id);
+        }
+        else
+        {
+                for (size_t i{0}; i != ids.size(); ++i)
+                        f->consider(ids[i], scores[i]);
+        }
+}
+
+uint64_t QueryResultsCache::key(const query &q, const uint32_t flags, const uint32_t topK) noexcept
+{
+        const auto h = query_plan::hash(q.root);
+
+        return h ^ ((uint64_t(flags) << 32 | topK) * 0x9e3779b97f4a7c15ull);
+}
+
+// Expects lock to be held
+std::list<QueryResultsCache::entry>::iterator QueryResultsCache::find(const query &q, const uint64_t key, const uint32_t flags, const uint32_t topK)
+{
+        const auto it = map.find(key);
+
+        if (it == map.end())
+                return lru.end();
+
+        const auto e = it->second;
+
+        if (e->flags != flags || e->topK != topK || !query_plan::same(e->original.root, q.root))
+                return lru.end();
+
+        return e;
+}
+
+// Expects lock to be held
+void QueryResultsCache::evict()
+{
+        while (footprint > capacity && !lru.empty())
+        {
+                auto &e = lru.back();
+
+                footprint -= e.footprint;
+                map.erase(e.key);
+                lru.pop_back();
+        }
+}
+
+std::shared_ptr<const cached_results> QueryResultsCache::lookup(const query &q, const uint64_t key, const uint32_t flags, const uint32_t topK, const uint64_t generation, const uint64_t instance, const uint64_t maskingState, const uint64_t scorerFingerprint)
+{
+        std::lock_guard<std::mutex> g(lock);
+        const auto e = find(q, key, flags, topK);
+
+        if (e == lru.end())
+                return nullptr;
+
+        for (const auto &it : e->sources)
+        {
+                if (it.generation == generation && it.instance == instance && it.maskingState == maskingState && it.scorerFingerprint == scorerFingerprint)
+                {
+                        lru.splice(lru.begin(), lru, e);
+                        return it.results;
+                }
+        }
+
+        return nullptr;
+}
+
+void QueryResultsCache::store(const query &q, const uint64_t key, const uint32_t flags, const uint32_t topK, const uint64_t generation, const uint64_t instance, const uint64_t maskingState, const uint64_t scorerFingerprint, const cached_results *const parts, const size_t partsCnt)
+{
+        auto res = std::make_shared<cached_results>();
+        size_t n{0};
+
+        for (size_t i{0}; i != partsCnt; ++i)
+        {
+                if (parts[i].overflow)
+                        return;
+
+                n += parts[i].ids.size();
+        }
+
+        if (n > MaxCachedMatches)
+                return;
+
+        res->ids.reserve(n);
+        for (size_t i{0}; i != partsCnt; ++i)
+        {
+                res->ids.insert(res->ids.end(), parts[i].ids.begin(), parts[i].ids.end());
+                res->scores.insert(res->scores.end(), parts[i].scores.begin(), parts[i].scores.end());
+        }
+
+        const auto size = res->footprint();
+        std::lock_guard<std::mutex> g(lock);
+        auto e = find(q, key, flags, topK);
+
+        if (e == lru.end())
+        {
+                if (const auto it = map.find(key); it != map.end())
+                {
+                        // collision; replace it
+                        footprint -= it->second->footprint;
+                        lru.erase(it->second);
+                        map.erase(it);
+                }
+
+                lru.push_front({key, query(q), flags, topK, {}, 0});
+                e = lru.begin();
+                map.insert({key, e});
+        }
+        else
+                lru.splice(lru.begin(), lru, e);
+
+        auto &sources = e->sources;
+
+        for (size_t i{0}; i != sources.size();)
+        {
+                if (sources[i].generation == generation && sources[i].instance > instance)
+                {
+                        // instances IDs are monotonically increasing, so that's from a source instance that's been replaced
+                        return;
+                }
+                else if (sources[i].generation == generation)
+                {
+                        footprint -= sources[i].results->footprint();
+                        e->footprint -= sources[i].results->footprint();
+                        sources[i] = std::move(sources.back());
+                        sources.pop_back();
+                }
+                else
+                        ++i;
+        }
+
+        sources.push_back({generation, instance, maskingState, scorerFingerprint, std::move(res)});
+        e->footprint += size;
+        footprint += size;
+        evict();
+}
+
+void QueryResultsCache::invalidate(const uint64_t generation)
+{
+        std::lock_guard<std::mutex> g(lock);
+
+        for (auto &e : lru)
+        {
+                auto &sources = e.sources;
+
+                for (size_t i{0}; i != sources.size();)
+                {
+                        if (sources[i].generation == generation)
+                        {
+                                footprint -= sources[i].results->footprint();
+                                e.footprint -= sources[i].results->footprint();
+                                sources[i] = std::move(sources.back());
+                                sources.pop_back();
+                        }
+                        else
+                                ++i;
+                }
+        }
+}
+
+void QueryResultsCache::clear()
+{
+        std::lock_guard<std::mutex> g(lock);
+
+        map.clear();
+        lru.clear();
+        footprint = 0;
+}
+
+void QueryResultsCache::set_default(QueryResultsCache *const c) noexcept
+{
+        defaultCache.store(c, std::memory_order_release);
+}
+
+QueryResultsCache *QueryResultsCache::default_cache() noexcept
+{
+        return defaultCache.load(std::memory_order_acquire);
+}
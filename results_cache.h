@@ -0,0 +1,172 @@
+// Query results cache
+// Segments are immutable, so executing the same query on the same segment, with the same more recent sources masking its documents, will
+// always match the same documents. QueryResultsCache tracks, for each (query, exec flags, topK), the documents(and scores) matched in
+// each index source, keyed by the source generation and instance(see IndexSource::instance_id()), and its masking state(see
+// IndexSourcesCollection::masking_state_for()), so that
+// when sources are added to(or removed from) a collection, only the new sources, and the sources whose masking state changed, need to be executed.
+//
+// This is opt-in(see QueryResultsCache::set_default()), and only used by exec_query_partitioned() and exec_query_par(), when:
+// - either ExecFlags::DocumentsOnly or ExecFlags::AccumulatedScoreScheme is selected (we can't replay matched_document instances)
+// - no IndexDocumentsFilter is provided (its decisions may change from one execution to the next)
+//
+// Scores are cached as they were provided to MatchedIndexDocumentsFilter::consider(), along with the scorer fingerprint(see
+// IndexSourcesCollectionTermsScorer::fingerprint()), and are only replayed for the same fingerprint. If the scorer provides no
+// fingerprint, ExecFlags::AccumulatedScoreScheme results are not cached.
+#pragma once
+#include "matches.h"
+#include "queries.h"
+#include <ext/flat_hash_map.h>
+#include <list>
+#include <memory>
+#include <mutex>
+
+namespace Trinity
+{
+        // Documents provided to MatchedIndexDocumentsFilter::consider(), in order
+        struct cached_results final
+        {
+                std::vector<docid_t> ids;
+                std::vector<double> scores; // empty unless ExecFlags::AccumulatedScoreScheme was selected
+                bool overflow{false};       // too many to cache
+
+                void replay(MatchedIndexDocumentsFilter *) const;
+
+                inline size_t footprint() const noexcept
+                {
+                        return sizeof(cached_results) + ids.size() * sizeof(docid_t) + scores.size() * sizeof(double);
+                }
+        };
+
+        // Records the documents provided to consider() into out, and forwards them to target
+        struct recording_documents_filter final
+            : public MatchedIndexDocumentsFilter
+        {
+                MatchedIndexDocumentsFilter *const target;
+                cached_results *const out;
+                const size_t limit;
+
+                recording_documents_filter(MatchedIndexDocumentsFilter *const t, cached_results *const o, const size_t l)
+                    : target{t}, out{o}, limit{l}
+                {
+                }
+
+                void consider(const matched_document &match) override final
+                {
+                        target->consider(match);
+                }
+
+                void consider(const docid_t id) override final
+                {
+                        if (out->ids.size() == limit)
+                                out->overflow = true;
+                        else if (!out->overflow)
+                                out->ids.push_back(id);
+
+                        target->consider(id);
+                }
+
+                void consider(const docid_t id, const double score) override final
+                {
+                        if (out->ids.size() == limit)
+                                out->overflow = true;
+                        else if (!out->overflow)
+                        {
+                                out->ids.push_back(id);
+                                out->scores.push_back(score);
+                        }
+
+                        target->consider(id, score);
+                }
+
+                void prepare(const query_index_terms **queryIndicesTerms_) override final
+                {
+                        MatchedIndexDocumentsFilter::prepare(queryIndicesTerms_);
+                        target->prepare(queryIndicesTerms_);
+                }
+        };
+
+        // Buffers the documents provided to consider(), so that they can be replayed into another filter later, e.g
+        // when merging the results of exec_query_partitioned() ranges into a single filter(see exec_query_par_topk())
+        struct buffered_documents_filter final
+            : public MatchedIndexDocumentsFilter
+        {
+                cached_results results;
+
+                void consider(const docid_t id) override final
+                {
+                        results.ids.push_back(id);
+                }
+
+                void consider(const docid_t id, const double score) override final
+                {
+                        results.ids.push_back(id);
+                        results.scores.push_back(score);
+                }
+        };
+
+        class QueryResultsCache final
+        {
+              private:
+                struct source_results final
+                {
+                        uint64_t generation;
+                        // a merged segment assumes the generation of the most recent segment it replaced, so queries still executing on
+                        // the replaced segment may store() results for that generation after it's been replaced; they won't match the new instance
+                        uint64_t instance;
+                        uint64_t maskingState;
+                        uint64_t scorerFingerprint;
+                        std::shared_ptr<const cached_results> results;
+                };
+
+                struct entry final
+                {
+                        uint64_t key;
+                        query original; // for collisions
+                        uint32_t flags;
+                        uint32_t topK;
+                        std::vector<source_results> sources;
+                        size_t footprint;
+                };
+
+              private:
+                const size_t capacity;
+                std::mutex lock;
+                std::list<entry> lru; // most recently used first
+                ska::flat_hash_map<uint64_t, std::list<entry>::iterator> map;
+                size_t footprint{0};
+
+              private:
+                std::list<entry>::iterator find(const query &, const uint64_t key, const uint32_t flags, const uint32_t topK);
+
+                void evict();
+
+              public:
+                // Results of a single source with more matches than that are not cached
+                static constexpr size_t MaxCachedMatches{64 * 1024};
+
+                // capacity is in bytes, for all cached results
+                QueryResultsCache(const size_t c = 256 * 1024 * 1024)
+                    : capacity{c}
+                {
+                }
+
+                static uint64_t key(const query &, const uint32_t flags, const uint32_t topK) noexcept;
+
+                // scorerFingerprint is 0 unless scores are involved
+                std::shared_ptr<const cached_results> lookup(const query &, const uint64_t key, const uint32_t flags, const uint32_t topK, const uint64_t generation, const uint64_t instance, const uint64_t maskingState, const uint64_t scorerFingerprint);
+
+                // Stores the results of a source, recorded in parts(e.g one for each exec_query_partitioned() range); they are concatenated, in order
+                // Results for the same source generation but for a different instance, masking state or scorer fingerprint are replaced.
+                void store(const query &, const uint64_t key, const uint32_t flags, const uint32_t topK, const uint64_t generation, const uint64_t instance, const uint64_t maskingState, const uint64_t scorerFingerprint, const cached_results *parts, const size_t partsCnt);
+
+                // Drops all results of the source with that generation, e.g when it's merged into another source and deleted
+                void invalidate(const uint64_t generation);
+
+                void clear();
+
+                // The cache exec_query_partitioned() and exec_query_par() use; nullptr(the default) disables caching
+                static void set_default(QueryResultsCache *c) noexcept;
+
+                static QueryResultsCache *default_cache() noexcept;
+        };
+}
@@ -1,8 +1,47 @@
 #include "segment_index_source.h"
+#include "elias_fano_codec.h"
 #include "google_codec.h"
 #include "lucene_codec.h"
 
-Trinity::SegmentIndexSource::SegmentIndexSource(const char *basePath)
+// Applies policy hints to memory(page aligned) that holds the index or other postings data
+static void advise(const void *const p, const size_t size, const Trinity::segment_load_policy &policy, const bool populated)
+{
+        auto ptr = const_cast<void *>(p);
+
+        if (!ptr || !size)
+                return;
+
+        switch (policy.indexAccess)
+        {
+                case Trinity::segment_load_policy::Access::Random:
+                        madvise(ptr, size, MADV_RANDOM);
+                        break;
+
+                case Trinity::segment_load_policy::Access::Sequential:
+                        madvise(ptr, size, MADV_SEQUENTIAL);
+                        break;
+
+                default:
+                        break;
+        }
+
+#ifdef MADV_HUGEPAGE
+        if (policy.hugePages)
+                madvise(ptr, size, MADV_HUGEPAGE);
+#endif
+
+        if (policy.populate && !populated)
+        {
+#ifdef MADV_POPULATE_READ
+                if (madvise(ptr, size, MADV_POPULATE_READ) == -1)
+                        madvise(ptr, size, MADV_WILLNEED);
+#else
+                madvise(ptr, size, MADV_WILLNEED);
+#endif
+        }
+}
+
+Trinity::SegmentIndexSource::SegmentIndexSource(const char *basePath, const segment_load_policy policy)
 {
         int fd;
         char path[PATH_MAX];
@@ -44,7 +83,39 @@ Trinity::SegmentIndexSource::SegmentIndexSource(const char *basePath)
                 else
                         close(fd);
 
-                terms.reset(new SegmentTerms(basePath));
+                snprintf(path, sizeof(path), "%s/norms", basePath);
+                fd = open(path, O_RDONLY | O_LARGEFILE);
+
+                if (fd == -1)
+                {
+                        // segments created before norms were supported, or with no documents
+                        if (errno != ENOENT)
+                                throw Switch::system_error("open() failed for norms");
+                }
+                else if (const auto fileSize = lseek64(fd, 0, SEEK_END); fileSize > 0)
+                {
+                        auto fileData = mmap(nullptr, fileSize, PROT_READ, MAP_SHARED, fd, 0);
+
+                        close(fd);
+                        if (unlikely(fileData == MAP_FAILED))
+                                throw Switch::data_error("Failed to access ", path, ":", strerror(errno));
+
+                        madvise(fileData, fileSize, MADV_DONTDUMP);
+                        normsFileData.Set(reinterpret_cast<uint8_t *>(fileData), fileSize);
+
+                        const auto p = normsFileData.start();
+
+                        if (fileSize < sizeof(uint32_t) * 2 || fileSize != sizeof(uint32_t) * 2 + *reinterpret_cast<const uint32_t *>(p + sizeof(uint32_t)))
+                                throw Switch::data_error("Unexpected norms contents");
+
+                        norms.base = *reinterpret_cast<const uint32_t *>(p);
+                        norms.size = *reinterpret_cast<const uint32_t *>(p + sizeof(uint32_t));
+                        norms.data = p + sizeof(uint32_t) * 2;
+                }
+                else
+                        close(fd);
+
+                terms.reset(new SegmentTerms(basePath, policy.willNeedTerms));
 
                 snprintf(path, sizeof(path), "%s/index", basePath);
                 fd = open(path, O_RDONLY | O_LARGEFILE);
@@ -80,14 +151,20 @@ Trinity::SegmentIndexSource::SegmentIndexSource(const char *basePath)
 
                         close(fd);
                         index.Set(p, fileSize);
+
+#ifdef MADV_HUGEPAGE
+                        if (policy.hugePages)
+                                madvise(reinterpret_cast<void *>(uintptr_t(p) & ~uintptr_t(getpagesize() - 1)), fileSize, MADV_HUGEPAGE);
+#endif
 #else
-                        auto fileData = mmap(nullptr, fileSize, PROT_READ, MAP_SHARED, fd, 0);
+                        auto fileData = mmap(nullptr, fileSize, PROT_READ, MAP_SHARED | (policy.populate ? MAP_POPULATE : 0), fd, 0);
 
                         close(fd);
                         if (unlikely(fileData == MAP_FAILED))
                                 throw Switch::data_error("Failed to acess ", path);
 
                         madvise(fileData, fileSize, MADV_DONTDUMP);
+                        advise(fileData, fileSize, policy, true);
                         index.Set(static_cast<const uint8_t *>(fileData), uint32_t(fileSize));
 #endif
                 }
@@ -169,18 +246,78 @@ Trinity::SegmentIndexSource::SegmentIndexSource(const char *basePath)
                         // SLog("Restored codec '", codec, "' sumTermHits = ", dotnotation_repr(defaultFieldStats.sumTermHits), ", totalTerms = ", dotnotation_repr(defaultFieldStats.totalTerms), ", sumTermsDocs = ", dotnotation_repr(defaultFieldStats.sumTermsDocs), ", docsCnt = ", dotnotation_repr(defaultFieldStats.docsCnt), "\n");
                 }
 
-                if (codec.Eq(_S("LUCENE")))
-                        accessProxy.reset(new Trinity::Codecs::Lucene::AccessProxy(basePath, index.start()));
+                Trinity::Codecs::Lucene::IntsEncoding encoding;
+                bool blockMax;
+
+                if (Trinity::Codecs::Lucene::encoding_for_codec_identifier(codec, &encoding, &blockMax))
+                {
+                        auto ap = new Trinity::Codecs::Lucene::AccessProxy(basePath, index.start(), nullptr, encoding, blockMax);
+
+                        accessProxy.reset(ap);
+                        advise(ap->hitsDataPtr, ap->hitsDataSize, policy, false);
+                }
 #ifdef TRINITY_CODECS_GOOGLE_AVAILABLE
                 else if (codec.Eq(_S("GOOGLE")))
                         accessProxy.reset(new Trinity::Codecs::Google::AccessProxy(basePath, index.start()));
+#endif
+#ifdef TRINITY_CODECS_ELIASFANO_AVAILABLE
+                else if (codec.Eq(_S("ELIASFANO")))
+                {
+                        auto ap = new Trinity::Codecs::EliasFano::AccessProxy(basePath, index.start());
+
+                        accessProxy.reset(ap);
+                        advise(ap->hitsDataPtr, ap->hitsDataSize, policy, false);
+                }
 #endif
                 else
                         throw Switch::data_error("Unknown codec");
         }
         catch (...)
         {
+                if (auto ptr = (void *)normsFileData.offset)
+                        munmap(ptr, normsFileData.size());
+
 		ResetRefs();
 		throw;
         }
 }
+
+std::future<void> Trinity::SegmentIndexSource::prewarm(const std::vector<str8_t> &topTerms)
+{
+        std::unique_ptr<simple_allocator> allocator(new simple_allocator(4096));
+        std::vector<str8_t> v;
+
+        v.reserve(topTerms.size());
+        for (const auto &it : topTerms)
+                v.push_back({allocator->CopyOf(it.data(), it.size()), it.size()});
+
+        Retain();
+        return std::async(std::launch::async, [this](const auto terms, const auto allocator) {
+                static const size_t pageSize = getpagesize();
+                uint8_t sum{0};
+
+                Defer({
+                        Release();
+                });
+
+                for (const auto term : terms)
+                {
+                        // also caches the term_index_ctx
+                        const auto tctx = term_ctx(term);
+
+                        if (!tctx.documents || !index.size())
+                                continue;
+
+                        const auto *const chunk = index.start() + tctx.indexChunk.offset;
+                        const auto *const end = chunk + tctx.indexChunk.size();
+                        const auto *p = reinterpret_cast<const uint8_t *>(uintptr_t(chunk) & ~uintptr_t(pageSize - 1));
+
+                        madvise(const_cast<uint8_t *>(p), end - p, MADV_WILLNEED);
+                        for (; p < end; p += pageSize)
+                                sum += *reinterpret_cast<const volatile uint8_t *>(p);
+                }
+
+                (void)sum;
+        },
+                          std::move(v), std::move(allocator));
+}
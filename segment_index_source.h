@@ -2,9 +2,36 @@
 #include "index_source.h"
 #include "terms.h"
 #include "docidupdates.h"
+#include <future>
 
 namespace Trinity
 {
+        // How a segment's files are mapped and accessed
+        // The defaults provide no hints to the kernel, so the first queries after a segment is loaded will page-fault
+        // their way through cold postings. This is mostly about tail latency right after segments are loaded; see also SegmentIndexSource::prewarm()
+        struct segment_load_policy final
+        {
+                enum class Access : uint8_t
+                {
+                        Normal = 0,
+                        Random,    // MADV_RANDOM; no read-ahead
+                        Sequential // MADV_SEQUENTIAL; aggressive read-ahead
+                };
+
+                // MAP_POPULATE the index (and MADV_POPULATE_READ or MADV_WILLNEED for hits.data, if any), so that
+                // all page faults are paid for when the segment is loaded
+                bool populate{false};
+
+                // MADV_HUGEPAGE for the index and hits.data
+                // Only effective if the kernel supports transparent huge pages for read-only file mappings, or if TRINITY_MEMRESIDENT_INDEX is defined
+                bool hugePages{false};
+
+                // MADV_WILLNEED for terms.data (the terms skiplist is always loaded in memory)
+                bool willNeedTerms{false};
+
+                Access indexAccess{Access::Normal};
+        };
+
 	// You can use SegmentIndexSession to create a new segment
 	// This is a utility class
         class SegmentIndexSource final
@@ -33,8 +60,17 @@ namespace Trinity
 			}
                 } maskedDocuments;
 
+                // see norms.h
+                norms_view norms;
+                range_base<const uint8_t *, uint32_t> normsFileData;
+
               public:
-                SegmentIndexSource(const char *basePath);
+                SegmentIndexSource(const char *basePath, const segment_load_policy policy = {});
+
+                // Resolves each term and touches its postings in the background, so that they are cached/paged in
+                // before queries need them. You should provide the most frequently queried terms.
+                // The segment is retained until that's done.
+                std::future<void> prewarm(const std::vector<str8_t> &topTerms);
 
 		bool index_empty() const noexcept override final
 		{
@@ -51,6 +87,14 @@ namespace Trinity
 			return accessProxy.get();
 		}
 
+		// Decoders of this segment may share decoded state(e.g the Lucene codec caches decoded skiplists)
+		// Those are the hits/misses for that cache, so that you can tell if it's worth it, or if you need to adjust its capacity
+		// (see e.g Codecs::Lucene::skiplists_cache::set_capacity())
+		auto decoders_cache_stats() const
+		{
+			return accessProxy ? accessProxy->decoders_cache_stats() : Trinity::Codecs::AccessProxy::cache_stats{};
+		}
+
                 field_statistics default_field_stats() override final
 		{
 			return defaultFieldStats;
@@ -76,8 +120,21 @@ namespace Trinity
                         return maskedDocuments.set;
                 }
 
+                norms_view doc_norms() override final
+                {
+                        return norms;
+                }
+
+                uint8_t doc_norm(const isrc_docid_t id) override final
+                {
+                        return norms[id];
+                }
+
                 ~SegmentIndexSource()
 		{
+                        if (auto ptr = (void *)normsFileData.offset)
+                                munmap(ptr, normsFileData.size());
+
 			if (auto ptr = (void *)index.offset)
 			{
 #ifdef TRINITY_MEMRESIDENT_INDEX
@@ -1,18 +1,86 @@
 #include "similarity.h"
+#if defined(__AVX2__) || defined(__SSE4_1__)
+#include <immintrin.h>
+#endif
 
 static bool init()
 {
 	auto t{Trinity::Similarity::IndexSourcesCollectionBM25Scorer::Scorer::normalizationTable};
 
 	for (uint32_t i{0}; i != 256; ++i)
-        {
-                const float f(i);
-
-                t[i] = 1.0 / (f * f);
-        }
+                t[i] = Trinity::Norms::decode_length(i);
 
 	return true;
 }
 
 float Trinity::Similarity::IndexSourcesCollectionBM25Scorer::Scorer::normalizationTable[256];
 bool Trinity::Similarity::IndexSourcesCollectionBM25Scorer::Scorer::initializer = init();
+
+// The batch scorers compute in single precision, whereas score() mixes float and double, so scores may differ in the last bits
+void Trinity::Similarity::IndexSourcesCollectionTFIDFScorer::Scorer::score_batch(const isrc_docid_t *const ids, const uint16_t *const freqs, const size_t n, const Similarity::ScorerWeight *const sw, float *const out)
+{
+        const float v = static_cast<const ScorerWeight *>(sw)->v;
+        size_t i{0};
+
+#if defined(__AVX2__)
+        const __m256 w = _mm256_set1_ps(v);
+
+        for (; i + 8 <= n; i += 8)
+        {
+                const __m256i f = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(freqs + i)));
+
+                _mm256_storeu_ps(out + i, _mm256_mul_ps(_mm256_sqrt_ps(_mm256_cvtepi32_ps(f)), w));
+        }
+#elif defined(__SSE4_1__)
+        const __m128 w = _mm_set1_ps(v);
+
+        for (; i + 4 <= n; i += 4)
+        {
+                const __m128i f = _mm_cvtepu16_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(freqs + i)));
+
+                _mm_storeu_ps(out + i, _mm_mul_ps(_mm_sqrt_ps(_mm_cvtepi32_ps(f)), w));
+        }
+#endif
+
+        for (; i < n; ++i)
+                out[i] = tf(freqs[i]) * v;
+}
+
+void Trinity::Similarity::IndexSourcesCollectionBM25Scorer::Scorer::score_batch(const isrc_docid_t *const ids, const uint16_t *const freqs, const size_t n, const Similarity::ScorerWeight *const weight, float *const out)
+{
+        const auto w = static_cast<const ScorerWeight *>(weight);
+        const float idf = w->idf;
+        size_t i{0};
+
+#if defined(__AVX2__)
+        // norms are bytes, so we load them individually, and then gather the normalization factors from w->cache[]
+        const __m256 vidf = _mm256_set1_ps(idf);
+
+        for (; i + 8 <= n; i += 8)
+        {
+                const __m256i idx = _mm256_setr_epi32(norms[ids[i]], norms[ids[i + 1]], norms[ids[i + 2]], norms[ids[i + 3]],
+                                                      norms[ids[i + 4]], norms[ids[i + 5]], norms[ids[i + 6]], norms[ids[i + 7]]);
+                const __m256 norm = _mm256_i32gather_ps(w->cache, idx, sizeof(float));
+                const __m256 f = _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(freqs + i))));
+
+                _mm256_storeu_ps(out + i, _mm256_div_ps(_mm256_mul_ps(vidf, f), _mm256_add_ps(f, norm)));
+        }
+#elif defined(__SSE4_1__)
+        const __m128 vidf = _mm_set1_ps(idf);
+
+        for (; i + 4 <= n; i += 4)
+        {
+                const __m128 norm = _mm_setr_ps(w->cache[norms[ids[i]]], w->cache[norms[ids[i + 1]]], w->cache[norms[ids[i + 2]]], w->cache[norms[ids[i + 3]]]);
+                const __m128 f = _mm_cvtepi32_ps(_mm_cvtepu16_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(freqs + i))));
+
+                _mm_storeu_ps(out + i, _mm_div_ps(_mm_mul_ps(vidf, f), _mm_add_ps(f, norm)));
+        }
+#endif
+
+        for (; i < n; ++i)
+        {
+                const float f = freqs[i];
+
+                out[i] = idf * f / (f + w->cache[norms[ids[i]]]);
+        }
+}
@@ -46,6 +46,28 @@ namespace Trinity
                         // Scores a single document; freq is the number of matches in the current document of
 			// either a single term or a phrase
                         virtual float score(const isrc_docid_t id, const uint16_t freq, const ScorerWeight *) = 0;
+
+                        // Scores n documents of the same term or phrase, i.e out[i] = score(ids[i], freqs[i], weight)
+                        // The execution engine uses it to score whole decoded blocks of postings lists, instead of paying for a virtual score() call
+                        // for every document. The default impl. just invokes score(); you should override it if you can do better (e.g SIMD)
+                        virtual void score_batch(const isrc_docid_t *const ids, const uint16_t *const freqs, const size_t n, const ScorerWeight *const weight, float *const out)
+                        {
+                                for (size_t i{0}; i != n; ++i)
+                                        out[i] = score(ids[i], freqs[i], weight);
+                        }
+
+                        // Dynamic pruning support (see exec_query() topK)
+                        // If score() is monotonically non-decreasing in freq, and you can provide an upper bound of score() for any document
+                        // where freq <= maxFreq, override both methods, so that the execution engine can skip documents that can't make it into the top-k
+                        virtual bool provides_max_score() const
+                        {
+                                return false;
+                        }
+
+                        virtual float max_score(const uint16_t maxFreq, const ScorerWeight *)
+                        {
+                                return std::numeric_limits<float>::max();
+                        }
                 };
 
                 struct IndexSourcesCollectionTermsScorer
@@ -58,9 +80,29 @@ namespace Trinity
 
                         virtual IndexSourceTermsScorer *new_source_scorer(IndexSource *) = 0;
 
+                        // Cached query results scores(see results_cache.h) are only reused if this is unchanged
+                        // It should identify the state the scores depend on, e.g collection-wide statistics aggregated in reset()
+                        // 0(the default) means it's unknown, and scores are never cached.
+                        virtual uint64_t fingerprint() const noexcept
+                        {
+                                return 0;
+                        }
+
                         virtual ~IndexSourcesCollectionTermsScorer()
                         {
                         }
+
+                      protected:
+                        // Identifies the sources of a collection; for scorers that depend on statistics of all of them
+                        static uint64_t collection_fingerprint(const IndexSourcesCollection *const c) noexcept
+                        {
+                                uint64_t h{0xcbf29ce484222325ull};
+
+                                // instances, not generations; a segment merged by itself assumes its generation, but not its statistics
+                                for (const auto it : c->sources)
+                                        h = (h ^ it->instance_id()) * 0x100000001b3ull;
+                                return h ? h : 1;
+                        }
                 };
 
                 // A trivial scorer that simply scores based on the matches
@@ -79,12 +121,28 @@ namespace Trinity
                                 {
                                         return freq;
                                 }
+
+                                bool provides_max_score() const override final
+                                {
+                                        return true;
+                                }
+
+                                float max_score(const uint16_t maxFreq, const ScorerWeight *) override final
+                                {
+                                        return maxFreq;
+                                }
                         };
 
                         IndexSourceTermsScorer *new_source_scorer(IndexSource *s) override final
                         {
                                 return new Scorer(this, s);
                         }
+
+                        // scores only depend on the freqs
+                        uint64_t fingerprint() const noexcept override final
+                        {
+                                return 1;
+                        }
                 };
 
                 // A TF-IDF scorer
@@ -93,6 +151,7 @@ namespace Trinity
                 {
                         IndexSource::field_statistics dfsAccum;
                         const IndexSourcesCollection *collection;
+                        uint64_t collectionFingerprint{0};
 
                         struct Scorer final
                             : public IndexSourceTermsScorer
@@ -165,6 +224,18 @@ namespace Trinity
                                         // TODO: if we had normalizations, we 'd instead return v * decodeNormValue(id) or something
                                         return v;
                                 }
+
+                                void score_batch(const isrc_docid_t *const ids, const uint16_t *const freqs, const size_t n, const Similarity::ScorerWeight *const sw, float *const out) override final;
+
+                                bool provides_max_score() const override final
+                                {
+                                        return true;
+                                }
+
+                                float max_score(const uint16_t maxFreq, const Similarity::ScorerWeight *sw) override final
+                                {
+                                        return tf(maxFreq) * static_cast<const ScorerWeight *>(sw)->v;
+                                }
                         };
 
                         // currently, no support for multiple fields
@@ -183,6 +254,13 @@ namespace Trinity
                                         dfsAccum.sumTermsDocs += s.sumTermsDocs;
                                         dfsAccum.docsCnt += s.docsCnt;
                                 }
+                                // idf depends on the documents frequencies across all sources
+                                collectionFingerprint = collection_fingerprint(c);
+                        }
+
+                        uint64_t fingerprint() const noexcept override final
+                        {
+                                return collectionFingerprint;
                         }
 
                         IndexSourceTermsScorer *new_source_scorer(IndexSource *s) override final
@@ -196,6 +274,7 @@ namespace Trinity
                 {
                         IndexSource::field_statistics dfsAccum;
                         const IndexSourcesCollection *collection;
+                        uint64_t collectionFingerprint{0};
                         // controls non-linear term frequence normalization (saturation)
                         static constexpr float k1{1.2};
                         // controls degree document length normalizes tf valuies
@@ -204,8 +283,10 @@ namespace Trinity
                         struct Scorer final
                             : public IndexSourceTermsScorer
                         {
-                                static float normalizationTable[256]; // will be initialized elsewhere
+                                // decoded document length for each norm; will be initialized elsewhere
+                                static float normalizationTable[256];
                                 static bool initializer;
+                                const norms_view norms;
 
                                 static inline double idf(const uint32_t docFreq, const uint64_t docsCnt)
                                 {
@@ -218,7 +299,7 @@ namespace Trinity
                                 }
 
                                 Scorer(IndexSourcesCollectionTermsScorer *r, IndexSource *src)
-                                    : IndexSourceTermsScorer(r, src)
+                                    : IndexSourceTermsScorer(r, src), norms{src->doc_norms()}
                                 {
                                 }
 
@@ -226,18 +307,21 @@ namespace Trinity
                                     : public Similarity::ScorerWeight
                                 {
                                         const double idf;
-                                        const uint32_t avgDocTermFrq;
+                                        const float avgDocLength;
+                                        // k1 * (1 - b + b * docLength / avgDocLength) for each norm
                                         float cache[256];
+                                        // lowest of cache[], for max_score()
+                                        float minNorm;
 
-                                        ScorerWeight(const double i, const uint32_t a)
-                                            : idf{i}, avgDocTermFrq{a}
+                                        ScorerWeight(const double i, const float a)
+                                            : idf{i}, avgDocLength{a}
                                         {
                                         }
                                 };
 
                                 ScorerWeight *new_scorer_weight(const str8_t *const terms, const uint16_t cnt) override final
                                 {
-                                        const auto cs = static_cast<IndexSourcesCollectionTFIDFScorer *>(collectionScorer);
+                                        const auto cs = static_cast<IndexSourcesCollectionBM25Scorer *>(collectionScorer);
                                         const auto collection = cs->collection;
                                         const auto &stats = cs->dfsAccum;
                                         const auto documentsCnt{stats.docsCnt};
@@ -254,24 +338,40 @@ namespace Trinity
                                                 idf_ += idf(df, documentsCnt);
                                         }
 
-                                        const auto avgDocTermFrq = stats.sumTermsDocs / stats.docsCnt;
-                                        auto w = std::make_unique<ScorerWeight>(idf_, avgDocTermFrq);
+                                        const float avgDocLength = stats.docsCnt ? double(stats.sumTermHits) / stats.docsCnt : 0;
+                                        auto w = std::make_unique<ScorerWeight>(idf_, avgDocLength);
 
-                                        for (uint32_t i{0}; i != 256; ++i)
-                                                w->cache[i] = k1 * ((1 - b) + b * double(normalizationTable[i] / avgDocTermFrq));
+                                        // norm 0 means we don't know the document's length, so we 'll treat it as an average length document
+                                        w->cache[0] = k1;
+                                        for (uint32_t i{1}; i != 256; ++i)
+                                                w->cache[i] = avgDocLength ? k1 * ((1 - b) + b * double(normalizationTable[i] / avgDocLength)) : k1;
 
+                                        w->minNorm = *std::min_element(w->cache, w->cache + 256);
                                         return w.release();
                                 }
 
                                 inline float score(const isrc_docid_t id, const uint16_t freq, const Similarity::ScorerWeight *weight) override final
                                 {
-                                        // otherwise cache[norms.get(doc)]
-                                        const auto norm{k1};
                                         const auto w = static_cast<const ScorerWeight *>(weight);
+                                        const auto norm = w->cache[norms[id]];
                                         const auto idf = w->idf;
 
                                         return idf * float(freq) / double(freq + norm);
                                 }
+
+                                void score_batch(const isrc_docid_t *const ids, const uint16_t *const freqs, const size_t n, const Similarity::ScorerWeight *const weight, float *const out) override final;
+
+                                bool provides_max_score() const override final
+                                {
+                                        return true;
+                                }
+
+                                float max_score(const uint16_t maxFreq, const Similarity::ScorerWeight *weight) override final
+                                {
+                                        const auto w = static_cast<const ScorerWeight *>(weight);
+
+                                        return w->idf * float(maxFreq) / double(maxFreq + w->minNorm);
+                                }
                         };
 
                         void reset(const IndexSourcesCollection *const c) override final
@@ -288,6 +388,13 @@ namespace Trinity
                                         dfsAccum.sumTermsDocs += s.sumTermsDocs;
                                         dfsAccum.docsCnt += s.docsCnt;
                                 }
+                                // idf depends on the documents frequencies across all sources
+                                collectionFingerprint = collection_fingerprint(c);
+                        }
+
+                        uint64_t fingerprint() const noexcept override final
+                        {
+                                return collectionFingerprint;
                         }
 
                         IndexSourceTermsScorer *new_source_scorer(IndexSource *s) override final
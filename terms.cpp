@@ -178,7 +178,7 @@ void Trinity::pack_terms(std::vector<std::pair<str8_t, term_index_ctx>> &terms,
         }
 }
 
-Trinity::SegmentTerms::SegmentTerms(const char *segmentBasePath)
+Trinity::SegmentTerms::SegmentTerms(const char *segmentBasePath, const bool willNeed)
 {
         int fd;
 
@@ -227,6 +227,9 @@ Trinity::SegmentTerms::SegmentTerms(const char *segmentBasePath)
                         throw Switch::data_error("Failed to access ", Buffer{}.append(segmentBasePath, "/terms.data").AsS32(), ": ", strerror(errno));
 
 		madvise(fileData, fileSize, MADV_DONTDUMP);
+                if (willNeed)
+                        madvise(fileData, fileSize, MADV_WILLNEED);
+
                 termsData.Set(reinterpret_cast<const uint8_t *>(fileData), fileSize);
         }
         else
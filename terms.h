@@ -180,7 +180,8 @@ namespace Trinity
                 range_base<const uint8_t *, uint32_t> termsData;
 
               public:
-                SegmentTerms(const char *segmentBasePath);
+                // If willNeed is set, the kernel will be advised(MADV_WILLNEED) to read ahead terms.data
+                SegmentTerms(const char *segmentBasePath, const bool willNeed = false);
 
                 ~SegmentTerms()
                 {